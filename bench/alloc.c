@@ -0,0 +1,121 @@
+/*
+ * Calls to malloc per transaction, with and without the object pools.
+ * Worker threads each commit transactions of two PUTs and one GET on
+ * random keys.  Every malloc and calloc made by a worker thread is counted
+ * by wrapping them here.  Transactions, versions, dependencies and write
+ * set entries come from the pools; blobs and keys still come from malloc.
+ *
+ * Usage: bin/bench_alloc [threads] [txns_per_thread] [keys]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "transaction_ext.h"
+#include "store_ext.h"
+#include "pool.h"
+
+CLIENT_REGISTRY *client_registry;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+
+static __thread size_t mallocs = 0;
+
+void *malloc(size_t size) {
+    mallocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    mallocs++;
+    return __libc_calloc(n, size);
+}
+
+static int txns_per_thread = 200000;
+static int num_keys = 10000;
+
+typedef struct {
+    long id;
+    size_t mallocs;
+    size_t aborts;
+} WORKER;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static KEY *make_key(unsigned int n) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "user:%u", n);
+    return key_create(blob_create(buf, len));
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    unsigned int seed = wp->id + 1;
+    size_t start = mallocs;
+    for(int i = 0; i < txns_per_thread; i++) {
+        TRANSACTION *tp = trans_create();
+        BLOB *bp = NULL;
+        int aborted = store_put(tp, make_key(rand_r(&seed) % num_keys), blob_create("value", 5)) == TRANS_ABORTED ||
+                      store_put(tp, make_key(rand_r(&seed) % num_keys), blob_create("value", 5)) == TRANS_ABORTED ||
+                      store_get(tp, make_key(rand_r(&seed) % num_keys), &bp) == TRANS_ABORTED;
+        blob_unref(bp, "bench");
+        if(aborted) {
+            trans_abort(tp);
+            wp->aborts++;
+        } else if(trans_commit(tp) == TRANS_ABORTED) {
+            wp->aborts++;
+        }
+    }
+    wp->mallocs = mallocs - start;
+    return NULL;
+}
+
+static void run(int caching, int nthreads) {
+    pool_caching = caching;
+    store_init();
+    store_gc_start();
+    pthread_t tids[nthreads];
+    WORKER w[nthreads];
+    double t = now();
+    for(long i = 0; i < nthreads; i++) {
+        w[i] = (WORKER){ .id = i };
+        pthread_create(&tids[i], NULL, worker, &w[i]);
+    }
+    size_t total_mallocs = 0, aborts = 0;
+    for(int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        total_mallocs += w[i].mallocs;
+        aborts += w[i].aborts;
+    }
+    double s = now() - t;
+    store_fini();
+    size_t total = (size_t)nthreads * txns_per_thread;
+    printf("%-6s %10.0f %14.2f %8zu\n", caching ? "on" : "off", total / s,
+           (double)total_mallocs / total, aborts);
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2) txns_per_thread = atoi(argv[2]);
+    if(argc > 3) num_keys = atoi(argv[3]);
+    trans_init();
+    trans_track_writes = 1;
+    printf("%d threads, %d transactions each, %d keys\n", nthreads, txns_per_thread, num_keys);
+    printf("%-6s %10s %14s %8s\n", "pools", "txns/s", "mallocs/txn", "aborts");
+    // Nothing pooled may be live when the setting changes, so the run
+    // without pools comes first.
+    run(0, nthreads);
+    run(1, nthreads);
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Cost of aborts to clients, with and without server-side retry.  Client
+ * threads run read-modify-write transactions on a few hot keys against a
+ * server listening on the loopback interface, each on a connection kept
+ * for the whole run.  Without retry, each operation is a request and
+ * reply, and the client redoes a transaction that aborts.  With retry,
+ * each transaction is one BATCH, and the server reruns it when it aborts.
+ * Reported are committed transactions per second, and the retries per
+ * commit made by the clients and by the server.
+ *
+ * Usage: bin/bench_batch [threads] [txns_per_thread] [keys] [ops]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include "client_registry.h"
+#include "csapp.h"
+#include "data.h"
+#include "protocol.h"
+#include "protocol_ext.h"
+#include "server.h"
+#include "server_ext.h"
+#include "store_ext.h"
+#include "transaction.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static char port[16];
+static int txns_per_thread = 2000;
+static int num_keys = 8;
+static int ops_per_trans = 2;
+
+typedef struct {
+    long id;
+    int batch;
+    size_t retries;
+} WORKER;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Headers and payloads are written separately, so Nagle's algorithm would
+ * hold each request back for the ACK of the one before.
+ */
+static int nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void *acceptor(void *arg) {
+    int listenfd = *(int *)arg;
+    for(;;) {
+        int *fdp = Malloc(sizeof(int));
+        *fdp = nodelay(Accept(listenfd, NULL, NULL));
+        pthread_t tid;
+        Pthread_create(&tid, NULL, xacto_client_service, fdp);
+    }
+    return NULL;
+}
+
+static int send_pkt(int fd, uint8_t type, void *data, size_t size) {
+    XACTO_PACKET pkt = { .type = type, .size = size, .null = data == NULL };
+    return proto_send_packet(fd, &pkt, data);
+}
+
+/*
+ * Receive a packet and discard its payload.
+ *
+ * @return  The status field, or -1 if the connection closed.
+ */
+static int recv_pkt(int fd) {
+    XACTO_PACKET pkt;
+    void *data = NULL;
+    if(proto_recv_packet(fd, &pkt, &data) != 0) return -1;
+    Free(data);
+    return pkt.status;
+}
+
+/*
+ * Send the operations of a transaction: a GET and a PUT of each key.
+ * Unless batch is set, wait for the reply to each one, and stop at one
+ * that says the transaction aborted.
+ *
+ * @return  0 if no reply said the transaction aborted, otherwise -1.
+ */
+static int send_ops(int fd, unsigned int *seed, int batch) {
+    char key[32];
+    for(int i = 0; i < ops_per_trans; i++) {
+        int len = snprintf(key, sizeof(key), "hot:%d", rand_r(seed) % num_keys);
+        if(send_pkt(fd, XACTO_GET_PKT, NULL, 0) != 0 || send_pkt(fd, XACTO_KEY_PKT, key, len) != 0)
+            return -1;
+        if(!batch){
+            int status = recv_pkt(fd);
+            if(recv_pkt(fd) < 0 || status != TRANS_PENDING) return -1;
+        }
+        if(send_pkt(fd, XACTO_PUT_PKT, NULL, 0) != 0 || send_pkt(fd, XACTO_KEY_PKT, key, len) != 0 ||
+           send_pkt(fd, XACTO_VALUE_PKT, "value", 5) != 0)
+            return -1;
+        if(!batch && recv_pkt(fd) != TRANS_PENDING) return -1;
+    }
+    return 0;
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    unsigned int seed = wp->id + 1;
+    int fd = nodelay(open_clientfd("localhost", port));
+    for(int i = 0; i < txns_per_thread; i++) {
+        for(;;) {
+            if(wp->batch) {
+                // The replies to the GETs follow a committed reply.
+                if(send_pkt(fd, XACTO_BATCH_PKT, NULL, 0) == 0 && send_ops(fd, &seed, 1) == 0 &&
+                   send_pkt(fd, XACTO_COMMIT_PKT, NULL, 0) == 0 && recv_pkt(fd) == TRANS_COMMITTED) {
+                    for(int j = 0; j < ops_per_trans; j++) recv_pkt(fd);
+                    break;
+                }
+                continue;
+            }
+            if(send_ops(fd, &seed, 0) == 0 && send_pkt(fd, XACTO_COMMIT_PKT, NULL, 0) == 0 &&
+               recv_pkt(fd) == TRANS_COMMITTED)
+                break;
+            wp->retries++;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void run(int batch, int nthreads) {
+    pthread_t tids[nthreads];
+    WORKER w[nthreads];
+    SERVER_BATCH_STATS before, after;
+    server_get_batch_stats(&before);
+    double t = now();
+    for(long i = 0; i < nthreads; i++) {
+        w[i] = (WORKER){ .id = i, .batch = batch };
+        pthread_create(&tids[i], NULL, worker, &w[i]);
+    }
+    size_t retries = 0;
+    for(int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        retries += w[i].retries;
+    }
+    double s = now() - t;
+    server_get_batch_stats(&after);
+    size_t commits = (size_t)nthreads * txns_per_thread;
+    printf("%-8s %12.0f %18.3f %18.3f\n", batch ? "batch" : "per-op", commits / s,
+           (double)retries / commits, (double)(after.retries - before.retries) / commits);
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 8;
+    if(argc > 2) txns_per_thread = atoi(argv[2]);
+    if(argc > 3) num_keys = atoi(argv[3]);
+    if(argc > 4) ops_per_trans = atoi(argv[4]);
+    client_registry = creg_init();
+    trans_init();
+    store_init();
+    store_gc_start();
+
+    int listenfd = open_listenfd("0");
+    // The port is in the same place for IPv4 and IPv6.
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    getsockname(listenfd, (struct sockaddr *)&addr, &len);
+    snprintf(port, sizeof(port), "%d", ntohs(((struct sockaddr_in *)&addr)->sin_port));
+    pthread_t tid;
+    pthread_create(&tid, NULL, acceptor, &listenfd);
+
+    printf("%d threads, %d transactions each, %d keys, %d GET/PUT pairs per transaction\n",
+           nthreads, txns_per_thread, num_keys, ops_per_trans);
+    printf("%-8s %12s %18s %18s\n", "mode", "commits/s", "client retries", "server retries");
+    run(0, nthreads);
+    run(1, nthreads);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Bytes allocated and copied per PUT, for values of several sizes.  Each
+ * PUT stores a new key with a value whose content comes from a buffer, as
+ * the server's does from the packet it received.  Every malloc, calloc,
+ * realloc and memcpy made by this thread is counted by wrapping them here,
+ * so the counts cover the whole PUT, not only the blobs.
+ *
+ * Usage: bin/bench_blob [puts]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+
+CLIENT_REGISTRY *client_registry;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static __thread size_t allocated = 0;
+static __thread size_t copied = 0;
+
+void *malloc(size_t size) {
+    allocated += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    allocated += n * size;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocated += size;
+    return __libc_realloc(ptr, size);
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    copied += n;
+    return memmove(dst, src, n);
+}
+
+int main(int argc, char *argv[]) {
+    int puts = argc > 1 ? atoi(argv[1]) : 100000;
+    size_t sizes[] = { 8, 64, 1024, 16384 };
+    char *buf = malloc(sizes[3]);
+    memset(buf, 'v', sizes[3]);
+    trans_init();
+    store_init();
+    printf("%d PUTs of each size\n", puts);
+    printf("%8s %16s %16s\n", "size", "allocated/PUT", "copied/PUT");
+    for(int i = 0; i < 4; i++) {
+        TRANSACTION *tp = trans_create();
+        char key[32];
+        size_t a = allocated, c = copied;
+        for(int j = 0; j < puts; j++) {
+            int len = snprintf(key, sizeof(key), "%zu:%d", sizes[i], j);
+            store_put(tp, key_create(blob_create(key, len)), blob_create(buf, sizes[i]));
+        }
+        printf("%8zu %16.1f %16.1f\n", sizes[i], (double)(allocated - a) / puts,
+               (double)(copied - c) / puts);
+        trans_commit(tp);
+    }
+    store_fini();
+    free(buf);
+    return 0;
+}
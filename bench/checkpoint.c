@@ -0,0 +1,133 @@
+/*
+ * Latency of writes while snapshots are taken of a live store.  Writer
+ * threads each commit transactions of one PUT to random keys, first with
+ * nothing else going on, and then while another thread writes snapshots
+ * back to back.  A snapshot holds a segment lock only for a batch of
+ * buckets at a time, so the writers should barely notice it.
+ *
+ * Usage: bin/bench_checkpoint [threads] [ops_per_thread] [keys] [file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+#include "snapshot.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static int ops_per_thread = 100000;
+static int num_keys = 200000;
+static char *path = "/tmp/bench_checkpoint.snp";
+static volatile int writers_done;
+
+typedef struct {
+    long id;
+    uint32_t *txn_ns;       // Latency of each whole transaction.
+} WORKER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static KEY *make_key(unsigned int n) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "user:%u", n);
+    return key_create(blob_create(buf, len));
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    unsigned int seed = wp->id + 1;
+    char value[100];
+    for(int i = 0; i < ops_per_thread; i++) {
+        unsigned int k = rand_r(&seed) % num_keys;
+        int n = snprintf(value, sizeof(value), "value %d of %ld", i, wp->id);
+        KEY *kp = make_key(k);
+        uint64_t t0 = now_ns();
+        TRANSACTION *tp = trans_create();
+        if(store_put(tp, kp, blob_create(value, n)) == TRANS_ABORTED) {
+            trans_abort(tp);
+        } else {
+            trans_commit(tp);
+        }
+        wp->txn_ns[i] = now_ns() - t0;
+    }
+    return NULL;
+}
+
+static void *checkpointer(void *arg) {
+    int *count = arg;
+    while(!writers_done) {
+        if(snapshot_write(path) < 0) exit(1);
+        (*count)++;
+    }
+    return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(uint32_t *v, size_t n, double p) {
+    return n == 0 ? 0 : v[(size_t)(p * (n - 1))];
+}
+
+static void run(int checkpoints, int nthreads) {
+    store_init();
+    store_gc_start();
+    TRANSACTION *tp = trans_create();
+    for(int k = 0; k < num_keys; k++)
+        store_put(tp, make_key(k), blob_create("initial value, about as long as the others", 42));
+    trans_commit(tp);
+
+    pthread_t tids[nthreads], ctid;
+    WORKER w[nthreads];
+    size_t total = (size_t)nthreads * ops_per_thread;
+    uint32_t *txn_ns = malloc(total * sizeof(uint32_t));
+    int count = 0;
+    writers_done = 0;
+    uint64_t t = now_ns();
+    if(checkpoints) pthread_create(&ctid, NULL, checkpointer, &count);
+    for(long i = 0; i < nthreads; i++) {
+        w[i] = (WORKER){ .id = i, .txn_ns = txn_ns + i * ops_per_thread };
+        pthread_create(&tids[i], NULL, worker, &w[i]);
+    }
+    for(int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    double s = (now_ns() - t) / 1e9;
+    writers_done = 1;
+    if(checkpoints) pthread_join(ctid, NULL);
+    store_fini();
+
+    qsort(txn_ns, total, sizeof(uint32_t), cmp_u32);
+    printf("%-11s %10.0f %8.0f %8.0f %8.0f %10.0f %6d\n", checkpoints ? "checkpoint" : "none",
+           total / s, pct(txn_ns, total, 0.50), pct(txn_ns, total, 0.99),
+           pct(txn_ns, total, 0.999), pct(txn_ns, total, 1.0), count);
+    free(txn_ns);
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2) ops_per_thread = atoi(argv[2]);
+    if(argc > 3) num_keys = atoi(argv[3]);
+    if(argc > 4) path = argv[4];
+    trans_init();
+    printf("%d threads, %d commits each, %d keys (latencies in ns)\n",
+           nthreads, ops_per_thread, num_keys);
+    printf("%-11s %10s %8s %8s %8s %10s %6s\n", "background", "commits/s", "p50", "p99", "p99.9", "max", "snaps");
+    run(0, nthreads);
+    run(1, nthreads);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * Growth of resident memory over a long run of PUTs that replace values
+ * of mixed sizes.  Worker threads each commit transactions that PUT a
+ * random key (32 bytes) with a value of a random size from 512 to 4096
+ * bytes, so the number of live values stays the same while their memory
+ * is freed and allocated over and over.  The collector thread is not
+ * started, so each PUT removes the version it replaces and the live data
+ * stays the same size however far behind a collector would fall.  Each
+ * second the resident set size (RSS) of the process is shown, with the
+ * counters of the slab allocator (see slab.h).  The run is made twice,
+ * each in a process of its own: with the object pools, and so the slab
+ * allocator, turned off, so that all blob memory comes from malloc, and
+ * then with them on.  Reported at the end of each run is how much RSS
+ * grew after the first second.
+ *
+ * Usage: bin/bench_churn [seconds] [threads] [keys]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "data_ext.h"
+#include "transaction.h"
+#include "store_ext.h"
+#include "pool.h"
+#include "slab.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static int seconds = 30;
+static int num_keys = 20000;
+static int stop = 0;
+static char value[4096];
+
+typedef struct {
+    long id;
+    size_t puts;
+} WORKER;
+
+static double rss_mb(void) {
+    long size = 0, pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if(f != NULL) {
+        if(fscanf(f, "%ld %ld", &size, &pages) != 2) pages = 0;
+        fclose(f);
+    }
+    return (double)pages * sysconf(_SC_PAGESIZE) / 1e6;
+}
+
+static KEY *make_key(unsigned int n) {
+    char buf[33];
+    snprintf(buf, sizeof(buf), "churn:%026u", n);
+    return key_create(blob_create(buf, 32));
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    unsigned int seed = wp->id + 1;
+    while(!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        TRANSACTION *tp = trans_create();
+        size_t size = 512 + rand_r(&seed) % (sizeof(value) - 512 + 1);
+        if(store_put(tp, make_key(rand_r(&seed) % num_keys), blob_create(value, size)) == TRANS_ABORTED)
+            trans_abort(tp);
+        else
+            trans_commit(tp);
+        wp->puts++;
+    }
+    return NULL;
+}
+
+static void run(int slab, int nthreads) {
+    pool_caching = slab;
+    trans_init();
+    store_init();
+    pthread_t tids[nthreads];
+    WORKER w[nthreads];
+    for(long i = 0; i < nthreads; i++) {
+        w[i] = (WORKER){ .id = i };
+        pthread_create(&tids[i], NULL, worker, &w[i]);
+    }
+    printf("%s\n%4s %10s %10s %12s %10s %12s\n", slab ? "slab" : "malloc", "sec", "RSS MB",
+           "live MB", "reserved MB", "in use MB", "requested MB");
+    double first = 0, rss = 0;
+    for(int s = 1; s <= seconds; s++) {
+        sleep(1);
+        SLAB_STATS ss;
+        slab_get_stats(&ss);
+        rss = rss_mb();
+        if(s == 1) first = rss;
+        printf("%4d %10.1f %10.1f %12.1f %10.1f %12.1f\n", s, rss, blob_resident_bytes() / 1e6,
+               ss.reserved / 1e6, ss.in_use / 1e6, ss.requested / 1e6);
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    size_t puts = 0;
+    for(int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        puts += w[i].puts;
+    }
+    printf("%s: %.0f PUTs/s, RSS grew %.1f MB after the first second\n\n", slab ? "slab" : "malloc",
+           puts / (double)seconds, rss - first);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    if(argc > 1) seconds = atoi(argv[1]);
+    int nthreads = argc > 2 ? atoi(argv[2]) : 4;
+    if(argc > 3) num_keys = atoi(argv[3]);
+    memset(value, 'v', sizeof(value));
+    printf("%d threads, %d keys, %d seconds\n\n", nthreads, num_keys, seconds);
+    fflush(stdout);
+    for(int slab = 0; slab <= 1; slab++) {
+        pid_t pid = fork();
+        if(pid == 0) {
+            run(slab, nthreads);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Commit waits under a hot-key workload.  Each thread commits transactions
+ * that GET and then PUT a few keys drawn from a small set, so most
+ * transactions depend on others that are still pending and have to wait
+ * for them at commit.  Prints the throughput and the distribution of the
+ * time commits spent waiting for their dependencies.
+ *
+ * Usage: bin/bench_commit_wait [threads] [txns_per_thread] [hot_keys] [keys_per_txn]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "transaction_ext.h"
+#include "store_ext.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static int txns_per_thread = 20000;
+static int hot_keys = 16;
+static int keys_per_txn = 2;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static KEY *make_key(unsigned int n) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "hot:%u", n);
+    return key_create(blob_create(buf, len));
+}
+
+static void *worker(void *arg) {
+    unsigned int seed = (long)arg + 1;
+    long committed = 0;
+    for(int i = 0; i < txns_per_thread; i++) {
+        TRANSACTION *tp = trans_create();
+        TRANS_STATUS status = TRANS_PENDING;
+        for(int k = 0; k < keys_per_txn && status != TRANS_ABORTED; k++) {
+            unsigned int key = rand_r(&seed) % hot_keys;
+            BLOB *bp = NULL;
+            status = store_get(tp, make_key(key), &bp);
+            blob_unref(bp, "bench");
+            if(status != TRANS_ABORTED)
+                status = store_put(tp, make_key(key), blob_create("value", 5));
+        }
+        if(status == TRANS_ABORTED) trans_abort(tp);
+        else if(trans_commit(tp) == TRANS_COMMITTED) committed++;
+    }
+    return (void *)committed;
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 8;
+    if(argc > 2) txns_per_thread = atoi(argv[2]);
+    if(argc > 3) hot_keys = atoi(argv[3]);
+    if(argc > 4) keys_per_txn = atoi(argv[4]);
+    trans_init();
+    store_init();
+    store_gc_start();
+
+    pthread_t tids[nthreads];
+    double t = now();
+    for(long i = 0; i < nthreads; i++)
+        pthread_create(&tids[i], NULL, worker, (void *)i);
+    long committed = 0;
+    for(int i = 0; i < nthreads; i++) {
+        void *n;
+        pthread_join(tids[i], &n);
+        committed += (long)n;
+    }
+    double s = now() - t;
+    store_fini();
+
+    TRANS_WAIT_STATS st;
+    trans_get_wait_stats(&st);
+    printf("%d threads, %d transactions each, %d hot keys, %d per transaction\n",
+           nthreads, txns_per_thread, hot_keys, keys_per_txn);
+    printf("%.0f commits/s, %ld of %d committed\n", committed / s, committed, nthreads * txns_per_thread);
+    printf("%zu commits had dependencies, %zu waited: %zu spun, %zu slept (spin limit %d)\n",
+           st.commits, st.waits, st.spun, st.slept, st.spin_limit);
+    printf("%12s %10s\n", "wait (us)", "commits");
+    for(int i = 0; i < TRANS_WAIT_BUCKETS; i++) {
+        if(st.histogram[i] == 0) continue;
+        if(i == 0) printf("%12s %10zu\n", "< 1", st.histogram[i]);
+        else printf("%5ld-%-6ld %10zu\n", 1L << (i - 1), (1L << i) - 1, st.histogram[i]);
+    }
+    return 0;
+}
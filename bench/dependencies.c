@@ -0,0 +1,59 @@
+/*
+ * Cost of a large dependency set.  In each round one transaction is made
+ * to depend on a number of others, each added several times over as a
+ * hot key would add it, and then commits once they all have.  The time
+ * of each add (including the duplicates) and of the final commit is
+ * reported.
+ *
+ * Usage: bin/bench_dependencies [dependencies] [repeats] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "client_registry.h"
+#include "transaction.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    int ndeps = argc > 1 ? atoi(argv[1]) : 1000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 4;
+    int rounds = argc > 3 ? atoi(argv[3]) : 100;
+    TRANSACTION **deps = malloc(ndeps * sizeof(TRANSACTION *));
+    uint64_t add_ns = 0, commit_ns = 0;
+
+    trans_init();
+    for(int r = 0; r < rounds; r++) {
+        for(int i = 0; i < ndeps; i++)
+            deps[i] = trans_create();
+        TRANSACTION *tp = trans_create();
+        uint64_t t = now_ns();
+        for(int k = 0; k < repeats; k++) {
+            for(int i = 0; i < ndeps; i++)
+                trans_add_dependency(tp, deps[i]);
+        }
+        add_ns += now_ns() - t;
+        for(int i = 0; i < ndeps; i++)
+            trans_commit(deps[i]);
+        t = now_ns();
+        if(trans_commit(tp) != TRANS_COMMITTED) {
+            fprintf(stderr, "Commit failed\n");
+            return 1;
+        }
+        commit_ns += now_ns() - t;
+    }
+    printf("%d dependencies, each added %d times, %d rounds\n", ndeps, repeats, rounds);
+    printf("add:    %8.1f ns per call\n", (double)add_ns / rounds / ndeps / repeats);
+    printf("commit: %8.1f us\n", commit_ns / 1e3 / rounds);
+    free(deps);
+    return 0;
+}
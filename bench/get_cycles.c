@@ -0,0 +1,95 @@
+/*
+ * CPU cycles per GET of a settled value.  Each thread repeatedly reads
+ * keys from a small shared set in read-only transactions, so all threads
+ * keep taking and dropping references on the same few value blobs and
+ * their creator transactions.  Cycles are counted with the time stamp
+ * counter around the store_get call and the blob_unref of its result.
+ *
+ * Usage: bin/bench_get_cycles [threads] [gets_per_thread] [keys]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <x86intrin.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static int gets_per_thread = 1000000;
+static int num_keys = 4;
+static KEY **keys;
+
+typedef struct {
+    long id;
+    uint64_t cycles;
+} WORKER;
+
+static KEY *make_key(unsigned int n) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "hot:%u", n);
+    return key_create(blob_create(buf, len));
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    TRANSACTION *tp = trans_create();
+    for(int i = 0; i < gets_per_thread; i++) {
+        BLOB *bp = NULL;
+        // store_get consumes the key, so each GET gets a reference to a
+        // key made in advance.
+        KEY *kp = keys[i % num_keys];
+        blob_ref(kp->blob, "bench");
+        KEY *kc = key_create(kp->blob);
+        uint64_t t = __rdtsc();
+        store_get(tp, kc, &bp);
+        blob_unref(bp, "bench");
+        wp->cycles += __rdtsc() - t;
+        if(i % 10000 == 9999) {
+            trans_commit(tp);
+            tp = trans_create();
+        }
+    }
+    trans_commit(tp);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2) gets_per_thread = atoi(argv[2]);
+    if(argc > 3) num_keys = atoi(argv[3]);
+    trans_init();
+    store_init();
+    keys = malloc(num_keys * sizeof(KEY *));
+    TRANSACTION *tp = trans_create();
+    for(int k = 0; k < num_keys; k++) {
+        keys[k] = make_key(k);
+        store_put(tp, make_key(k), blob_create("a hot value", 11));
+    }
+    trans_commit(tp);
+
+    printf("%d keys, %d GETs per thread\n", num_keys, gets_per_thread);
+    printf("%8s %14s\n", "threads", "cycles/GET");
+    for(int n = 1; n <= nthreads; n *= 2) {
+        pthread_t tids[n];
+        WORKER w[n];
+        for(long i = 0; i < n; i++) {
+            w[i] = (WORKER){ .id = i };
+            pthread_create(&tids[i], NULL, worker, &w[i]);
+        }
+        uint64_t cycles = 0;
+        for(int i = 0; i < n; i++) {
+            pthread_join(tids[i], NULL);
+            cycles += w[i].cycles;
+        }
+        printf("%8d %14.0f\n", n, (double)cycles / n / gets_per_thread);
+    }
+    store_fini();
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Cost of walking a bucket of keys that share a long prefix.  1000 keys
+ * of 64 bytes, a 56-byte prefix followed by a number, are put in a list, and
+ * each key in turn is looked up in it with key_compare(), as in a bucket
+ * walk.  This is done with the keys' real hashes, which tell almost all of
+ * them apart, and again with all the hashes made equal, as if they all
+ * collided, so that every comparison has to look at the contents.  A set
+ * of binary keys, which differ only after some null bytes, is also looked
+ * up with all their hashes made equal, and lookups that found the wrong
+ * key are counted.
+ *
+ * Usage: bin/bench_key_compare [keys] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "client_registry.h"
+#include "data.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Look up each key in the list by a copy of it.
+ *
+ * @return  The number of lookups that found a different key.
+ */
+static size_t walk(KEY **keys, KEY **probes, int n, int rounds, size_t *compares) {
+    size_t wrong = 0;
+    for(int r = 0; r < rounds; r++) {
+        for(int i = 0; i < n; i++) {
+            int j = 0;
+            while(j < n && key_compare(keys[j], probes[i]) != 0) j++;
+            *compares += j < n ? j + 1 : n;
+            wrong += j != i;
+        }
+    }
+    return wrong;
+}
+
+static void run(char *name, KEY **keys, KEY **probes, int n, int rounds) {
+    size_t compares = 0;
+    double t = now();
+    size_t wrong = walk(keys, probes, n, rounds, &compares);
+    double s = now() - t;
+    printf("%-16s %14.1f %12zu\n", name, s * 1e9 / compares, wrong / rounds);
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    KEY **keys = malloc(n * sizeof(KEY *)), **probes = malloc(n * sizeof(KEY *));
+    char buf[128];
+    printf("%d keys, %d rounds\n", n, rounds);
+    printf("%-16s %14s %12s\n", "keys", "ns/compare", "wrong keys");
+
+    for(int i = 0; i < n; i++) {
+        int len = snprintf(buf, sizeof(buf), "tenant-0042/region-eu-west/bucket-photos/2024/06/object-%08d", i);
+        keys[i] = key_create(blob_create(buf, len));
+        probes[i] = key_create(blob_create(buf, len));
+    }
+    run("prefix", keys, probes, n, rounds);
+    for(int i = 0; i < n; i++) keys[i]->hash = probes[i]->hash = 0;
+    run("prefix, collided", keys, probes, n, rounds);
+
+    for(int i = 0; i < n; i++) {
+        key_dispose(keys[i]);
+        key_dispose(probes[i]);
+        memset(buf, 0, 16);
+        memcpy(buf + 16, &i, sizeof(i));
+        keys[i] = key_create(blob_create(buf, 16 + sizeof(i)));
+        probes[i] = key_create(blob_create(buf, 16 + sizeof(i)));
+        keys[i]->hash = probes[i]->hash = 0;
+    }
+    run("binary, collided", keys, probes, n, rounds);
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Memory traffic in the server per PUT of a large value.  A client sends
+ * PUTs of one key, each in a transaction of its own, to a server listening
+ * on the loopback interface.  Every malloc, calloc and memcpy made by the
+ * process is counted by wrapping them here; the client makes none of its
+ * own while sending, so the counts are the server's.  Reported per PUT are
+ * the bytes allocated, zeroed by calloc and copied by memcpy, an estimate
+ * of the bytes of memory written and read for them (each byte copied is
+ * read and written), and the rate at which values were stored.  The copy
+ * out of the socket made by the kernel is the same either way and is not
+ * counted.
+ *
+ * Usage: bin/bench_large_put [puts] [value_size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include "client_registry.h"
+#include "csapp.h"
+#include "data.h"
+#include "protocol.h"
+#include "server.h"
+#include "store_ext.h"
+#include "transaction.h"
+
+CLIENT_REGISTRY *client_registry;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+
+static size_t allocated = 0;
+static size_t zeroed = 0;
+static size_t copied = 0;
+
+void *malloc(size_t size) {
+    __atomic_fetch_add(&allocated, size, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    __atomic_fetch_add(&allocated, n * size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&zeroed, n * size, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    __atomic_fetch_add(&copied, n, __ATOMIC_RELAXED);
+    return memmove(dst, src, n);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Headers and payloads are written separately, so Nagle's algorithm would
+ * hold each request back for the ACK of the one before.
+ */
+static int nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void *acceptor(void *arg) {
+    int listenfd = *(int *)arg;
+    for(;;) {
+        int *fdp = Malloc(sizeof(int));
+        *fdp = nodelay(Accept(listenfd, NULL, NULL));
+        pthread_t tid;
+        Pthread_create(&tid, NULL, xacto_client_service, fdp);
+    }
+    return NULL;
+}
+
+static int send_pkt(int fd, uint8_t type, void *data, size_t size) {
+    XACTO_PACKET pkt = { .type = type, .size = size, .null = data == NULL };
+    return proto_send_packet(fd, &pkt, data);
+}
+
+static int recv_status(int fd) {
+    XACTO_PACKET pkt;
+    if(proto_recv_packet(fd, &pkt, NULL) != 0) return -1;
+    return pkt.status;
+}
+
+int main(int argc, char *argv[]) {
+    int puts = argc > 1 ? atoi(argv[1]) : 1000;
+    size_t size = argc > 2 ? atol(argv[2]) : 256 * 1024;
+    char *value = __libc_malloc(size);
+    memset(value, 'v', size);
+    client_registry = creg_init();
+    trans_init();
+    store_init();
+    store_gc_start();
+
+    int listenfd = open_listenfd("0");
+    // The port is in the same place for IPv4 and IPv6.
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    getsockname(listenfd, (struct sockaddr *)&addr, &len);
+    char port[16];
+    snprintf(port, sizeof(port), "%d", ntohs(((struct sockaddr_in *)&addr)->sin_port));
+    pthread_t tid;
+    pthread_create(&tid, NULL, acceptor, &listenfd);
+
+    int fd = nodelay(open_clientfd("localhost", port));
+    size_t a = __atomic_load_n(&allocated, __ATOMIC_RELAXED);
+    size_t z = __atomic_load_n(&zeroed, __ATOMIC_RELAXED);
+    size_t c = __atomic_load_n(&copied, __ATOMIC_RELAXED);
+    double t = now();
+    int commits = 0;
+    for(int i = 0; i < puts; i++) {
+        if(send_pkt(fd, XACTO_PUT_PKT, NULL, 0) != 0 || send_pkt(fd, XACTO_KEY_PKT, "large", 5) != 0 ||
+           send_pkt(fd, XACTO_VALUE_PKT, value, size) != 0 || recv_status(fd) != TRANS_PENDING ||
+           send_pkt(fd, XACTO_COMMIT_PKT, NULL, 0) != 0)
+            break;
+        commits += recv_status(fd) == TRANS_COMMITTED;
+    }
+    double s = now() - t;
+    a = __atomic_load_n(&allocated, __ATOMIC_RELAXED) - a;
+    z = __atomic_load_n(&zeroed, __ATOMIC_RELAXED) - z;
+    c = __atomic_load_n(&copied, __ATOMIC_RELAXED) - c;
+    close(fd);
+
+    printf("%d PUTs of %zu bytes, %d committed\n", puts, size, commits);
+    printf("%14s %14s %14s %14s %10s\n", "allocated/PUT", "zeroed/PUT", "copied/PUT", "traffic/PUT", "MB/s");
+    printf("%14.0f %14.0f %14.0f %14.0f %10.1f\n", (double)a / puts, (double)z / puts, (double)c / puts,
+           (double)(z + 2 * c) / puts, (double)puts * size / s / 1e6);
+    return 0;
+}
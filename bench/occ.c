@@ -0,0 +1,139 @@
+/*
+ * Abort rate and throughput of ordering by transaction ID and of optimistic
+ * concurrency control (see store_ext.h) on keys drawn from a Zipfian
+ * distribution.  Each transaction reads a number of keys and writes back a
+ * given percentage of them, as a read-modify-write would.  Aborted
+ * transactions are counted and not retried.  Each mode is run for each
+ * skew.
+ *
+ * Usage: bin/bench_occ [threads] [txns_per_thread] [keys] [reads] [write_pct]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static int txns_per_thread = 50000;
+static int num_keys = 100000;
+static int ops_per_trans = 8;
+static int write_pct = 25;
+static double *cdf;
+
+typedef struct {
+    long id;
+    size_t commits;
+    size_t aborts;
+} WORKER;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Key i (from 0) is drawn with probability proportional to 1 / (i+1)^theta.
+ */
+static void zipf_init(double theta) {
+    double sum = 0;
+    for(int i = 0; i < num_keys; i++) {
+        sum += 1 / pow(i + 1, theta);
+        cdf[i] = sum;
+    }
+    for(int i = 0; i < num_keys; i++) cdf[i] /= sum;
+}
+
+static int zipf_next(unsigned int *seed) {
+    double u = (double)rand_r(seed) / RAND_MAX;
+    int lo = 0, hi = num_keys - 1;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static KEY *make_key(int n) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "z:%d", n);
+    return key_create(blob_create(buf, len));
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    unsigned int seed = wp->id + 1;
+    for(int i = 0; i < txns_per_thread; i++) {
+        TRANSACTION *tp = trans_create();
+        int aborted = 0;
+        for(int j = 0; j < ops_per_trans && !aborted; j++) {
+            int k = zipf_next(&seed);
+            BLOB *bp = NULL;
+            aborted = store_get(tp, make_key(k), &bp) == TRANS_ABORTED;
+            blob_unref(bp, "bench");
+            if(!aborted && rand_r(&seed) % 100 < write_pct)
+                aborted = store_put(tp, make_key(k), blob_create("value", 5)) == TRANS_ABORTED;
+        }
+        if(aborted) trans_abort(tp);
+        if(aborted || trans_commit(tp) == TRANS_ABORTED) wp->aborts++;
+        else wp->commits++;
+    }
+    return NULL;
+}
+
+static void run(int occ, double theta, int nthreads) {
+    store_occ = occ;
+    store_init();
+    TRANSACTION *tp = trans_create();
+    for(int i = 0; i < num_keys; i++)
+        store_put(tp, make_key(i), blob_create("value", 5));
+    trans_commit(tp);
+    store_gc_start();
+    pthread_t tids[nthreads];
+    WORKER w[nthreads];
+    double t = now();
+    for(long i = 0; i < nthreads; i++) {
+        w[i] = (WORKER){ .id = i };
+        pthread_create(&tids[i], NULL, worker, &w[i]);
+    }
+    size_t commits = 0, aborts = 0;
+    for(int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        commits += w[i].commits;
+        aborts += w[i].aborts;
+    }
+    double s = now() - t;
+    store_fini();
+    printf("%-6s %6.2f %12.0f %12.0f %9.2f%%\n", occ ? "occ" : "order", theta,
+           (commits + aborts) / s, commits / s, 100.0 * aborts / (commits + aborts));
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2) txns_per_thread = atoi(argv[2]);
+    if(argc > 3) num_keys = atoi(argv[3]);
+    if(argc > 4) ops_per_trans = atoi(argv[4]);
+    if(argc > 5) write_pct = atoi(argv[5]);
+    cdf = malloc(num_keys * sizeof(double));
+    trans_init();
+    printf("%d threads, %d transactions each, %d keys, %d reads per transaction, %d%% written\n",
+           nthreads, txns_per_thread, num_keys, ops_per_trans, write_pct);
+    printf("%-6s %6s %12s %12s %10s\n", "mode", "theta", "txns/s", "commits/s", "aborts");
+    double thetas[] = { 0.5, 0.8, 0.99, 1.2 };
+    for(int i = 0; i < 4; i++) {
+        zipf_init(thetas[i]);
+        run(0, thetas[i], nthreads);
+        run(1, thetas[i], nthreads);
+    }
+    free(cdf);
+    return 0;
+}
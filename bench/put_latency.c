@@ -0,0 +1,124 @@
+/*
+ * End-to-end latency of PUTs with large keys.  A client PUTs keys of a
+ * given size, drawn from a fixed set, with small values to a server
+ * listening on the loopback interface, each PUT in a transaction of its
+ * own.  Timed is each PUT, from sending its request to receiving the
+ * reply; the COMMIT that follows is not.
+ *
+ * Usage: bin/bench_put_latency [puts] [key_size] [keys]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include "client_registry.h"
+#include "csapp.h"
+#include "data.h"
+#include "protocol.h"
+#include "server.h"
+#include "store_ext.h"
+#include "transaction.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Headers and payloads are written separately, so Nagle's algorithm would
+ * hold each request back for the ACK of the one before.
+ */
+static int nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void *acceptor(void *arg) {
+    int listenfd = *(int *)arg;
+    for(;;) {
+        int *fdp = Malloc(sizeof(int));
+        *fdp = nodelay(Accept(listenfd, NULL, NULL));
+        pthread_t tid;
+        Pthread_create(&tid, NULL, xacto_client_service, fdp);
+    }
+    return NULL;
+}
+
+static int send_pkt(int fd, uint8_t type, void *data, size_t size) {
+    XACTO_PACKET pkt = { .type = type, .size = size, .null = data == NULL };
+    return proto_send_packet(fd, &pkt, data);
+}
+
+static int recv_status(int fd) {
+    XACTO_PACKET pkt;
+    if(proto_recv_packet(fd, &pkt, NULL) != 0) return -1;
+    return pkt.status;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    int puts = argc > 1 ? atoi(argv[1]) : 100000;
+    int key_size = argc > 2 ? atoi(argv[2]) : 1024;
+    int num_keys = argc > 3 ? atoi(argv[3]) : 10000;
+    client_registry = creg_init();
+    trans_init();
+    store_init();
+    store_gc_start();
+
+    int listenfd = open_listenfd("0");
+    // The port is in the same place for IPv4 and IPv6.
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    getsockname(listenfd, (struct sockaddr *)&addr, &len);
+    char port[16];
+    snprintf(port, sizeof(port), "%d", ntohs(((struct sockaddr_in *)&addr)->sin_port));
+    pthread_t tid;
+    pthread_create(&tid, NULL, acceptor, &listenfd);
+
+    char *key = malloc(key_size);
+    unsigned int seed = 1;
+    for(int i = 0; i < key_size; i++) key[i] = 'a' + rand_r(&seed) % 26;
+    uint32_t *lat = malloc(puts * sizeof(uint32_t));
+    int fd = nodelay(open_clientfd("localhost", port));
+    int done = 0;
+    uint64_t start = now_ns();
+    for(; done < puts; done++) {
+        // The key number goes at the end, so all keys share a long prefix.
+        char num[16];
+        int n = snprintf(num, sizeof(num), "%08d", rand_r(&seed) % num_keys);
+        memcpy(key + key_size - n, num, n);
+        uint64_t t = now_ns();
+        if(send_pkt(fd, XACTO_PUT_PKT, NULL, 0) != 0 || send_pkt(fd, XACTO_KEY_PKT, key, key_size) != 0 ||
+           send_pkt(fd, XACTO_VALUE_PKT, "value", 5) != 0 || recv_status(fd) != TRANS_PENDING)
+            break;
+        lat[done] = now_ns() - t;
+        if(send_pkt(fd, XACTO_COMMIT_PKT, NULL, 0) != 0 || recv_status(fd) != TRANS_COMMITTED)
+            break;
+    }
+    double s = (now_ns() - start) / 1e9;
+    close(fd);
+
+    qsort(lat, done, sizeof(uint32_t), cmp_u32);
+    double sum = 0;
+    for(int i = 0; i < done; i++) sum += lat[i];
+    printf("%d PUTs of %d-byte keys over %d keys, %.0f transactions/s\n", done, key_size, num_keys, done / s);
+    printf("%10s %10s %10s %10s\n", "avg ns", "p50", "p99", "p99.9");
+    if(done > 0)
+        printf("%10.0f %10u %10u %10u\n", sum / done, lat[done / 2], lat[(int)(done * 0.99)],
+               lat[(int)(done * 0.999)]);
+    return 0;
+}
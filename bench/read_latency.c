@@ -0,0 +1,153 @@
+/*
+ * Latency of store operations under a read-mostly workload: 95% GETs and
+ * 5% PUTs over a shared set of keys, each operation in its own transaction.
+ * The workload is run twice, once with every GET taking the segment lock and
+ * adding a version (store_fast_reads = 0, which is how the store used to
+ * work) and once with reads of settled values served without the lock.
+ * Percentiles are for the store_get/store_put call itself; "txn" is the
+ * whole create/operate/commit sequence.
+ *
+ * Usage: bin/bench_read_latency [threads] [ops_per_thread] [keys]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+
+CLIENT_REGISTRY *client_registry;
+
+#define READ_PERCENT 95
+
+static int ops_per_thread = 200000;
+static int num_keys = 10000;
+
+typedef struct {
+    long id;
+    uint32_t *get_ns;       // Latency of each GET.
+    uint32_t *all_ns;       // Latency of each operation.
+    uint32_t *txn_ns;       // Latency of each whole transaction.
+    int gets;
+    int aborts;
+} WORKER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static KEY *make_key(unsigned int n) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "user:%u", n);
+    return key_create(blob_create(buf, len));
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    unsigned int seed = wp->id + 1;
+    for(int i = 0; i < ops_per_thread; i++) {
+        unsigned int k = rand_r(&seed) % num_keys;
+        int read = rand_r(&seed) % 100 < READ_PERCENT;
+        KEY *kp = make_key(k);
+        BLOB *value = read ? NULL : blob_create("updated", 7);
+        uint64_t t0 = now_ns();
+        TRANSACTION *tp = trans_create();
+        uint64_t t1 = now_ns();
+        TRANS_STATUS st;
+        if(read) {
+            BLOB *bp = NULL;
+            st = store_get(tp, kp, &bp);
+            blob_unref(bp, "bench done");
+        } else {
+            st = store_put(tp, kp, value);
+        }
+        uint64_t t2 = now_ns();
+        if(st == TRANS_ABORTED) {
+            trans_abort(tp);
+            wp->aborts++;
+        } else if(trans_commit(tp) == TRANS_ABORTED) {
+            wp->aborts++;
+        }
+        uint64_t t3 = now_ns();
+        if(read) wp->get_ns[wp->gets++] = t2 - t1;
+        wp->all_ns[i] = t2 - t1;
+        wp->txn_ns[i] = t3 - t0;
+    }
+    return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(uint32_t *v, size_t n, double p) {
+    return n == 0 ? 0 : v[(size_t)(p * (n - 1))];
+}
+
+static void report(const char *mode, const char *what, uint32_t *v, size_t n) {
+    qsort(v, n, sizeof(uint32_t), cmp_u32);
+    printf("%-6s %-4s %10zu %10.0f %10.0f %10.0f %10.0f\n", mode, what, n,
+           pct(v, n, 0.50), pct(v, n, 0.99), pct(v, n, 0.999), pct(v, n, 1.0));
+}
+
+static void run(int fast, int nthreads) {
+    store_fast_reads = fast;
+    store_init();
+    TRANSACTION *tp = trans_create();
+    for(int k = 0; k < num_keys; k++)
+        store_put(tp, make_key(k), blob_create("initial", 7));
+    trans_commit(tp);
+
+    pthread_t tids[nthreads];
+    WORKER w[nthreads];
+    size_t total = (size_t)nthreads * ops_per_thread;
+    uint32_t *get_ns = malloc(total * sizeof(uint32_t));
+    uint32_t *all_ns = malloc(total * sizeof(uint32_t));
+    uint32_t *txn_ns = malloc(total * sizeof(uint32_t));
+    for(long i = 0; i < nthreads; i++) {
+        w[i] = (WORKER){ .id = i };
+        w[i].get_ns = malloc(ops_per_thread * sizeof(uint32_t));
+        w[i].all_ns = all_ns + i * ops_per_thread;
+        w[i].txn_ns = txn_ns + i * ops_per_thread;
+        pthread_create(&tids[i], NULL, worker, &w[i]);
+    }
+    size_t gets = 0;
+    int aborts = 0;
+    for(int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        for(int j = 0; j < w[i].gets; j++) get_ns[gets++] = w[i].get_ns[j];
+        aborts += w[i].aborts;
+        free(w[i].get_ns);
+    }
+    store_fini();
+
+    const char *mode = fast ? "fast" : "locked";
+    report(mode, "get", get_ns, gets);
+    report(mode, "all", all_ns, total);
+    report(mode, "txn", txn_ns, total);
+    fprintf(stderr, "(%s: %d aborts)\n", mode, aborts);
+    free(get_ns);
+    free(all_ns);
+    free(txn_ns);
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2) ops_per_thread = atoi(argv[2]);
+    if(argc > 3) num_keys = atoi(argv[3]);
+    trans_init();
+    printf("%d threads, %d ops each, %d keys, %d%% reads (latencies in ns)\n",
+           nthreads, ops_per_thread, num_keys, READ_PERCENT);
+    printf("%-6s %-4s %10s %10s %10s %10s %10s\n", "mode", "op", "count", "p50", "p99", "p99.9", "max");
+    run(0, nthreads);
+    run(1, nthreads);
+    return 0;
+}
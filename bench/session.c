@@ -0,0 +1,154 @@
+/*
+ * Transactions per second per connection, with a connection opened for
+ * each transaction, as was needed when the server ended the connection at
+ * COMMIT, and with one connection kept for all of a client's transactions.
+ * Each client thread runs small transactions, a PUT and a GET of a key of
+ * its own followed by a COMMIT, against a server listening on the loopback
+ * interface, so that no transaction aborts and only the cost of the
+ * connection differs.
+ *
+ * Usage: bin/bench_session [threads] [txns_per_thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include "client_registry.h"
+#include "csapp.h"
+#include "data.h"
+#include "protocol.h"
+#include "server.h"
+#include "store_ext.h"
+#include "transaction.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static char port[16];
+static int txns_per_thread = 2000;
+
+typedef struct {
+    long id;
+    int persistent;
+    size_t commits;
+} WORKER;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Headers and payloads are written separately, so Nagle's algorithm would
+ * hold each request back for the ACK of the one before.
+ */
+static int nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void *acceptor(void *arg) {
+    int listenfd = *(int *)arg;
+    for(;;) {
+        int *fdp = Malloc(sizeof(int));
+        *fdp = nodelay(Accept(listenfd, NULL, NULL));
+        pthread_t tid;
+        Pthread_create(&tid, NULL, xacto_client_service, fdp);
+    }
+    return NULL;
+}
+
+static int send_pkt(int fd, uint8_t type, void *data, size_t size) {
+    XACTO_PACKET pkt = { .type = type, .size = size, .null = data == NULL };
+    return proto_send_packet(fd, &pkt, data);
+}
+
+/*
+ * Receive a packet and discard its payload.
+ *
+ * @return  The status field, or -1 if the connection closed.
+ */
+static int recv_pkt(int fd) {
+    XACTO_PACKET pkt;
+    void *data = NULL;
+    if(proto_recv_packet(fd, &pkt, &data) != 0) return -1;
+    Free(data);
+    return pkt.status;
+}
+
+/*
+ * Run one transaction: PUT a key, GET it back and COMMIT.
+ *
+ * @return  1 if the transaction committed, otherwise 0.
+ */
+static int run_trans(int fd, char *key, int len) {
+    if(send_pkt(fd, XACTO_PUT_PKT, NULL, 0) != 0 || send_pkt(fd, XACTO_KEY_PKT, key, len) != 0 ||
+       send_pkt(fd, XACTO_VALUE_PKT, "value", 5) != 0 || recv_pkt(fd) != TRANS_PENDING)
+        return 0;
+    if(send_pkt(fd, XACTO_GET_PKT, NULL, 0) != 0 || send_pkt(fd, XACTO_KEY_PKT, key, len) != 0 ||
+       recv_pkt(fd) != TRANS_PENDING || recv_pkt(fd) < 0)
+        return 0;
+    return send_pkt(fd, XACTO_COMMIT_PKT, NULL, 0) == 0 && recv_pkt(fd) == TRANS_COMMITTED;
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    char key[32];
+    int len = snprintf(key, sizeof(key), "session:%ld", wp->id);
+    int fd = wp->persistent ? nodelay(open_clientfd("localhost", port)) : -1;
+    for(int i = 0; i < txns_per_thread; i++) {
+        if(!wp->persistent) fd = nodelay(open_clientfd("localhost", port));
+        wp->commits += run_trans(fd, key, len);
+        if(!wp->persistent) close(fd);
+    }
+    if(wp->persistent) close(fd);
+    return NULL;
+}
+
+static void run(int persistent, int nthreads) {
+    pthread_t tids[nthreads];
+    WORKER w[nthreads];
+    double t = now();
+    for(long i = 0; i < nthreads; i++) {
+        w[i] = (WORKER){ .id = i, .persistent = persistent };
+        pthread_create(&tids[i], NULL, worker, &w[i]);
+    }
+    size_t commits = 0;
+    for(int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        commits += w[i].commits;
+    }
+    double s = now() - t;
+    printf("%-12s %12.0f %16.0f %10zu\n", persistent ? "persistent" : "per-txn", commits / s,
+           commits / s / nthreads, commits);
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2) txns_per_thread = atoi(argv[2]);
+    client_registry = creg_init();
+    trans_init();
+    store_init();
+    store_gc_start();
+
+    int listenfd = open_listenfd("0");
+    // The port is in the same place for IPv4 and IPv6.
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    getsockname(listenfd, (struct sockaddr *)&addr, &len);
+    snprintf(port, sizeof(port), "%d", ntohs(((struct sockaddr_in *)&addr)->sin_port));
+    pthread_t tid;
+    pthread_create(&tid, NULL, acceptor, &listenfd);
+
+    printf("%d threads, %d transactions each\n", nthreads, txns_per_thread);
+    printf("%-12s %12s %16s %10s\n", "connection", "txns/s", "txns/s/conn", "commits");
+    run(0, nthreads);
+    run(1, nthreads);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Time to write a snapshot of a store, to load it back, and to read every
+ * value once after loading.  Loading only reads the keys, so the time until
+ * the store can serve requests does not depend on the size of the values;
+ * the values are paged in and checked as they are read.
+ *
+ * Usage: bin/bench_snapshot [keys] [value_size] [file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+#include "snapshot.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static KEY *make_key(int i) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "user:%08d", i);
+    return key_create(blob_create(buf, n));
+}
+
+int main(int argc, char *argv[]) {
+    int keys = argc > 1 ? atoi(argv[1]) : 1000000;
+    int value_size = argc > 2 ? atoi(argv[2]) : 1000;
+    char *path = argc > 3 ? argv[3] : "/tmp/bench_snapshot.snp";
+    char *value = malloc(value_size);
+    memset(value, 'v', value_size);
+
+    trans_init();
+    store_init();
+    TRANSACTION *tp = trans_create();
+    for(int i = 0; i < keys; i++) {
+        snprintf(value, value_size, "%d", i);
+        store_put(tp, make_key(i), blob_create(value, value_size));
+    }
+    trans_commit(tp);
+
+    double t = now();
+    if(snapshot_write(path) < 0) return 1;
+    double write_s = now() - t;
+    store_fini();
+
+    // Drop the file from the page cache where possible, so that loading
+    // has to read it from disk.
+    sync();
+    FILE *f = fopen("/proc/sys/vm/drop_caches", "w");
+    if(f != NULL) {
+        fputs("1", f);
+        fclose(f);
+    }
+
+    store_init();
+    t = now();
+    long loaded = snapshot_load(path);
+    double load_s = now() - t;
+
+    t = now();
+    tp = trans_create();
+    size_t bytes = 0;
+    for(int i = 0; i < keys; i++) {
+        BLOB *bp = NULL;
+        store_get(tp, make_key(i), &bp);
+        if(bp != NULL) bytes += bp->size;
+        blob_unref(bp, "bench done");
+    }
+    trans_commit(tp);
+    double read_s = now() - t;
+
+    printf("%d keys, %d byte values (%.0f MB)\n", keys, value_size, (double)keys * value_size / 1e6);
+    printf("write snapshot:   %8.2f s\n", write_s);
+    printf("load (serving):   %8.2f s  (%ld keys)\n", load_s, loaded);
+    printf("first read of all:%8.2f s  (%zu bytes)\n", read_s, bytes);
+    store_fini();
+    snapshot_unmap();
+    unlink(path);
+    free(value);
+    return 0;
+}
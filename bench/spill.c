@@ -0,0 +1,153 @@
+/*
+ * Read latency and memory use with a memory cap.  The store is loaded
+ * with more value bytes than the cap allows, and reader threads then GET
+ * keys with a skewed distribution: 90% of reads go to the first 10% of the
+ * keys.  The collector spills the cold values to the value log, so the
+ * hot ones stay in memory and most reads should not notice the cap.  The
+ * same run without a cap is shown first for comparison.
+ *
+ * Usage: bin/bench_spill [threads] [reads_per_thread] [keys] [value_size] [cap_percent]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+#include "data_ext.h"
+#include "vlog.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static int reads_per_thread = 200000;
+static int num_keys = 100000;
+static int value_size = 1000;
+
+typedef struct {
+    long id;
+    uint32_t *get_ns;       // Latency of each GET.
+} WORKER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static KEY *make_key(unsigned int n) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "user:%u", n);
+    return key_create(blob_create(buf, len));
+}
+
+static void *worker(void *arg) {
+    WORKER *wp = arg;
+    unsigned int seed = wp->id + 1;
+    unsigned int hot = num_keys / 10 > 0 ? num_keys / 10 : 1;
+    TRANSACTION *tp = trans_create();
+    for(int i = 0; i < reads_per_thread; i++) {
+        unsigned int k = rand_r(&seed) % 10 < 9 ? rand_r(&seed) % hot : rand_r(&seed) % num_keys;
+        KEY *kp = make_key(k);
+        BLOB *bp = NULL;
+        uint64_t t0 = now_ns();
+        TRANS_STATUS status = store_get(tp, kp, &bp);
+        wp->get_ns[i] = now_ns() - t0;
+        // A reader with a smaller ID than one that already read the key aborts.
+        if(status == TRANS_ABORTED) {
+            trans_abort(tp);
+            tp = trans_create();
+            continue;
+        }
+        if(bp == NULL || bp->size != value_size) {
+            fprintf(stderr, "Bad value for key %u\n", k);
+            exit(1);
+        }
+        blob_unref(bp, "bench");
+        // Keep the transaction short so the values stay settled.
+        if(i % 1000 == 999) {
+            trans_commit(tp);
+            tp = trans_create();
+        }
+    }
+    trans_commit(tp);
+    return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(uint32_t *v, size_t n, double p) {
+    return n == 0 ? 0 : v[(size_t)(p * (n - 1))];
+}
+
+static void run(int cap_percent, int nthreads) {
+    store_init();
+    char *value = malloc(value_size);
+    memset(value, 'v', value_size);
+    TRANSACTION *tp = trans_create();
+    for(int k = 0; k < num_keys; k++)
+        store_put(tp, make_key(k), blob_create(value, value_size));
+    trans_commit(tp);
+    free(value);
+
+    size_t loaded = blob_resident_bytes();
+    store_memory_cap = cap_percent > 0 ? loaded / 100 * cap_percent : 0;
+    if(store_memory_cap > 0 && vlog_open(NULL) < 0) exit(1);
+    store_gc_budget = 100;
+    store_gc_start();
+    // Let the collector get under the cap before the reads start.
+    for(int i = 0; i < 1000 && store_memory_cap > 0 && blob_resident_bytes() > store_memory_cap; i++)
+        usleep(10000);
+    store_gc_budget = STORE_GC_BUDGET;
+
+    pthread_t tids[nthreads];
+    WORKER w[nthreads];
+    size_t total = (size_t)nthreads * reads_per_thread;
+    uint32_t *get_ns = malloc(total * sizeof(uint32_t));
+    uint64_t t = now_ns();
+    for(long i = 0; i < nthreads; i++) {
+        w[i] = (WORKER){ .id = i, .get_ns = get_ns + i * reads_per_thread };
+        pthread_create(&tids[i], NULL, worker, &w[i]);
+    }
+    for(int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    double s = (now_ns() - t) / 1e9;
+
+    VLOG_STATS st;
+    vlog_get_stats(&st);
+    store_fini();
+    vlog_close();
+
+    qsort(get_ns, total, sizeof(uint32_t), cmp_u32);
+    printf("%5d%% %9.1f %9.1f %9.1f %10.0f %7.0f %7.0f %7.0f %8zu %7.1f %7.1f\n",
+           cap_percent, loaded / 1048576.0, st.resident_bytes / 1048576.0,
+           st.spilled_bytes / 1048576.0, total / s,
+           pct(get_ns, total, 0.50), pct(get_ns, total, 0.99), pct(get_ns, total, 0.999),
+           st.reloads, st.reload_avg_us, st.reload_max_us);
+    free(get_ns);
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2) reads_per_thread = atoi(argv[2]);
+    if(argc > 3) num_keys = atoi(argv[3]);
+    if(argc > 4) value_size = atoi(argv[4]);
+    int cap_percent = argc > 5 ? atoi(argv[5]) : 25;
+    trans_init();
+    printf("%d threads, %d reads each, %d keys of %d bytes (latencies in ns, sizes in MB)\n",
+           nthreads, reads_per_thread, num_keys, value_size);
+    printf("%6s %9s %9s %9s %10s %7s %7s %7s %8s %7s %7s\n", "cap", "loaded", "resident",
+           "spilled", "gets/s", "p50", "p99", "p99.9", "reloads", "avg us", "max us");
+    run(0, nthreads);
+    run(cap_percent, nthreads);
+    return 0;
+}
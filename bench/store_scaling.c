@@ -0,0 +1,87 @@
+/*
+ * PUT/GET throughput of the store as the number of threads grows.
+ *
+ * Each thread runs short transactions over its own range of keys, so the
+ * threads never conflict at the transaction level and the only thing they
+ * can contend on is the locking inside the store.  Every thread count is run
+ * twice: once with a single segment (one lock for the whole map, which is how
+ * the store used to work) and once with the default number of segments.
+ * With a large number of keys per thread, most operations create a key,
+ * and so also insert it into the ordered index.
+ *
+ * Usage: bin/bench_store_scaling [max_threads] [ops_per_thread] [keys_per_thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+
+CLIENT_REGISTRY *client_registry;
+
+#define OPS_PER_TRANS 8
+
+static int ops_per_thread = 100000;
+static int keys_per_thread = 4096;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg) {
+    long id = (long)arg;
+    unsigned int seed = id + 1;
+    char buf[32];
+    for(int i = 0; i < ops_per_thread; i += OPS_PER_TRANS) {
+        TRANSACTION *tp = trans_create();
+        for(int j = 0; j < OPS_PER_TRANS; j++) {
+            int n = snprintf(buf, sizeof(buf), "u:%ld:%d", id, rand_r(&seed) % keys_per_thread);
+            KEY *kp = key_create(blob_create(buf, n));
+            if(j % 2 == 0) {
+                store_put(tp, kp, blob_create(buf, n));
+            } else {
+                BLOB *bp = NULL;
+                store_get(tp, kp, &bp);
+                blob_unref(bp, "bench done");
+            }
+        }
+        trans_commit(tp);
+    }
+    return NULL;
+}
+
+static double run(int bits, int nthreads) {
+    pthread_t tids[nthreads];
+    store_segment_bits = bits;
+    store_init();
+    double start = now();
+    for(long i = 0; i < nthreads; i++)
+        pthread_create(&tids[i], NULL, worker, (void *)i);
+    for(int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    double elapsed = now() - start;
+    store_fini();
+    return (double)nthreads * ops_per_thread / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 64;
+    if(argc > 2) ops_per_thread = atoi(argv[2]);
+    if(argc > 3) keys_per_thread = atoi(argv[3]);
+    trans_init();
+    printf("%8s %18s %18s %8s\n", "threads", "1 lock (ops/s)", "segments (ops/s)", "speedup");
+    for(int n = 1; n <= max_threads; n *= 2) {
+        double before = run(0, n);
+        double after = run(STORE_SEGMENT_BITS, n);
+        printf("%8d %18.0f %18.0f %7.2fx\n", n, before, after, after / before);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Commit throughput with the write-ahead log, for a range of group commit
+ * windows.  Each thread commits transactions of one PUT as fast as it can;
+ * the number of syncs shows how many commits each sync made durable.
+ *
+ * Usage: bin/bench_wal_commit [threads] [commits_per_thread] [file]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client_registry.h"
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+#include "wal.h"
+
+CLIENT_REGISTRY *client_registry;
+
+static int commits_per_thread;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *committer(void *arg) {
+    char buf[32];
+    for(int i = 0; i < commits_per_thread; i++) {
+        int n = snprintf(buf, sizeof(buf), "t%ld:%d", (long)arg, i);
+        TRANSACTION *tp = trans_create();
+        store_put(tp, key_create(blob_create(buf, n)), blob_create(buf, n));
+        trans_commit(tp);
+    }
+    return NULL;
+}
+
+/*
+ * Run one round of commits, with the log in the given file, or without a
+ * log if path is NULL.
+ */
+static void run(int threads, char *path, int window_us) {
+    store_init();
+    if(path != NULL) {
+        unlink(path);
+        if(wal_open(path) < 0) exit(1);
+        wal_group_window_us = window_us;
+    }
+    pthread_t tids[threads];
+    double t = now();
+    for(long i = 0; i < threads; i++)
+        pthread_create(&tids[i], NULL, committer, (void *)i);
+    for(int i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+    double s = now() - t;
+    int commits = threads * commits_per_thread;
+    if(path != NULL) {
+        WAL_STATS st;
+        wal_get_stats(&st);
+        printf("%6d us  %10.0f  %8zu  %9.1f  %9zu\n", window_us, commits / s, st.syncs,
+               (double)st.commits / st.syncs, st.max_batch);
+        wal_close();
+        unlink(path);
+    } else {
+        printf("  no log  %10.0f\n", commits / s);
+    }
+    store_fini();
+}
+
+int main(int argc, char *argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 16;
+    commits_per_thread = argc > 2 ? atoi(argv[2]) : 200;
+    char *path = argc > 3 ? argv[3] : "/tmp/bench_wal.log";
+    int windows[] = { 0, 50, 100, 200, 500, 1000 };
+
+    trans_init();
+    printf("%d threads, %d commits each\n", threads, commits_per_thread);
+    printf(" window   commits/s     syncs  avg batch  max batch\n");
+    run(threads, NULL, 0);
+    for(int i = 0; i < sizeof(windows) / sizeof(windows[0]); i++)
+        run(threads, path, windows[i]);
+    trans_fini();
+    return 0;
+}
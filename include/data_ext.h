@@ -0,0 +1,134 @@
+#ifndef DATA_EXT_H
+#define DATA_EXT_H
+
+/*
+ * Additional blob prototypes.  These live here because data.h must not be
+ * modified.
+ */
+
+#include <stdint.h>
+#include "data.h"
+
+/*
+ * Create a blob with room for content of a given size, which the caller
+ * must fill in before the blob is shared with other threads.  This lets
+ * content be read straight into a blob (see proto_recv_blob()).  The
+ * content is followed by a null character.  The returned blob has one
+ * reference, which becomes the caller's responsibility.
+ *
+ * @param size  The size in bytes of the content.
+ * @return  The new blob, which has reference count 1.
+ */
+BLOB *blob_reserve(size_t size);
+
+/*
+ * Create a blob that takes over a buffer rather than copying it, such as
+ * the payload returned by proto_recv_packet().  The returned blob has one
+ * reference, which becomes the caller's responsibility.
+ *
+ * @param content  A buffer allocated with malloc, holding size bytes of
+ *   content followed by a null character.  It is freed with the blob.
+ * @param size  The size in bytes of the content.
+ * @return  The new blob, which has reference count 1.
+ */
+BLOB *blob_adopt(char *content, size_t size);
+
+/*
+ * A blob normally owns a private copy of its content.  A borrowed blob
+ * instead points at content that belongs to something else, such as a
+ * memory-mapped snapshot, which must stay valid for as long as the blob
+ * exists.  The content of a borrowed blob is not freed with the blob.
+ *
+ * Borrowed content may not have been read yet when the blob is created,
+ * so it can be given an expected hash (computed with hash_bytes() and seed
+ * 0) which blob_check() compares with the content the first time it is
+ * called.  This lets the content be checked when it is first used rather
+ * than when the blob is created.
+ */
+
+/*
+ * Create a blob whose content is not copied.  The returned blob has one
+ * reference, which becomes the caller's responsibility.
+ *
+ * @param content  The content of the blob, which must outlive the blob.
+ * @param size  The size in bytes of the content.
+ * @return  The new blob, which has reference count 1.
+ */
+BLOB *blob_create_borrowed(char *content, size_t size);
+
+/*
+ * Set the hash that the content of a blob is expected to have.
+ * This must be done before the blob is shared with other threads.
+ *
+ * @param bp  The blob.
+ * @param check  The expected value of hash_bytes(content, size, 0).
+ */
+void blob_expect(BLOB *bp, uint64_t check);
+
+/*
+ * Record the hash of the content of a blob, computed while the content was
+ * being filled in, so that blob_hash() does not have to read it again.
+ * This must be done before the blob is shared with other threads.
+ *
+ * @param bp  The blob.
+ * @param hash  The value of hash_bytes(content, size, 0).
+ */
+void blob_set_hash(BLOB *bp, uint64_t hash);
+
+/*
+ * Check the content of a blob against its expected hash, if it has one
+ * that has not been checked yet.
+ *
+ * @param bp  The blob.
+ * @return  0 if the content is as expected, or there is nothing to check,
+ *   otherwise -1.
+ */
+int blob_check(BLOB *bp);
+
+/*
+ * A spilled blob stands for content that has been written to the value
+ * log (see vlog.h) and is not in memory.  It has the size of the content,
+ * but its content is NULL, so the content must be read back with
+ * vlog_load() before it is used.  When a spilled blob is freed, its space
+ * in the value log is released.
+ */
+
+/*
+ * Create a spilled blob.  The returned blob has one reference, which
+ * becomes the caller's responsibility.
+ *
+ * @param size  The size in bytes of the content.
+ * @param offset  Where the content is in the value log.
+ * @param check  The value of hash_bytes(content, size, 0).
+ * @return  The new blob, which has reference count 1.
+ */
+BLOB *blob_create_spilled(size_t size, uint64_t offset, uint64_t check);
+
+/*
+ * Find out whether a blob is spilled, and if so where its content is.
+ *
+ * @param bp  The blob.
+ * @param offsetp  Variable into which the offset of the content in the
+ *   value log is stored, or NULL.
+ * @param checkp  Variable into which the hash of the content is stored,
+ *   or NULL.
+ * @return  Nonzero if the blob is spilled.
+ */
+int blob_is_spilled(BLOB *bp, uint64_t *offsetp, uint64_t *checkp);
+
+/*
+ * Find out whether a blob owns content that is in memory, as opposed to
+ * being spilled or borrowed.
+ *
+ * @param bp  The blob.
+ * @return  Nonzero if the blob owns its content.
+ */
+int blob_is_owned(BLOB *bp);
+
+/*
+ * Get the number of bytes of memory held by the content of all blobs that
+ * own their content.
+ */
+size_t blob_resident_bytes(void);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+ * Epoch-based reclamation, for data structures that are read without
+ * taking a lock.  A thread brackets each lock-free read with epoch_enter()
+ * and epoch_exit().  A writer that unlinks an object which such a reader
+ * might still be looking at does not free it directly, but passes it to
+ * epoch_retire(), which frees it once every thread that could have seen it
+ * has left the section in which it was reading.
+ *
+ * There is a global epoch number.  A thread entering a read section records
+ * the global epoch it saw.  The global epoch can only advance when every
+ * thread inside a read section has seen its current value, so an object
+ * retired during epoch e cannot be in use once the global epoch reaches e+2.
+ *
+ * Versions and blobs are always freed this way (see version_dispose() and
+ * blob_unref()), so a reader inside a read section may follow version
+ * links and read blob content it reached through the store without taking
+ * references: whatever it can still see stays allocated until it leaves.
+ *
+ * Threads register themselves on first use.  Objects retired by a thread
+ * that exits before they could be freed are handed to whichever thread
+ * next advances the epoch.
+ */
+
+/*
+ * Enter a read section.  Sections may be nested.
+ */
+void epoch_enter(void);
+
+/*
+ * Leave a read section.
+ */
+void epoch_exit(void);
+
+/*
+ * Arrange for an object to be freed once no read section that was active
+ * when it was unlinked can still be using it.  The object must already be
+ * unreachable for readers that start after this call.
+ *
+ * @param ptr  The object.
+ * @param fn  Function called with ptr to free it.  It may itself retire
+ *   other objects.
+ */
+void epoch_retire(void *ptr, void (*fn)(void *));
+
+/*
+ * Free every retired object immediately, including any retired by the
+ * free functions themselves.  This may only be called when no
+ * thread is inside a read section, such as when the store is finalized.
+ */
+void epoch_reclaim_all(void);
+
+#endif
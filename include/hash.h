@@ -0,0 +1,70 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 64-bit hash of arbitrary data, using the XXH64 algorithm.  The whole
+ * input is hashed, in 32-byte stripes spread over four independent lanes,
+ * so every byte affects every bit of the result and long inputs are hashed
+ * at close to memory speed.
+ *
+ * @param data  The data to be hashed.
+ * @param len  The number of bytes of data.
+ * @param seed  Seed for the hash; different seeds give unrelated hashes.
+ * @return  The hash value.
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+
+/*
+ * State of a hash of data that arrives in pieces, such as a payload being
+ * read from a socket, so that each piece can be hashed while it is still
+ * in the cache.  The result is the same as that of hash_bytes() over all
+ * the pieces put together.
+ */
+typedef struct hash_state {
+    uint64_t lanes[4];
+    uint64_t seed;
+    uint64_t total;             // Bytes hashed so far.
+    unsigned char stripe[32];   // Start of a stripe not yet complete.
+    size_t buffered;            // Bytes in stripe.
+} HASH_STATE;
+
+/*
+ * Start hashing data that arrives in pieces.
+ *
+ * @param sp  The state of the hash.
+ * @param seed  Seed for the hash, as for hash_bytes().
+ */
+void hash_init(HASH_STATE *sp, uint64_t seed);
+
+/*
+ * Hash the next piece of data.
+ *
+ * @param sp  The state of the hash.
+ * @param data  The data.
+ * @param len  The number of bytes of data.
+ */
+void hash_update(HASH_STATE *sp, const void *data, size_t len);
+
+/*
+ * Finish hashing data that arrived in pieces.
+ *
+ * @param sp  The state of the hash.
+ * @return  The hash value, the same as hash_bytes() would give for all the
+ *   pieces put together.
+ */
+uint64_t hash_final(HASH_STATE *sp);
+
+/*
+ * Fold a 64-bit hash into 32 bits, keeping the influence of all 64 bits.
+ *
+ * @param h  The 64-bit hash.
+ * @return  The folded hash.
+ */
+static inline uint32_t hash_fold(uint64_t h) {
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "data.h"
+
+/*
+ * The index is a skiplist containing the key of every map entry in the
+ * store, kept in key order, so that the store can find all the keys in a
+ * range without visiting every bucket.  Keys are ordered by comparing their
+ * content bytewise (as with memcmp), with a shorter key ordered before any
+ * longer key of which it is a prefix.
+ *
+ * To keep range scans serializable, the index also remembers which "gaps"
+ * between adjacent keys have been scanned, and by which transaction.
+ * A key may not be inserted into a gap that has been scanned by a transaction
+ * with a greater ID than the inserting transaction, since the scan should have
+ * seen it.  This is the same rule the store applies to versions of a key.
+ *
+ * The index does not own the keys it contains: a key stays in the index
+ * only as long as the map entry that owns it.
+ *
+ * The index is split into 2^INDEX_STRIPE_BITS independently locked
+ * stripes by the hash of the key, so that creating keys in different
+ * stripes does not serialize; a scan visits all of them.
+ */
+#define INDEX_STRIPE_BITS 6
+#define INDEX_STRIPES (1 << INDEX_STRIPE_BITS)
+
+/*
+ * Initialize the index.
+ */
+void index_init(void);
+
+/*
+ * Finalize the index, freeing its nodes (but not the keys in them).
+ */
+void index_fini(void);
+
+/*
+ * Insert a key into the index on behalf of a transaction.
+ *
+ * @param kp  The key, which must not already be in the index.
+ * @param id  The ID of the transaction creating the key.
+ * @return  0 if the key was inserted, or -1 if the gap the key falls into
+ *   has been scanned by a transaction with a greater ID, in which case the
+ *   key is not inserted.
+ */
+int index_insert(KEY *kp, unsigned int id);
+
+/*
+ * Remove a key from the index.  The gap before the key and the gap after
+ * it become a single gap, which counts as scanned by whichever transaction
+ * with the greater ID scanned either of them.
+ *
+ * @param kp  The key, which must be in the index.
+ */
+void index_remove(KEY *kp);
+
+/*
+ * Find the keys in a range on behalf of a transaction, and record that the
+ * transaction has scanned that range.
+ *
+ * @param lo  Lowest key in the range, or NULL for no lower bound.
+ * @param hi  Key just past the end of the range, or NULL for no upper bound.
+ * @param id  The ID of the scanning transaction.
+ * @param keysp  Variable into which a pointer to an array of keys is stored.
+ *   The keys are new keys, in order, sharing the blobs of the keys in the
+ *   index.  The caller becomes responsible for the keys and for freeing the
+ *   array.
+ * @return  The number of keys in the array.
+ */
+int index_scan(BLOB *lo, BLOB *hi, unsigned int id, KEY ***keysp);
+
+/*
+ * Compare the content of two blobs in key order.
+ *
+ * @return  Negative, zero, or positive as the first blob orders before,
+ *   equal to, or after the second.
+ */
+int index_compare(BLOB *bp1, BLOB *bp2);
+
+#endif
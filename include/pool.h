@@ -0,0 +1,91 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Object pools, for small fixed-size objects that are created and freed at
+ * a high rate (transactions, versions, dependencies).  Each thread keeps a
+ * cache of free objects for each pool, so most allocations and frees touch
+ * no lock and no shared cache line.  An object may be freed by a different
+ * thread than the one that allocated it: it simply goes into the freeing
+ * thread's cache.  When a cache holds 2 * POOL_BATCH objects, POOL_BATCH
+ * of them are moved to the shared free list of the pool in one piece, and
+ * an empty cache takes a whole batch back from there.  Only when the
+ * shared list is empty is a new slab of POOL_SLAB objects allocated with
+ * malloc.  Slabs are never returned to malloc, so the memory of a pool
+ * stays as large as it has ever needed to be.  A thread that exits moves
+ * its caches to the shared lists.
+ *
+ * If pool_caching is 0 when an object is allocated, it comes straight
+ * from malloc instead, and pool_free() must then see the same setting.
+ * It is only meant to be changed while no pooled objects exist, to
+ * measure what the pools save.
+ */
+#define POOL_BATCH 32
+#define POOL_SLAB 256
+#define POOL_MAX 48
+
+extern int pool_caching;
+
+typedef struct pool {
+    char *name;
+    size_t size;                // Object size, as given.
+    int index;                  // Slot in the thread caches, or -1 if none yet.
+    pthread_mutex_t mutex;      // Protects the fields below.
+    void *batches;              // Shared list of free batches.
+    size_t free_objects;        // Objects in the shared list.
+    size_t slabs;               // Slabs allocated so far.
+    size_t refills;             // Batches taken by thread caches.
+    size_t flushes;             // Batches given back by thread caches.
+} POOL;
+
+#define POOL_INITIALIZER(name, size) \
+    { (name), (size), -1, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0 }
+
+/*
+ * Counters for a pool.
+ */
+typedef struct pool_stats {
+    size_t slabs;           // Slabs allocated with malloc.
+    size_t objects;         // Objects in those slabs.
+    size_t free_objects;    // Objects in the shared free list.
+    size_t refills;         // Batches taken by thread caches.
+    size_t flushes;         // Batches given back by thread caches.
+} POOL_STATS;
+
+/*
+ * Allocate an object from a pool.
+ *
+ * @param pp  The pool.
+ * @return  The object, zero-filled.
+ */
+void *pool_alloc(POOL *pp);
+
+/*
+ * Allocate an object from a pool without zero-filling it, for callers that
+ * are about to fill in all of it.
+ *
+ * @param pp  The pool.
+ * @return  The object.
+ */
+void *pool_alloc_uninit(POOL *pp);
+
+/*
+ * Return an object to a pool.
+ *
+ * @param pp  The pool it was allocated from.
+ * @param obj  The object, or NULL.
+ */
+void pool_free(POOL *pp, void *obj);
+
+/*
+ * Get the counters for a pool.
+ *
+ * @param pp  The pool.
+ * @param sp  Structure into which the counters are stored.
+ */
+void pool_get_stats(POOL *pp, POOL_STATS *sp);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef PROTOCOL_EXT_H
+#define PROTOCOL_EXT_H
+
+#include "protocol.h"
+#include "data.h"
+
+/*
+ * Additional packet types for the Xacto protocol.  These live here because
+ * protocol.h must not be modified.  They are numbered after the packet types
+ * in protocol.h, so clients that do not use them are unaffected.
+ *
+ * Client-to-server requests:
+ *   SCAN:    Get all the mappings with keys in a range
+ *            (sends request serial #, then two KEY packets: the lowest key
+ *             in the range and the key just past the end of the range,
+ *             either of which may be null to leave that end unbounded)
+ *            (reply echoes serial # and returns status, then a KEY packet
+ *             and a VALUE packet for each mapping in the range, in key order,
+ *             then a null KEY packet whose status field gives the final
+ *             status of the transaction)
+ *   BATCH:   Run a whole transaction, retrying it if it aborts
+ *            (sends request serial #, then PUT and GET requests with their
+ *             KEY and VALUE packets as usual, then a COMMIT request; the
+ *             server replies to none of these)
+ *            (reply echoes serial # and returns the final status, then,
+ *             if that is committed, a VALUE packet for each GET, in order)
+ *
+ * A connection carries any number of transactions, one after another.  The
+ * first request after a COMMIT, or after a reply whose status is aborted,
+ * starts a new transaction.  The reply to a GET that aborts the transaction
+ * is still followed by a VALUE packet, a null one.  A BATCH may only be sent
+ * between transactions.
+ */
+#define XACTO_SCAN_PKT (XACTO_REPLY_PKT + 1)
+#define XACTO_BATCH_PKT (XACTO_REPLY_PKT + 2)
+
+/*
+ * Receive a data packet, blocking until one is available, and read its
+ * payload straight into a new blob (see blob_reserve()).  The returned
+ * structure has its multi-byte fields in network byte order.
+ *
+ * @param fd  The file descriptor from which the packet is to be received.
+ * @param pkt  Pointer to caller-supplied storage for the fixed-size
+ *   portion of the packet.
+ * @param bpp  Variable into which to store the blob, with one reference,
+ *   which becomes the caller's responsibility.  It is NULL for a null
+ *   packet, and an empty blob for one with an empty payload.
+ * @param hash  If nonzero, the payload is hashed piece by piece as it
+ *   arrives, and the hash is kept with the blob (see blob_set_hash()), so
+ *   that a key made from it needs no second pass over the content.
+ * @return  0 in case of successful reception, -1 otherwise.
+ */
+int proto_recv_blob(int fd, XACTO_PACKET *pkt, BLOB **bpp, int hash);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SERVER_EXT_H
+#define SERVER_EXT_H
+
+/*
+ * Additional server prototypes and constants.  These live here because
+ * server.h must not be modified.
+ */
+
+#include <stddef.h>
+#include "server.h"
+
+/*
+ * A client that sends a whole transaction as a BATCH (see protocol_ext.h)
+ * lets the server retry it: if the transaction aborts, the server runs the
+ * operations again in a new transaction, up to server_batch_retries more
+ * times, and only then gives up.  The client gets one reply with the final
+ * outcome, and keeps its connection either way.
+ */
+#define SERVER_BATCH_RETRIES 8
+
+extern int server_batch_retries;
+
+/*
+ * Counters for batches since the server started.
+ */
+typedef struct server_batch_stats {
+    size_t batches;         // Batches received.
+    size_t commits;         // Batches that committed in the end.
+    size_t failures;        // Batches that still aborted on the last try.
+    size_t retries;         // Tries after the first, over all batches.
+} SERVER_BATCH_STATS;
+
+/*
+ * Get the counters for batches.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void server_get_batch_stats(SERVER_BATCH_STATS *sp);
+
+#endif
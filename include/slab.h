@@ -0,0 +1,60 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/*
+ * Slab allocator for blob memory, whose sizes vary but cluster around a few
+ * values.  Sizes up to SLAB_MAX bytes are rounded up to one of
+ * SLAB_CLASSES size classes, and each class is an object pool (see
+ * pool.h), so it has the same thread caches and slabs that are never
+ * returned to malloc.  Memory freed in one class is only ever reused for
+ * that class, so a long run of allocations and frees of mixed sizes does
+ * not fragment the heap.  Classes are spaced 32 bytes apart from 96 up to
+ * 256 bytes, the smallest blob being 96 bytes, and four to each doubling
+ * above that, so no more than a quarter of a slot is left unused.  Larger
+ * sizes go to malloc.
+ *
+ * Unlike malloc, the allocator must be told the size again when memory is
+ * freed, so the caller has to know it.
+ */
+#define SLAB_CLASSES 26
+#define SLAB_MAX 8192
+
+/*
+ * Counters for the slab allocator, in bytes.  The memory the size classes
+ * hold is reserved, of which what has been handed out is in use and the
+ * rest is idle; of what is in use, only requested bytes were asked for,
+ * and the rest is lost to rounding up.
+ */
+typedef struct slab_stats {
+    size_t reserved;        // Memory of all slabs taken from malloc.
+    size_t in_use;          // Slots handed out and not yet freed.
+    size_t requested;       // Sizes asked for in those slots.
+    size_t large;           // Memory of larger objects, taken from malloc.
+} SLAB_STATS;
+
+/*
+ * Allocate memory, which is not zero-filled.
+ *
+ * @param size  The number of bytes needed.
+ * @return  The memory.
+ */
+void *slab_alloc(size_t size);
+
+/*
+ * Free memory allocated by slab_alloc().
+ *
+ * @param ptr  The memory, or NULL.
+ * @param size  The size that was given to slab_alloc().
+ */
+void slab_free(void *ptr, size_t size);
+
+/*
+ * Get the counters for the slab allocator.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void slab_get_stats(SLAB_STATS *sp);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+ * A snapshot is a file holding the most recent committed value of every key
+ * in the store, so that a restarted server can pick up where it left off.
+ *
+ * The file starts with a header giving a magic string ("XACTOSNP"), the
+ * format version (SNAPSHOT_VERSION), and the location and size of two
+ * sections.  The record section has one record per key, in key order, each
+ * giving the size of the key, the location, size and hash of the value,
+ * and then the bytes of the key itself, padded to a multiple of 8 bytes.
+ * The value section has the values, one after the other.  All numbers are
+ * in the byte order of the machine that wrote the file, so a snapshot is
+ * only meant to be read on the same kind of machine.
+ *
+ * The header holds a hash of itself and a hash of the record section, and
+ * both are checked when the snapshot is loaded.  The values are not read
+ * when the snapshot is loaded: the file is mapped into memory and the store
+ * refers to the values where they are, so they are paged in only when they
+ * are used.  Each value is checked against the hash in its record the first
+ * time it is read (see blob_check() in data_ext.h).  All hashes are XXH64
+ * (see hash.h) with seed 0.
+ *
+ * A snapshot is written to a temporary file which is synced and then renamed
+ * over the old snapshot, so a crash while writing leaves the old one intact.
+ */
+
+#define SNAPSHOT_MAGIC "XACTOSNP"
+#define SNAPSHOT_VERSION 1
+
+/*
+ * Write a snapshot of the store, as of the moment this is called, while
+ * requests go on.  The snapshot holds the values left by the transactions
+ * that had committed by then (see store_each_as_of in store_ext.h), so it
+ * is consistent even though later transactions may commit while it is
+ * being taken.  If the write-ahead log is open, it is rotated at the same
+ * point, and its old segment is removed once the snapshot is safely
+ * written (see wal.h).
+ *
+ * @param path  Name of the snapshot file.
+ * @return  0 if the snapshot was written, otherwise -1.
+ */
+int snapshot_write(char *path);
+
+/*
+ * Load a snapshot into the store, which must have been initialized and
+ * should be empty.  The values are entered by a single transaction which
+ * is committed before this returns, so this must be done before any other
+ * transaction is created.  The file stays mapped until snapshot_unmap()
+ * is called.
+ *
+ * @param path  Name of the snapshot file.
+ * @return  The number of keys loaded, 0 if there is no such file, or -1 if
+ *   the file could not be read or is not a valid snapshot.
+ */
+long snapshot_load(char *path);
+
+/*
+ * Unmap a snapshot that was loaded.  This may only be done once the store
+ * has been finalized and nothing refers to the values in the snapshot.
+ */
+void snapshot_unmap(void);
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef STORE_EXT_H
+#define STORE_EXT_H
+
+/*
+ * Additional store prototypes and constants.  These live here because
+ * store.h must not be modified.
+ */
+
+#include <stddef.h>
+#include "store.h"
+
+/*
+ * The map is divided into 2^STORE_SEGMENT_BITS segments, each an independent
+ * hash table with its own lock, so that operations on keys in different
+ * segments can proceed in parallel.  The number of segments is taken from
+ * store_segment_bits when store_init() is called; setting it to 0 gives a
+ * single table protected by a single lock.
+ *
+ * Each segment starts out with NUM_BUCKETS buckets and its size is always
+ * a power of two.  The "load factor" is the average number of entries per
+ * bucket.  When the load factor of a segment rises above STORE_MAX_LOAD its
+ * table is doubled, and when it drops below 1/STORE_MIN_LOAD_DIV the table
+ * is halved (but never below NUM_BUCKETS).
+ *
+ * A resize does not move all the entries at once.  Instead, the old table is
+ * kept around and every operation on the segment moves STORE_REHASH_STEP
+ * buckets from the old table into the new one, so that no single request
+ * pays for the whole resize.
+ */
+#ifndef STORE_SEGMENT_BITS
+#define STORE_SEGMENT_BITS 6
+#endif
+#define STORE_MAX_LOAD 2
+#define STORE_MIN_LOAD_DIV 8
+#define STORE_REHASH_STEP 4
+
+extern int store_segment_bits;
+
+/*
+ * When the only version of a key is a committed one, its value is "settled",
+ * and a GET of that key is served without taking the segment lock and
+ * without adding a version to the key.  Reads still count for ordering
+ * transactions: once a transaction has read a settled value, no transaction
+ * with a smaller ID may access that key.  Setting store_fast_reads to 0
+ * makes every GET take the lock and add a version, as before.
+ */
+extern int store_fast_reads;
+
+/*
+ * Setting store_occ before store_init() selects optimistic concurrency
+ * control instead of the ordering of transactions by ID.  A PUT then only
+ * adds to the write set of the transaction, and a GET reads the transaction's
+ * own last write of the key, or else the last committed value, whose version
+ * goes in the read set (see transaction_ext.h).  Nothing is added to the key
+ * and no transaction is aborted for its ID.  When the transaction commits,
+ * a validate hook checks, one transaction at a time, that nothing it read
+ * has been replaced since, and if so installs its writes; otherwise it
+ * aborts.  So conflicts cost an abort only when they overlap in time, and
+ * then only the transaction that committed last pays.  Scans read each key
+ * as a GET does, but do not guard the range against keys created after the
+ * scan.
+ */
+extern int store_occ;
+
+/*
+ * Superseded and aborted versions are removed from a key whenever the key is
+ * accessed, but keys nobody touches would keep them forever.  The garbage
+ * collector thread, started by store_gc_start(), sweeps the whole store in
+ * batches of STORE_GC_BUCKETS buckets, holding a segment lock only for one
+ * batch.  It removes dead versions, aborts the creators of versions that
+ * came after an aborted one, and removes keys left with no versions.
+ * While it is running, requests only remove aborted versions inline and
+ * leave the rest to it.
+ *
+ * store_gc_budget is the percentage of one CPU the collector may use: it
+ * sleeps in proportion to the time it spends sweeping.  A full pass over
+ * the store starts at most every STORE_GC_INTERVAL_MS milliseconds.
+ */
+#define STORE_GC_BUCKETS 64
+#define STORE_GC_BUDGET 10
+#define STORE_GC_INTERVAL_MS 100
+
+extern int store_gc_budget;
+
+/*
+ * If store_memory_cap is nonzero, the store tries to keep no more than that
+ * many bytes of blob content in memory (see blob_resident_bytes in
+ * data_ext.h).  While it holds more, the collector thread sweeps without
+ * pausing, whatever its budget, and spills cold values to the value log (see
+ * vlog.h), which must be open.  A value is cold if it is the settled value
+ * of its key, is at least STORE_SPILL_MIN bytes long, and nobody has read
+ * it since the previous pass: each GET marks the key as referenced, and
+ * each pass clears the mark, so a key read between two passes gets a
+ * second chance (the CLOCK algorithm).  Up to STORE_SPILL_BATCH values are
+ * chosen per batch of buckets and written out without the segment lock.
+ * A GET that finds a spilled value reads it back and puts it in memory
+ * again.
+ */
+#define STORE_SPILL_MIN 64
+#define STORE_SPILL_BATCH 16
+
+extern size_t store_memory_cap;
+
+/*
+ * Counters describing the shape of the map and the work of the garbage
+ * collector.
+ */
+typedef struct store_stats {
+    int num_segments;       // Number of independently locked segments.
+    size_t num_entries;     // Number of map entries in the store.
+    int num_buckets;        // Number of buckets in the current tables.
+    int old_num_buckets;    // Buckets in tables still being drained by a resize.
+    double load_factor;     // Entries per bucket of the current tables.
+    size_t grows;           // Number of times the table has been doubled.
+    size_t shrinks;         // Number of times the table has been halved.
+    size_t rehashed;        // Number of entries moved by incremental rehashing.
+    size_t max_chain;       // Length of the longest bucket chain.
+    size_t reclaimed;       // Versions removed by garbage collection.
+    size_t cascaded;        // Creators aborted by garbage collection.
+    size_t removed;         // Keys removed for having no versions left.
+    size_t gc_passes;       // Full passes made by the collector thread.
+    double gc_last_pass_ms; // Wall time of the last full pass.
+    double gc_max_pass_ms;  // Wall time of the longest full pass.
+    double gc_busy_ms;      // Total time spent sweeping, not counting sleeps.
+    size_t occ_validations; // Transactions validated in optimistic mode.
+    size_t occ_conflicts;   // Of those, ones that failed and aborted.
+} STORE_STATS;
+
+/*
+ * Get the values for all the keys in a range, in key order (see index.h).
+ * Each key in the range is read as if by store_get, so the scan follows
+ * the same rules about transaction IDs and dependencies.  In addition the
+ * range itself is recorded as having been read by the transaction, so that
+ * a transaction with a smaller ID can no longer create a key in it.
+ * Keys whose value is NULL are skipped.
+ *
+ * @param tp  The transaction in which the operation is being performed.
+ * @param lo  Lowest key in the range, or NULL for no lower bound.
+ * @param hi  Key just past the end of the range, or NULL for no upper bound.
+ * @param fn  Function called with each key and value.  It does not
+ *   inherit the references passed to it.  If it returns nonzero the scan is
+ *   stopped.
+ * @param arg  Argument passed through to fn.
+ * @return  Updated status of the transation, either TRANS_PENDING,
+ *   or TRANS_ABORTED.
+ */
+TRANS_STATUS store_scan(TRANSACTION *tp, BLOB *lo, BLOB *hi,
+                        int (*fn)(BLOB *key, BLOB *value, void *arg), void *arg);
+
+/*
+ * A checkpoint reads a consistent state of the store while requests go on.
+ * It chooses a commit sequence number (see transaction_ext.h) after
+ * calling store_checkpoint_begin(), and store_each_as_of() then gives it
+ * the value of every key as of that number.  Until store_checkpoint_end(),
+ * garbage collection keeps the versions holding those values, even if
+ * later transactions have replaced them, and segments are not resized.
+ */
+
+/*
+ * Start a checkpoint.  Only one checkpoint may be in progress.
+ */
+void store_checkpoint_begin(void);
+
+/*
+ * Call a function with every key in the store and its value as of a commit
+ * sequence number, which is the value left by the transactions that
+ * committed with numbers up to seq.  Keys with no value then, or a NULL
+ * one, are skipped.  This must be called between store_checkpoint_begin()
+ * and store_checkpoint_end(), with seq chosen after the checkpoint began.
+ * A segment is locked only for a few buckets at a time, and fn is called
+ * with it locked, so fn must not call back into the store.
+ *
+ * @param seq  The commit sequence number.
+ * @param fn  Function called with each key and value.  It does not
+ *   inherit the references passed to it.
+ * @param arg  Argument passed through to fn.
+ */
+void store_each_as_of(unsigned long seq, void (*fn)(BLOB *key, BLOB *value, void *arg), void *arg);
+
+/*
+ * Finish a checkpoint.
+ */
+void store_checkpoint_end(void);
+
+/*
+ * Start the garbage collector thread, if it is not already running.
+ * While it runs, store operations leave superseded committed versions
+ * for it to remove, rather than removing them inline.
+ */
+void store_gc_start(void);
+
+/*
+ * Stop the garbage collector thread, if it is running, and wait for it
+ * to finish.  This is also done by store_fini().
+ */
+void store_gc_stop(void);
+
+/*
+ * Get the current counters for the store.  The max_chain field requires
+ * a walk over every bucket, so this is not meant for the request path.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void store_get_stats(STORE_STATS *sp);
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef TRANSACTION_EXT_H
+#define TRANSACTION_EXT_H
+
+/*
+ * Additional transaction prototypes.  These live here because
+ * transaction.h must not be modified.
+ */
+
+#include <stddef.h>
+#include "transaction.h"
+#include "data.h"
+
+/*
+ * Transaction IDs are given out by an atomic counter, so creating a
+ * transaction takes no global lock.  Live transactions are registered in
+ * TRANS_SHARDS separately locked lists instead of trans_list (see
+ * transaction.h), which stays empty.
+ */
+#define TRANS_SHARDS 64
+
+/*
+ * Count the transactions that have not yet been freed.  This locks each
+ * shard of the registry in turn, so it is not meant for the request path.
+ *
+ * @return  The number of live transactions.
+ */
+size_t trans_count_live(void);
+
+/*
+ * The write set of a transaction is the list of PUTs it has performed, in
+ * the order performed.  A key may appear more than once, in which case the
+ * last value is the one that counts.  The store only records writes while
+ * trans_track_writes is nonzero, since nothing needs them otherwise.
+ * Writes are only added and read by the thread running the transaction,
+ * so the write set is not locked.
+ */
+typedef struct trans_write {
+    BLOB *key;
+    BLOB *value;                // NULL for a PUT that deletes the key.
+    struct trans_write *next;
+} TRANS_WRITE;
+
+extern int trans_track_writes;
+
+/*
+ * Add a PUT to the write set of a transaction.
+ *
+ * @param tp  The transaction.
+ * @param key  The key blob, of which the write set takes a new reference.
+ * @param value  The value blob, of which the write set takes a new
+ *   reference, or NULL.
+ */
+void trans_add_write(TRANSACTION *tp, BLOB *key, BLOB *value);
+
+/*
+ * Get the write set of a transaction.
+ *
+ * @param tp  The transaction.
+ * @return  The first write, or NULL if the write set is empty.  The writes
+ *   belong to the transaction and are freed with it.
+ */
+TRANS_WRITE *trans_get_writes(TRANSACTION *tp);
+
+/*
+ * The read set of a transaction is used by the store in optimistic mode
+ * (see store_ext.h): each entry names a key that was read from the store
+ * and the ID of the creator of the version that was read, or 0 if the key
+ * had no value.  Like the write set, it is only touched by the thread
+ * running the transaction.
+ */
+typedef struct trans_read {
+    BLOB *key;
+    unsigned int version;       // Creator of the version read, or 0.
+    struct trans_read *next;
+} TRANS_READ;
+
+/*
+ * Add a read to the read set of a transaction.
+ *
+ * @param tp  The transaction.
+ * @param key  The key blob, of which the read set takes a new reference.
+ * @param version  The ID of the creator of the version read, or 0.
+ */
+void trans_add_read(TRANSACTION *tp, BLOB *key, unsigned int version);
+
+/*
+ * Get the read set of a transaction.
+ *
+ * @param tp  The transaction.
+ * @return  The first read, or NULL if the read set is empty.  The reads
+ *   belong to the transaction and are freed with it.
+ */
+TRANS_READ *trans_get_reads(TRANSACTION *tp);
+
+/*
+ * A commit hook is called by trans_commit once every transaction the
+ * committing transaction depends on has committed, just before the
+ * committing transaction is itself marked committed.  If the hook fails,
+ * the transaction aborts instead.  Transactions that depend on the
+ * committing one keep waiting until the hook returns, so anything the hook
+ * does (such as making the write set durable) is done before they can commit.
+ *
+ * @param tp  The committing transaction.
+ * @return  0 if the transaction may commit, -1 if it must abort.
+ */
+typedef int TRANS_COMMIT_HOOK(TRANSACTION *tp);
+
+/*
+ * Set the commit hook, replacing any previous one.
+ *
+ * @param hook  The hook, or NULL for none.
+ */
+void trans_set_commit_hook(TRANS_COMMIT_HOOK *hook);
+
+/*
+ * A validate hook is called by trans_commit before it waits for the
+ * dependencies of the committing transaction.  Dependencies it adds are
+ * waited for like the others, and then the commit hook is called.  If it
+ * fails, the transaction aborts instead.
+ *
+ * @param hook  The hook, or NULL for none.
+ */
+void trans_set_validate_hook(TRANS_COMMIT_HOOK *hook);
+
+/*
+ * Wait until a transaction has committed or aborted.
+ *
+ * @param tp  The transaction, on which the caller must hold a reference.
+ * @return  The final status of the transaction.
+ */
+TRANS_STATUS trans_wait(TRANSACTION *tp);
+
+/*
+ * A transaction registers with each dependency it adds while that one is
+ * pending.  When a dependency commits it decrements the count of pending
+ * dependencies of each of its dependents, and when it aborts it aborts
+ * them, and their own dependents in turn.  A committing transaction thus
+ * waits for all its dependencies at once, until the count reaches 0 or it
+ * is aborted, whichever comes first.  It spins for a while before going
+ * to sleep; the length of the spin adapts between 0 and TRANS_SPIN_MAX
+ * rounds according to whether spinning has recently been long enough.
+ * Wait times are counted in TRANS_WAIT_BUCKETS buckets: bucket 0 holds
+ * waits under 1 us, and bucket i > 0 those from 2^(i-1) us to under
+ * 2^i us, except that the last bucket also holds everything longer.
+ */
+#define TRANS_SPIN_MAX 4096
+#define TRANS_WAIT_BUCKETS 24
+
+typedef struct trans_wait_stats {
+    size_t commits;         // Commits with a nonempty dependency set.
+    size_t waits;           // Of those, commits that had to wait.
+    size_t spun;            // Waits that ended while spinning.
+    size_t slept;           // Waits that went to sleep.
+    int spin_limit;         // Current length of the spin.
+    size_t histogram[TRANS_WAIT_BUCKETS];
+} TRANS_WAIT_STATS;
+
+/*
+ * Get the counters for commit waits.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void trans_get_wait_stats(TRANS_WAIT_STATS *sp);
+
+/*
+ * Each transaction that commits is given a commit sequence number, greater
+ * than that of every transaction that was given one before it.  Numbers
+ * start at 1; 0 means the transaction has not been given one.  A
+ * transaction gets its number just before it is marked committed, after
+ * every transaction it depends on, so the transactions with numbers up to
+ * any given one form a consistent state of the store (see store_each_as_of
+ * in store_ext.h).  A transaction that aborts after getting a number
+ * keeps it, but it still counts as aborted.
+ *
+ * A commit hook that needs to order its own work by sequence number can
+ * get the number early, by calling trans_assign_sequence() itself.
+ */
+
+/*
+ * Give a committing transaction its commit sequence number, if it does not
+ * have one yet.
+ *
+ * @param tp  The transaction.
+ * @return  The sequence number of the transaction.
+ */
+unsigned long trans_assign_sequence(TRANSACTION *tp);
+
+/*
+ * Get the commit sequence number of a transaction.
+ *
+ * @param tp  The transaction.
+ * @return  The sequence number, or 0 if it has not been given one.
+ */
+unsigned long trans_sequence(TRANSACTION *tp);
+
+/*
+ * Get the greatest commit sequence number given out so far.
+ */
+unsigned long trans_last_sequence(void);
+
+#endif
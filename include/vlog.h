@@ -0,0 +1,85 @@
+#ifndef VLOG_H
+#define VLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "data.h"
+
+/*
+ * The value log is the disk tier of the store.  When the store holds more
+ * than store_memory_cap bytes of blob content (see store_ext.h), the
+ * garbage collector spills cold values to the value log, replacing each in
+ * the store by a spilled blob (see data_ext.h) that only records where the
+ * content went.  A GET that finds a spilled value reads it back and puts
+ * it in memory again.
+ *
+ * The log is a scratch file: it only holds values for as long as the
+ * server runs, and durability is left to the write-ahead log and
+ * snapshots.  Space is taken from the end of the file without a lock, and
+ * when a spilled blob is freed its range is released by punching a hole
+ * in the file, so the log never needs compacting.  Each spilled value is
+ * checked against its XXH64 hash (see hash.h) when it is read back.
+ */
+
+/*
+ * Counters for the value log.
+ */
+typedef struct vlog_stats {
+    size_t resident_bytes;  // Bytes of blob content in memory.
+    size_t spills;          // Values written to the log.
+    size_t spilled_bytes;   // Bytes of values in the log not yet released.
+    size_t reloads;         // Values read back from the log.
+    double reload_avg_us;   // Average time to read a value back.
+    double reload_max_us;   // Longest time to read a value back.
+    size_t errors;          // Reads or writes that failed.
+} VLOG_STATS;
+
+/*
+ * Open the value log.
+ *
+ * @param path  Name of the file, which is replaced if it exists, or NULL
+ *   for an unnamed temporary file.
+ * @return  0 if successful, otherwise -1.
+ */
+int vlog_open(char *path);
+
+/*
+ * Close the value log.  Spilled blobs must not be read after this.
+ */
+void vlog_close(void);
+
+/*
+ * Write the content of a blob to the value log.
+ *
+ * @param bp  The blob, whose content must be in memory.
+ * @return  A spilled blob standing for the content, with one reference,
+ *   or NULL if the log is not open or could not be written.
+ */
+BLOB *vlog_spill(BLOB *bp);
+
+/*
+ * Read a spilled value back from the value log.
+ *
+ * @param bp  The spilled blob.
+ * @return  A new blob with the content, with one reference, or NULL if it
+ *   could not be read or did not match its hash.
+ */
+BLOB *vlog_load(BLOB *bp);
+
+/*
+ * Release the space of a spilled value.  This is called when a spilled
+ * blob is freed.
+ *
+ * @param offset  Where the value starts in the log.
+ * @param size  Size of the value.
+ */
+void vlog_release(uint64_t offset, size_t size);
+
+/*
+ * Get the counters for the value log.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void vlog_get_stats(VLOG_STATS *sp);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+
+/*
+ * The write-ahead log makes commits durable.  While the log is open, the
+ * write set of each committing transaction is appended to it and synced to
+ * disk before the transaction is marked committed, so a transaction whose
+ * commit has been reported survives a crash.  Transactions that wrote
+ * nothing are not logged.  When the log is opened, the transactions already
+ * in it are replayed into the store.
+ *
+ * Syncing is by far the most expensive part of a commit, so commits are
+ * grouped: the first committer to find no sync in progress becomes the
+ * leader, and writes and syncs everything appended so far, including the
+ * records of committers that arrived while it was waiting.  Those
+ * committers just wait for the sync to finish.  The leader may also wait
+ * wal_group_window_us microseconds before writing, to let more committers
+ * join the group, trading some latency for fewer syncs.
+ *
+ * The log starts with a header giving a magic string (WAL_MAGIC) and the
+ * format version (WAL_VERSION).  Each record that follows holds the write
+ * set of one transaction: the size of the record body, the number of
+ * writes, and an XXH64 hash (see hash.h) of the body, followed by the body,
+ * which gives the size and content of each key and value.  All numbers are
+ * in the byte order of the machine that wrote the log.  Replay stops at the
+ * first record that is incomplete or fails its check, which is where a
+ * crash interrupted a write, and the log is cut off there.
+ *
+ * A checkpoint (see snapshot_write in snapshot.h) rotates the log: the
+ * current file is renamed with WAL_OLD_SUFFIX and a new one is started, so
+ * that the old segment holds exactly the transactions the checkpoint
+ * includes.  Once the snapshot is safely written, the old segment is
+ * removed.  If the server stops before that, the old segment is replayed
+ * before the current one at startup.  Replaying transactions that are
+ * already in the snapshot does no harm, since each key ends up with the
+ * value the snapshot gives it.
+ */
+
+#define WAL_MAGIC "XACTOWAL"
+#define WAL_VERSION 1
+#define WAL_OLD_SUFFIX ".old"
+#define WAL_NEW_SUFFIX ".new"
+
+extern int wal_group_window_us;
+
+/*
+ * Counters for the log since it was opened.
+ */
+typedef struct wal_stats {
+    size_t commits;         // Transactions logged.
+    size_t syncs;           // Number of times the log was synced.
+    size_t bytes;           // Bytes appended.
+    size_t max_batch;       // Most transactions made durable by one sync.
+} WAL_STATS;
+
+/*
+ * Open the log, creating it if it does not exist, and replay it into the
+ * store, using a single transaction that is committed before this returns.
+ * If an old segment was left by a checkpoint that did not finish, it is
+ * replayed first, and the current segment is then appended to it, so that
+ * the log is back to a single file.
+ * This must be done after the store has been initialized (and any snapshot
+ * loaded) and before any other transaction is created.  From then on,
+ * trans_commit logs every transaction that wrote something.
+ *
+ * @param path  Name of the log file.
+ * @return  The number of transactions replayed, or -1 if the log could not
+ *   be opened or is not a log.
+ */
+long wal_open(char *path);
+
+/*
+ * Start a new segment of the log, for a checkpoint.  Everything appended
+ * so far is synced and moved to the old segment, and later commits go to
+ * the new one.  If an old segment is already there, because an earlier
+ * checkpoint did not finish, the records are appended to it instead.
+ *
+ * @param seqp  Variable into which is stored the commit sequence number
+ *   (see transaction_ext.h) that separates the two segments: transactions
+ *   in the old segment have numbers up to it, and those in the new
+ *   segment have greater numbers.
+ * @return  0 if successful, -1 if the log is not open or could not be
+ *   rotated, in which case it stays as it was.
+ */
+int wal_rotate(unsigned long *seqp);
+
+/*
+ * Remove the old segment of the log, once everything in it has been saved
+ * in some other way, such as in a snapshot.
+ *
+ * @return  0 if successful, otherwise -1.
+ */
+int wal_remove_old(void);
+
+/*
+ * Close the log.  Transactions committed after this are not logged.
+ */
+void wal_close(void);
+
+/*
+ * Get the counters for the log.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void wal_get_stats(WAL_STATS *sp);
+
+#endif
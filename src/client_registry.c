@@ -18,10 +18,11 @@
  * become empty before exiting the program.
  */
 typedef struct client_registry {
-    int fds;
-    pthread_mutex_t mutex;
-    sem_t sem;
+    int *fds;               // Registered file descriptors, count of them.
+    int size;               // Room in fds.
     int count;
+    pthread_mutex_t mutex;
+    pthread_cond_t empty;   // Signaled when count drops to zero.
 } CLIENT_REGISTRY;
 
 /*
@@ -35,12 +36,13 @@ CLIENT_REGISTRY *creg_init(){
     CLIENT_REGISTRY *head;
     if ((head  = calloc(sizeof(char),sizeof(CLIENT_REGISTRY))) == NULL)
         return NULL;
-    if(pthread_mutex_init(&head->mutex, NULL) < 0 || sem_init(&head->sem, 0, 0) < 0){
+    if(pthread_mutex_init(&head->mutex, NULL) != 0 || pthread_cond_init(&head->empty, NULL) != 0){
         Free(head);
         return NULL;
     }
     head->count = 0;
-    head->fds = -1;
+    head->size = 0;
+    head->fds = NULL;
     return head;
 }
 
@@ -54,10 +56,9 @@ CLIENT_REGISTRY *creg_init(){
  */
 void creg_fini(CLIENT_REGISTRY *cr){
     if(cr == NULL) return;
-    cr->fds = 0;
-    cr->count = 0;
+    Free(cr->fds);
     pthread_mutex_destroy(&cr->mutex);
-    sem_destroy(&cr->sem);
+    pthread_cond_destroy(&cr->empty);
     Free(cr);
 }
 
@@ -69,9 +70,12 @@ void creg_fini(CLIENT_REGISTRY *cr){
  * @return 0 if registration is successful, otherwise -1.
  */
 int creg_register(CLIENT_REGISTRY *cr, int fd){
-    if(cr == NULL || pthread_mutex_lock(&cr->mutex) < 0) return -1;
-    cr->count += 1;
-    cr->fds = fd;
+    if(cr == NULL || fd < 0 || pthread_mutex_lock(&cr->mutex) != 0) return -1;
+    if(cr->count == cr->size){
+        cr->size = cr->size ? cr->size * 2 : 16;
+        cr->fds = Realloc(cr->fds, cr->size * sizeof(int));
+    }
+    cr->fds[cr->count++] = fd;
     pthread_mutex_unlock(&cr->mutex);
     return 0;
 }
@@ -88,17 +92,19 @@ int creg_register(CLIENT_REGISTRY *cr, int fd){
  */
 int creg_unregister(CLIENT_REGISTRY *cr, int fd){
     if(cr == NULL || fd < 0) return -1;
-    if(pthread_mutex_lock(&cr->mutex) < 0) return -1;
-    if(cr->fds == fd){
-        cr->count--;
-        cr->fds = -1;
-        if(cr->count == 0){
-            if (sem_post(&cr->sem) < 0) return -1;
-        }
+    if(pthread_mutex_lock(&cr->mutex) != 0) return -1;
+    int i = 0;
+    while(i < cr->count && cr->fds[i] != fd) i++;
+    if(i == cr->count){
         pthread_mutex_unlock(&cr->mutex);
-        return 0;
+        debug("fd %d is not registered", fd);
+        return -1;
     }
-    return -1;
+    // Order does not matter, so the last one fills the hole.
+    cr->fds[i] = cr->fds[--cr->count];
+    if(cr->count == 0) pthread_cond_broadcast(&cr->empty);
+    pthread_mutex_unlock(&cr->mutex);
+    return 0;
 }
 
 /*
@@ -111,11 +117,12 @@ int creg_unregister(CLIENT_REGISTRY *cr, int fd){
  */
 void creg_wait_for_empty(CLIENT_REGISTRY *cr){
     if(cr == NULL)return;
+    pthread_mutex_lock(&cr->mutex);
     while(cr->count != 0){
-        sem_wait(&cr->sem);
-        cr->count--;
         debug("%d",cr->count);
+        pthread_cond_wait(&cr->empty, &cr->mutex);
     }
+    pthread_mutex_unlock(&cr->mutex);
 }
 
 /*
@@ -130,7 +137,9 @@ void creg_wait_for_empty(CLIENT_REGISTRY *cr){
  */
 void creg_shutdown_all(CLIENT_REGISTRY *cr){
     if(cr == NULL) return;
-    creg_unregister(cr, cr->fds);
-    shutdown(cr->fds, SHUT_RDWR);
+    pthread_mutex_lock(&cr->mutex);
+    // A service thread closes its descriptor only after unregistering it,
+    // so none of these can have been closed and reused yet.
+    for(int i = 0; i < cr->count; i++) shutdown(cr->fds[i], SHUT_RDWR);
+    pthread_mutex_unlock(&cr->mutex);
 }
-
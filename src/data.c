@@ -2,9 +2,87 @@
 
 #include "csapp.h"
 #include "data.h"
+#include "data_ext.h"
 #include "store.h"
 #include "debug.h"
 #include "transaction.h"
+#include "hash.h"
+#include "vlog.h"
+#include "pool.h"
+#include "epoch.h"
+#include "slab.h"
+
+#define BLOB_BORROWED 0x1     // Content is not owned by the blob.
+#define BLOB_UNCHECKED 0x2    // Content has an expected hash not yet checked.
+#define BLOB_SPILLED 0x4      // Content is in the value log, at offset.
+#define BLOB_ADOPTED 0x8      // Owned content in a buffer of its own.
+#define BLOB_HASHED 0x10      // The hash of the content is known, in check.
+
+/*
+ * Every blob is allocated with some extra fields that data.h has no
+ * room for.  A blob that owns its content keeps it inline, after these
+ * fields, so that the blob takes one allocation from the slab allocator,
+ * unless it adopted a buffer that already held the content.  Either way
+ * its prefix is not a copy but points at the content, which ends with a
+ * null character.
+ */
+typedef struct blob_ext {
+    BLOB blob;                // Must be first.
+    int flags;
+    uint64_t check;           // Hash, if BLOB_UNCHECKED, BLOB_SPILLED or BLOB_HASHED.
+    uint64_t offset;          // Place in the value log, if BLOB_SPILLED.
+    char data[];              // Owned content and a null character.
+} BLOB_EXT;
+
+/*
+ * Versions come from an object pool (see pool.h).
+ */
+static POOL version_pool = POOL_INITIALIZER("version", sizeof(VERSION));
+
+/*
+ * Bytes allocated for the content of blobs that own it.
+ */
+static size_t resident_bytes = 0;
+
+/*
+ * Allocate a blob from the slab allocator (see slab.h), with its header
+ * zeroed and room for some content inline.  The blob has one reference.
+ *
+ * @param room  Bytes of inline content, including the null character.
+ * @return  The blob, or NULL if its mutex could not be initialized.
+ */
+static BLOB_EXT *blob_alloc(size_t room){
+    // Only the header needs zeroing; any content is about to be filled in.
+    BLOB_EXT *xp = slab_alloc(sizeof(BLOB_EXT) + room);
+    memset(xp, 0, sizeof(BLOB_EXT));
+    if(pthread_mutex_init(&xp->blob.mutex, NULL) < 0) {
+        slab_free(xp, sizeof(BLOB_EXT) + room);
+        return NULL;
+    }
+    xp->blob.refcnt = 1;
+    return xp;
+}
+
+/*
+ * Create a blob with room for content of a given size, which the caller
+ * must fill in before the blob is shared with other threads.  The content
+ * is followed by a null character.  The returned blob has one reference,
+ * which becomes the caller's responsibility.
+ *
+ * @param size  The size in bytes of the content.
+ * @return  The new blob, which has reference count 1.
+ */
+BLOB *blob_reserve(size_t size){
+    BLOB_EXT *xp = blob_alloc(size + 1);
+    if(xp == NULL) return NULL;
+    xp->data[size] = '\0';
+    xp->blob.content = xp->data;
+    xp->blob.prefix = xp->data;
+    xp->blob.size = size;
+    __atomic_fetch_add(&resident_bytes, size + 1, __ATOMIC_RELAXED);
+    return &xp->blob;
+}
+
 /*
  * Create a blob with given content and size.
  * The content is copied, rather than shared with the caller.
@@ -16,29 +94,159 @@
  * @return  The new blob, which has reference count 1.
  */
 BLOB *blob_create(char *content, size_t size){
-    if(size < 0) return NULL;
-    BLOB *blob = Calloc(sizeof(BLOB), size);
-    if(pthread_mutex_init(&blob->mutex, NULL) < 0 || blob == NULL) {
-        Free(blob);
-        return NULL;
-    }
-    blob->refcnt = 1;
-    if(content != NULL){
-        blob->content = Calloc(sizeof(char), size+1);
-        memcpy(blob->content, content, size);
-        blob->prefix = Calloc(sizeof(char), size+1);
-        memcpy(blob->prefix, content, size);
-        blob->size = size;
-    } else {
-        blob->content = NULL;
-        blob->prefix = NULL;
-        blob->size = 0;
-    }
-    return blob;
+    if(content == NULL) return (BLOB *)blob_alloc(0);
+    BLOB *bp = blob_reserve(size);
+    if(bp != NULL) memcpy(bp->content, content, size);
+    return bp;
+}
+
+/*
+ * Create a blob that takes over a buffer rather than copying it.  The
+ * returned blob has one reference, which becomes the caller's
+ * responsibility.
+ *
+ * @param content  A buffer allocated with malloc, holding size bytes of
+ *   content followed by a null character.  It is freed with the blob.
+ * @param size  The size in bytes of the content.
+ * @return  The new blob, which has reference count 1.
+ */
+BLOB *blob_adopt(char *content, size_t size){
+    if(content == NULL) return blob_create(NULL, 0);
+    BLOB_EXT *xp = blob_alloc(0);
+    if(xp == NULL) return NULL;
+    xp->blob.content = content;
+    xp->blob.prefix = content;
+    xp->blob.size = size;
+    xp->flags = BLOB_ADOPTED;
+    __atomic_fetch_add(&resident_bytes, size + 1, __ATOMIC_RELAXED);
+    return &xp->blob;
+}
+
+/*
+ * Create a blob whose content is not copied.  The returned blob has one
+ * reference, which becomes the caller's responsibility.
+ *
+ * @param content  The content of the blob, which must outlive the blob.
+ * @param size  The size in bytes of the content.
+ * @return  The new blob, which has reference count 1.
+ */
+BLOB *blob_create_borrowed(char *content, size_t size){
+    BLOB_EXT *xp = blob_alloc(0);
+    if(xp == NULL) return NULL;
+    xp->blob.content = content;
+    xp->blob.prefix = NULL;
+    xp->blob.size = content != NULL ? size : 0;
+    xp->flags = BLOB_BORROWED;
+    return &xp->blob;
+}
+
+/*
+ * Create a spilled blob.  The returned blob has one reference, which
+ * becomes the caller's responsibility.
+ *
+ * @param size  The size in bytes of the content.
+ * @param offset  Where the content is in the value log.
+ * @param check  The value of hash_bytes(content, size, 0).
+ * @return  The new blob, which has reference count 1.
+ */
+BLOB *blob_create_spilled(size_t size, uint64_t offset, uint64_t check){
+    BLOB_EXT *xp = blob_alloc(0);
+    if(xp == NULL) return NULL;
+    xp->blob.size = size;
+    xp->flags = BLOB_SPILLED;
+    xp->offset = offset;
+    xp->check = check;
+    return &xp->blob;
+}
+
+/*
+ * Find out whether a blob is spilled, and if so where its content is.
+ *
+ * @param bp  The blob.
+ * @param offsetp  Variable into which the offset of the content in the
+ *   value log is stored, or NULL.
+ * @param checkp  Variable into which the hash of the content is stored,
+ *   or NULL.
+ * @return  Nonzero if the blob is spilled.
+ */
+int blob_is_spilled(BLOB *bp, uint64_t *offsetp, uint64_t *checkp){
+    if(bp == NULL) return 0;
+    BLOB_EXT *xp = (BLOB_EXT *)bp;
+    if(!(xp->flags & BLOB_SPILLED)) return 0;
+    if(offsetp != NULL) *offsetp = xp->offset;
+    if(checkp != NULL) *checkp = xp->check;
+    return 1;
+}
+
+/*
+ * Find out whether a blob owns content that is in memory, as opposed to
+ * being spilled or borrowed.
+ *
+ * @param bp  The blob.
+ * @return  Nonzero if the blob owns its content.
+ */
+int blob_is_owned(BLOB *bp){
+    return bp != NULL && bp->content != NULL && !(((BLOB_EXT *)bp)->flags & (BLOB_BORROWED | BLOB_SPILLED));
+}
+
+/*
+ * Get the number of bytes of memory held by the content of all blobs that
+ * own their content.
+ */
+size_t blob_resident_bytes(void){
+    return __atomic_load_n(&resident_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Set the hash that the content of a blob is expected to have.
+ * This must be done before the blob is shared with other threads.
+ *
+ * @param bp  The blob.
+ * @param check  The expected value of hash_bytes(content, size, 0).
+ */
+void blob_expect(BLOB *bp, uint64_t check){
+    if(bp == NULL) return;
+    BLOB_EXT *xp = (BLOB_EXT *)bp;
+    xp->check = check;
+    xp->flags |= BLOB_UNCHECKED;
+}
+
+/*
+ * Record the hash of the content of a blob, computed while the content was
+ * being filled in, so that blob_hash() does not have to read it again.
+ * This must be done before the blob is shared with other threads.
+ *
+ * @param bp  The blob.
+ * @param hash  The value of hash_bytes(content, size, 0).
+ */
+void blob_set_hash(BLOB *bp, uint64_t hash){
+    if(bp == NULL) return;
+    BLOB_EXT *xp = (BLOB_EXT *)bp;
+    xp->check = hash;
+    xp->flags |= BLOB_HASHED;
 }
 
 /*
- * Increase the reference count on a blob.
+ * Check the content of a blob against its expected hash, if it has one
+ * that has not been checked yet.
+ *
+ * @param bp  The blob.
+ * @return  0 if the content is as expected, or there is nothing to check,
+ *   otherwise -1.
+ */
+int blob_check(BLOB *bp){
+    if(bp == NULL) return 0;
+    BLOB_EXT *xp = (BLOB_EXT *)bp;
+    if(!(__atomic_load_n(&xp->flags, __ATOMIC_ACQUIRE) & BLOB_UNCHECKED)) return 0;
+    if(hash_bytes(bp->content, bp->size, 0) != xp->check) return -1;
+    __atomic_fetch_and(&xp->flags, ~BLOB_UNCHECKED, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Increase the reference count on a blob.  The count is changed with an
+ * atomic operation rather than under the blob mutex.  Taking a reference
+ * needs no ordering, since the caller already holds one.
  *
  * @param bp  The blob.
  * @param why  Short phrase explaining the purpose of the increase.
@@ -46,39 +254,49 @@ BLOB *blob_create(char *content, size_t size){
  */
 BLOB *blob_ref(BLOB *bp, char *why){
     if(bp == NULL) return NULL;
-    if(pthread_mutex_lock(&bp->mutex) < 0) return NULL;
-    bp->refcnt += 1;
-    if(pthread_mutex_unlock(&bp->mutex) < 0) return NULL;
+    __atomic_fetch_add(&bp->refcnt, 1, __ATOMIC_RELAXED);
     return bp;
 }
 
+/*
+ * Free a blob whose last reference has been dropped, once no reader in
+ * an epoch read section can still be looking at it.
+ */
+static void blob_free(void *arg){
+    BLOB *bp = arg;
+    BLOB_EXT *xp = (BLOB_EXT *)bp;
+    if(blob_is_owned(bp)) __atomic_fetch_sub(&resident_bytes, bp->size + 1, __ATOMIC_RELAXED);
+    if(xp->flags & BLOB_SPILLED) vlog_release(xp->offset, bp->size);
+    if(xp->flags & BLOB_ADOPTED) Free(bp->content);
+    pthread_mutex_destroy(&bp->mutex);
+    slab_free(xp, sizeof(BLOB_EXT) + (bp->content == xp->data ? bp->size + 1 : 0));
+}
+
 /*
  * Decrease the reference count on a blob.
- * If the reference count reaches zero, the blob is freed.
+ * If the reference count reaches zero, the blob is retired (see epoch.h)
+ * and freed once no reader in a read section can still be using it, so
+ * lock-free readers need no reference of their own.  Each release is
+ * ordered after the holder's use of the blob, and the thread that drops
+ * the last reference synchronizes with all of them before retiring it.
  *
  * @param bp  The blob.
  * @param why  Short phrase explaining the purpose of the decrease.
  */
 void blob_unref(BLOB *bp, char *why){
-    if(bp == NULL || bp->refcnt < 1 || pthread_mutex_lock(&bp->mutex) < 0) return;
-    bp->refcnt -= 1;
-    if(bp->refcnt == 0){
-        if(bp->content != NULL) {
-            Free(bp->content);
-        }
-        if(bp->prefix != NULL){
-            Free(bp->prefix);
-        }
-        pthread_mutex_unlock(&bp->mutex);
-        pthread_mutex_destroy(&bp->mutex);
-        Free(bp);
-    } else {
-        pthread_mutex_unlock(&bp->mutex);
+    if(bp == NULL) return;
+    if(__atomic_sub_fetch(&bp->refcnt, 1, __ATOMIC_RELEASE) == 0){
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        epoch_retire(bp, blob_free);
     }
 }
 
 /*
- * Compare two blobs for equality of their content.
+ * Compare two blobs for equality of their content.  The content of a blob
+ * never changes once it has been created, so no locking is needed.  Blobs
+ * of different sizes differ without their contents being looked at, and
+ * otherwise every byte is compared, null characters included, by memcmp,
+ * which glibc runs with vector instructions.
  *
  * @param bp1  The first blob.
  * @param bp2  The second blob.
@@ -86,16 +304,12 @@ void blob_unref(BLOB *bp, char *why){
  */
 int blob_compare(BLOB *bp1, BLOB *bp2){
     if(bp1 == NULL || bp2 == NULL) return -1;
-    if(pthread_mutex_lock(&bp1->mutex) < 0 || pthread_mutex_lock(&bp2->mutex) < 0) return -1;
-    int max = 0;
-    if(bp1->size > bp2->size) {
-        max = bp1->size;
-    } else {
-        max = bp2->size;
-    }
-    int comp = strncmp(bp1->content, bp2->content, max);
-    if(pthread_mutex_unlock(&bp1->mutex) < 0 || pthread_mutex_unlock(&bp2->mutex) < 0) return -1;
-    return comp;
+    if(bp1 == bp2) return 0;
+    if(bp1->size != bp2->size) return bp1->size < bp2->size ? -1 : 1;
+    if(bp1->size == 0) return 0;
+    // A spilled blob has no content in memory to compare.
+    if(bp1->content == NULL || bp2->content == NULL) return -1;
+    return memcmp(bp1->content, bp2->content, bp1->size);
 }
 
 /*
@@ -106,9 +320,12 @@ int blob_compare(BLOB *bp1, BLOB *bp2){
  */
 int blob_hash(BLOB *bp){
     if(bp == NULL) return -1;
-    int x = 0;
-    if(bp->content != NULL) x = *(bp->content) % NUM_BUCKETS;
-    return x;
+    // The store reduces this to a segment and bucket itself, and compares
+    // hashes before contents, so all 32 bits are kept.
+    if(bp->content == NULL) return 0;
+    BLOB_EXT *xp = (BLOB_EXT *)bp;
+    if(xp->flags & BLOB_HASHED) return (int)hash_fold(xp->check);
+    return (int)hash_fold(hash_bytes(bp->content, bp->size, 0));
 }
 
 /*
@@ -120,13 +337,9 @@ int blob_hash(BLOB *bp){
  */
 KEY *key_create(BLOB *bp){
     if(bp == NULL) return NULL;
-    if(pthread_mutex_lock(&bp->mutex) < 0) return NULL;
-
     KEY *key = Calloc(sizeof(KEY), sizeof(char));
     key->blob = bp;
     key->hash = blob_hash(bp);
-
-    if(pthread_mutex_unlock(&bp->mutex) < 0) return NULL;
     return key;
 }
 
@@ -144,7 +357,8 @@ void key_dispose(KEY *kp){
 }
 
 /*
- * Compare two keys for equality.
+ * Compare two keys for equality.  Keys whose hashes or sizes differ are
+ * told apart without their contents being looked at.
  *
  * @param kp1  The first key.
  * @param kp2  The second key.
@@ -171,7 +385,7 @@ int key_compare(KEY *kp1, KEY *kp2){
  */
 VERSION *version_create(TRANSACTION *tp, BLOB *bp){
     if(tp == NULL) tp = trans_create();
-    VERSION *vp = Calloc(sizeof(char), sizeof(VERSION));
+    VERSION *vp = pool_alloc(&version_pool);
     vp->blob = bp;
     vp->creator = trans_ref(tp, "CREATED VERSION");
     vp->next = NULL;
@@ -179,23 +393,30 @@ VERSION *version_create(TRANSACTION *tp, BLOB *bp){
     return vp;
 }
 
+/*
+ * Free a disposed version, dropping its references to the creator
+ * transaction and the blob.
+ */
+static void version_free(void *arg){
+    VERSION *vp = arg;
+    trans_unref(vp->creator, "dereferencing");
+    blob_unref(vp->blob, "dereferencing");
+    pool_free(&version_pool, vp);
+}
+
 /*
  * Dispose of a version, decreasing the reference count of the
  * creator transaction and contained blob.  A version must be
  * disposed of only once and must not be referred to again once
- * it has been disposed.
+ * it has been disposed.  It is retired (see epoch.h) rather than
+ * freed at once, so a reader in a read section that reached it
+ * before it was unlinked may go on using it, its creator and its
+ * blob.
  *
  * @param vp  The version to be disposed.
  */
 void version_dispose(VERSION *vp){
     if(vp == NULL) return;
-    trans_unref(vp->creator, "dereferencing");
-    vp->creator = NULL;
-    vp->next = NULL;
-    vp->prev = NULL;
-    blob_unref(vp->blob,"dereferencing");
-    vp->blob = NULL;
-    Free(vp);
-    vp = NULL;
+    epoch_retire(vp, version_free);
 }
 
@@ -0,0 +1,249 @@
+#include "epoch.h"
+#include "csapp.h"
+#include "debug.h"
+#include "pool.h"
+
+/*
+ * A thread tries to advance the global epoch and free what it has retired
+ * after every EPOCH_RETIRE_BATCH retirements.
+ */
+#define EPOCH_RETIRE_BATCH 64
+
+typedef struct epoch_retired {
+    void *ptr;
+    void (*fn)(void *);
+    unsigned long epoch;            // Global epoch when the object was retired.
+    struct epoch_retired *next;
+} EPOCH_RETIRED;
+
+/*
+ * Every freed blob and version is retired, so the records come from an
+ * object pool (see pool.h).
+ */
+static POOL retired_pool = POOL_INITIALIZER("retired", sizeof(EPOCH_RETIRED));
+
+/*
+ * Per-thread record.  The state word is zero when the thread is not in a
+ * read section, and otherwise holds the epoch it saw on entry, shifted left
+ * one bit, with the low bit set.  Only the owning thread writes it.
+ */
+typedef struct epoch_thread {
+    unsigned long state;
+    int depth;                      // Nesting depth of read sections.
+    int in_use;                     // Whether a live thread owns the record.
+    EPOCH_RETIRED *retired;         // Objects retired by the thread.
+    int num_retired;                // Retired since the last attempt to free.
+    int reclaiming;                 // Whether the thread is running free functions.
+    struct epoch_thread *next;
+} EPOCH_THREAD;
+
+/*
+ * Records are never freed: when a thread exits its record is left for the
+ * next thread to register.  The list and the orphans are protected by
+ * epoch_mutex, which is also held while advancing the epoch.
+ */
+static unsigned long global_epoch = 1;
+static EPOCH_THREAD *threads = NULL;
+static EPOCH_RETIRED *orphans = NULL;
+static pthread_mutex_t epoch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+static __thread EPOCH_THREAD *self = NULL;
+
+/*
+ * Take the objects in a list that were retired at least two epochs before
+ * the given one out of it, returning them as a list of their own.
+ */
+static EPOCH_RETIRED *epoch_take_before(EPOCH_RETIRED **listp, unsigned long epoch){
+    EPOCH_RETIRED *ready = NULL;
+    EPOCH_RETIRED **rpp = listp;
+    while(*rpp != NULL){
+        EPOCH_RETIRED *rp = *rpp;
+        if(rp->epoch + 2 > epoch){
+            rpp = &rp->next;
+            continue;
+        }
+        *rpp = rp->next;
+        rp->next = ready;
+        ready = rp;
+    }
+    return ready;
+}
+
+/*
+ * Join two lists of retired objects.
+ */
+static EPOCH_RETIRED *epoch_join(EPOCH_RETIRED *list, EPOCH_RETIRED *more){
+    if(list == NULL) return more;
+    EPOCH_RETIRED *rp = list;
+    while(rp->next != NULL) rp = rp->next;
+    rp->next = more;
+    return list;
+}
+
+/*
+ * Call the free functions of a list of objects taken out by
+ * epoch_take_before().  A free function may itself retire objects (a
+ * version retires its blob when it drops the last reference), so no list
+ * is being walked and no lock is held while they run.  Objects retired
+ * meanwhile just join the calling thread's list.
+ *
+ * @return  The number of objects freed.
+ */
+static int epoch_free_list(EPOCH_THREAD *tp, EPOCH_RETIRED *list){
+    int n = 0;
+    tp->reclaiming++;
+    while(list != NULL){
+        EPOCH_RETIRED *rp = list;
+        list = rp->next;
+        rp->fn(rp->ptr);
+        pool_free(&retired_pool, rp);
+        n++;
+    }
+    tp->reclaiming--;
+    return n;
+}
+
+/*
+ * Called when a registered thread exits.  Anything it retired that could
+ * not yet be freed becomes an orphan.
+ */
+static void epoch_thread_exit(void *arg){
+    EPOCH_THREAD *tp = arg;
+    pthread_mutex_lock(&epoch_mutex);
+    EPOCH_RETIRED *rp = tp->retired;
+    while(rp != NULL){
+        EPOCH_RETIRED *next = rp->next;
+        rp->next = orphans;
+        orphans = rp;
+        rp = next;
+    }
+    tp->retired = NULL;
+    tp->num_retired = 0;
+    tp->depth = 0;
+    __atomic_store_n(&tp->state, 0, __ATOMIC_RELEASE);
+    tp->in_use = 0;
+    pthread_mutex_unlock(&epoch_mutex);
+    self = NULL;
+}
+
+static void epoch_make_key(void){
+    pthread_key_create(&epoch_key, epoch_thread_exit);
+}
+
+/*
+ * Record for the calling thread, registering it on first use.
+ */
+static EPOCH_THREAD *epoch_self(void){
+    if(self != NULL) return self;
+    pthread_once(&epoch_once, epoch_make_key);
+    pthread_mutex_lock(&epoch_mutex);
+    EPOCH_THREAD *tp = threads;
+    while(tp != NULL && tp->in_use) tp = tp->next;
+    if(tp == NULL){
+        tp = Calloc(1, sizeof(EPOCH_THREAD));
+        tp->next = threads;
+        threads = tp;
+    }
+    tp->in_use = 1;
+    pthread_mutex_unlock(&epoch_mutex);
+    pthread_setspecific(epoch_key, tp);
+    self = tp;
+    return tp;
+}
+
+/*
+ * Advance the global epoch if every thread in a read section has seen
+ * the current one, and free any orphans that have become old enough.
+ */
+static void epoch_try_advance(void){
+    pthread_mutex_lock(&epoch_mutex);
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    for(EPOCH_THREAD *tp = threads; tp != NULL; tp = tp->next){
+        unsigned long s = __atomic_load_n(&tp->state, __ATOMIC_SEQ_CST);
+        if((s & 1) && (s >> 1) != e){
+            pthread_mutex_unlock(&epoch_mutex);
+            return;
+        }
+    }
+    __atomic_store_n(&global_epoch, e + 1, __ATOMIC_SEQ_CST);
+    EPOCH_RETIRED *ready = epoch_take_before(&orphans, e + 1);
+    pthread_mutex_unlock(&epoch_mutex);
+    epoch_free_list(self, ready);
+}
+
+/*
+ * Enter a read section.  Sections may be nested.
+ */
+void epoch_enter(void){
+    EPOCH_THREAD *tp = epoch_self();
+    if(tp->depth++ > 0) return;
+    // Announce the epoch, then make sure it did not move in the meantime:
+    // otherwise an advance that missed the announcement could be followed
+    // by another that frees what this section is about to read.
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    for(;;){
+        __atomic_store_n(&tp->state, (e << 1) | 1, __ATOMIC_SEQ_CST);
+        unsigned long now = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+        if(now == e) break;
+        e = now;
+    }
+}
+
+/*
+ * Leave a read section.
+ */
+void epoch_exit(void){
+    EPOCH_THREAD *tp = self;
+    if(tp == NULL || tp->depth == 0) return;
+    if(--tp->depth == 0) __atomic_store_n(&tp->state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Arrange for an object to be freed once no read section that was active
+ * when it was unlinked can still be using it.  The object must already be
+ * unreachable for readers that start after this call.
+ *
+ * @param ptr  The object.
+ * @param fn  Function called with ptr to free it.  It may itself retire
+ *   other objects.
+ */
+void epoch_retire(void *ptr, void (*fn)(void *)){
+    EPOCH_THREAD *tp = epoch_self();
+    EPOCH_RETIRED *rp = pool_alloc(&retired_pool);
+    rp->ptr = ptr;
+    rp->fn = fn;
+    rp->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    rp->next = tp->retired;
+    tp->retired = rp;
+    // Retirements made by free functions wait for the next batch.
+    if(++tp->num_retired < EPOCH_RETIRE_BATCH || tp->reclaiming) return;
+    tp->num_retired = 0;
+    epoch_try_advance();
+    epoch_free_list(tp, epoch_take_before(&tp->retired, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST)));
+}
+
+/*
+ * Free every retired object immediately, including any retired by the
+ * free functions themselves.  This may only be called when no
+ * thread is inside a read section, such as when the store is finalized.
+ */
+void epoch_reclaim_all(void){
+    epoch_self();
+    size_t total = 0;
+    int n;
+    // Freeing may retire more objects, so keep going until nothing is left.
+    do {
+        EPOCH_RETIRED *ready = NULL;
+        pthread_mutex_lock(&epoch_mutex);
+        for(EPOCH_THREAD *tp = threads; tp != NULL; tp = tp->next){
+            ready = epoch_join(ready, epoch_take_before(&tp->retired, ~0UL));
+            tp->num_retired = 0;
+        }
+        ready = epoch_join(ready, epoch_take_before(&orphans, ~0UL));
+        pthread_mutex_unlock(&epoch_mutex);
+        n = epoch_free_list(self, ready);
+        total += n;
+    } while(n > 0);
+    debug("All %zu retired objects freed", total);
+}
@@ -0,0 +1,193 @@
+#include <string.h>
+#include "hash.h"
+
+/*
+ * Constants and round structure are those of XXH64, so the results can be
+ * checked against any other XXH64 implementation.
+ */
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+/*
+ * Unaligned little-endian loads.  memcpy compiles to a single load, which
+ * is in native byte order, so big-endian hosts swap the bytes; hashes are
+ * stored in snapshots and the value log, so they must not depend on the
+ * host.
+ */
+static inline uint64_t read64(const unsigned char *p){
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input){
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val){
+    acc ^= round64(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+/*
+ * Run the four lanes over every whole 32-byte stripe from p up to end.
+ *
+ * @return  Where the stripes stopped.
+ */
+static inline const unsigned char *hash_stripes(uint64_t v[4], const unsigned char *p,
+                                                const unsigned char *end){
+    // Four lanes with no dependencies between them, so the CPU can work on
+    // all of them at once.
+    uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+    while(end - p >= 32){
+        v1 = round64(v1, read64(p));
+        v2 = round64(v2, read64(p + 8));
+        v3 = round64(v3, read64(p + 16));
+        v4 = round64(v4, read64(p + 24));
+        p += 32;
+    }
+    v[0] = v1;
+    v[1] = v2;
+    v[2] = v3;
+    v[3] = v4;
+    return p;
+}
+
+static inline uint64_t hash_merge(const uint64_t v[4]){
+    uint64_t h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+    h = merge_round(h, v[0]);
+    h = merge_round(h, v[1]);
+    h = merge_round(h, v[2]);
+    return merge_round(h, v[3]);
+}
+
+static inline void hash_lanes_init(uint64_t v[4], uint64_t seed){
+    v[0] = seed + PRIME1 + PRIME2;
+    v[1] = seed + PRIME2;
+    v[2] = seed;
+    v[3] = seed - PRIME1;
+}
+
+/*
+ * Mix in the last bytes, fewer than 32, and finish the hash.
+ */
+static inline uint64_t hash_finish(uint64_t h, const unsigned char *p, const unsigned char *end){
+    while(p + 8 <= end){
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if(p + 4 <= end){
+        h ^= (uint64_t)read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while(p < end){
+        h ^= (*p) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+        p++;
+    }
+
+    // Final avalanche, so that every input bit affects every output bit.
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*
+ * 64-bit hash of arbitrary data, using the XXH64 algorithm.
+ *
+ * @param data  The data to be hashed.
+ * @param len  The number of bytes of data.
+ * @param seed  Seed for the hash; different seeds give unrelated hashes.
+ * @return  The hash value.
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed){
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if(len >= 32){
+        uint64_t v[4];
+        hash_lanes_init(v, seed);
+        p = hash_stripes(v, p, end);
+        h = hash_merge(v);
+    } else {
+        h = seed + PRIME5;
+    }
+    return hash_finish(h + (uint64_t)len, p, end);
+}
+
+/*
+ * Start hashing data that arrives in pieces.
+ *
+ * @param sp  The state of the hash.
+ * @param seed  Seed for the hash, as for hash_bytes().
+ */
+void hash_init(HASH_STATE *sp, uint64_t seed){
+    hash_lanes_init(sp->lanes, seed);
+    sp->seed = seed;
+    sp->total = 0;
+    sp->buffered = 0;
+}
+
+/*
+ * Hash the next piece of data.
+ *
+ * @param sp  The state of the hash.
+ * @param data  The data.
+ * @param len  The number of bytes of data.
+ */
+void hash_update(HASH_STATE *sp, const void *data, size_t len){
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    sp->total += len;
+    if(sp->buffered > 0){
+        size_t n = 32 - sp->buffered < len ? 32 - sp->buffered : len;
+        memcpy(sp->stripe + sp->buffered, p, n);
+        sp->buffered += n;
+        p += n;
+        if(sp->buffered < 32) return;
+        hash_stripes(sp->lanes, sp->stripe, sp->stripe + 32);
+        sp->buffered = 0;
+    }
+    p = hash_stripes(sp->lanes, p, end);
+    memcpy(sp->stripe, p, end - p);
+    sp->buffered = end - p;
+}
+
+/*
+ * Finish hashing data that arrived in pieces.
+ *
+ * @param sp  The state of the hash.
+ * @return  The hash value, the same as hash_bytes() would give for all the
+ *   pieces put together.
+ */
+uint64_t hash_final(HASH_STATE *sp){
+    uint64_t h = sp->total >= 32 ? hash_merge(sp->lanes) : sp->seed + PRIME5;
+    return hash_finish(h + sp->total, sp->stripe, sp->stripe + sp->buffered);
+}
@@ -0,0 +1,241 @@
+#include "index.h"
+#include "csapp.h"
+#include "debug.h"
+
+#define INDEX_MAX_LEVEL 24
+
+/*
+ * A node in the skiplist.  Each node also stands for the "gap" between
+ * its key and the key of the next node on level 0; scan_id records the
+ * greatest ID of any transaction that has scanned that gap.  The head node
+ * has no key and stands for the gap before the first key.
+ */
+typedef struct index_node {
+    KEY *key;
+    unsigned int scan_id;
+    int level;
+    struct index_node *next[];
+} INDEX_NODE;
+
+/*
+ * The index is split into stripes, each a skiplist of its own with its own
+ * lock, by the same top bits of the hash that pick a segment of the store.
+ * A key lives in one stripe, so inserting or removing it locks only that
+ * stripe, and with as many stripes as segments only scans contend with the
+ * segment that already holds the lock.  A scan visits every stripe in turn.
+ *
+ * Gaps are kept per stripe.  A gap of a stripe covers the gaps between all
+ * keys of the index that fall between its two ends, so marking it may keep
+ * out a few more keys than the scan needed, but never fewer.
+ *
+ * Within a stripe, scans only read the structure of the skiplist, so they
+ * share the lock; they update scan_id fields with atomic operations.
+ * Insertions and removals take the lock exclusively, so they always see a
+ * complete scan of the stripe.
+ */
+typedef struct index_stripe {
+    pthread_rwlock_t lock;
+    INDEX_NODE *head;
+    int level;
+    unsigned int seed;
+} INDEX_STRIPE;
+
+static INDEX_STRIPE stripes[INDEX_STRIPES];
+
+static INDEX_NODE *index_node_create(KEY *kp, int lvl){
+    INDEX_NODE *np = Calloc(1, sizeof(INDEX_NODE) + lvl * sizeof(INDEX_NODE *));
+    np->key = kp;
+    np->level = lvl;
+    return np;
+}
+
+/*
+ * The stripe that holds a key.
+ */
+static INDEX_STRIPE *index_stripe(KEY *kp){
+    return &stripes[(unsigned int)kp->hash >> (32 - INDEX_STRIPE_BITS)];
+}
+
+/*
+ * Random level for a new node, with each level a quarter as likely as the
+ * one below it.  Only called with the lock of the stripe held exclusively.
+ */
+static int index_random_level(INDEX_STRIPE *sp){
+    int lvl = 1;
+    sp->seed ^= sp->seed << 13;
+    sp->seed ^= sp->seed >> 17;
+    sp->seed ^= sp->seed << 5;
+    for(unsigned int r = sp->seed; lvl < INDEX_MAX_LEVEL && (r & 3) == 0; r >>= 2) lvl++;
+    return lvl;
+}
+
+/*
+ * Record that a transaction has scanned the gap after a node.
+ */
+static void index_mark(INDEX_NODE *np, unsigned int id){
+    unsigned int old = __atomic_load_n(&np->scan_id, __ATOMIC_RELAXED);
+    while(old < id && !__atomic_compare_exchange_n(&np->scan_id, &old, id, 0,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * Find the last node of a stripe with key less than the given blob, filling
+ * in the last such node at every level if update is not NULL.
+ */
+static INDEX_NODE *index_find_before(INDEX_STRIPE *sp, BLOB *bp, INDEX_NODE **update){
+    INDEX_NODE *np = sp->head;
+    for(int i = sp->level - 1; i >= 0; i--){
+        while(np->next[i] != NULL && index_compare(np->next[i]->key->blob, bp) < 0)
+            np = np->next[i];
+        if(update != NULL) update[i] = np;
+    }
+    return np;
+}
+
+/*
+ * Compare the content of two blobs in key order.
+ *
+ * @return  Negative, zero, or positive as the first blob orders before,
+ *   equal to, or after the second.
+ */
+int index_compare(BLOB *bp1, BLOB *bp2){
+    size_t n = bp1->size < bp2->size ? bp1->size : bp2->size;
+    int c = n > 0 ? memcmp(bp1->content, bp2->content, n) : 0;
+    if(c != 0) return c;
+    return (bp1->size > bp2->size) - (bp1->size < bp2->size);
+}
+
+/*
+ * Compare two keys, given pointers to them, in key order, for qsort().
+ */
+static int index_compare_keys(const void *a, const void *b){
+    return index_compare((*(KEY **)a)->blob, (*(KEY **)b)->blob);
+}
+
+/*
+ * Initialize the index.
+ */
+void index_init(void){
+    for(int i = 0; i < INDEX_STRIPES; i++){
+        INDEX_STRIPE *sp = &stripes[i];
+        pthread_rwlock_init(&sp->lock, NULL);
+        sp->head = index_node_create(NULL, INDEX_MAX_LEVEL);
+        sp->level = 1;
+        sp->seed = i + 1;
+    }
+}
+
+/*
+ * Finalize the index, freeing its nodes (but not the keys in them).
+ */
+void index_fini(void){
+    for(int i = 0; i < INDEX_STRIPES; i++){
+        INDEX_STRIPE *sp = &stripes[i];
+        INDEX_NODE *np = sp->head;
+        while(np != NULL){
+            INDEX_NODE *next = np->next[0];
+            Free(np);
+            np = next;
+        }
+        sp->head = NULL;
+        pthread_rwlock_destroy(&sp->lock);
+    }
+}
+
+/*
+ * Insert a key into the index on behalf of a transaction.
+ *
+ * @param kp  The key, which must not already be in the index.
+ * @param id  The ID of the transaction creating the key.
+ * @return  0 if the key was inserted, or -1 if the gap the key falls into
+ *   has been scanned by a transaction with a greater ID, in which case the
+ *   key is not inserted.
+ */
+int index_insert(KEY *kp, unsigned int id){
+    INDEX_NODE *update[INDEX_MAX_LEVEL];
+    INDEX_STRIPE *sp = index_stripe(kp);
+    pthread_rwlock_wrlock(&sp->lock);
+    INDEX_NODE *prev = index_find_before(sp, kp->blob, update);
+    if(prev->scan_id > id){
+        pthread_rwlock_unlock(&sp->lock);
+        debug("Key insert by transaction %d falls in gap scanned by %d", id, prev->scan_id);
+        return -1;
+    }
+    int lvl = index_random_level(sp);
+    for(int i = sp->level; i < lvl; i++) update[i] = sp->head;
+    if(lvl > sp->level) sp->level = lvl;
+    INDEX_NODE *np = index_node_create(kp, lvl);
+    // The new node splits the gap it was inserted into, so both halves
+    // have been scanned by whoever scanned the whole gap.
+    np->scan_id = prev->scan_id;
+    for(int i = 0; i < lvl; i++){
+        np->next[i] = update[i]->next[i];
+        update[i]->next[i] = np;
+    }
+    pthread_rwlock_unlock(&sp->lock);
+    return 0;
+}
+
+/*
+ * Remove a key from the index.  The gap before the key and the gap after
+ * it become a single gap, which counts as scanned by whichever transaction
+ * with the greater ID scanned either of them.
+ *
+ * @param kp  The key, which must be in the index.
+ */
+void index_remove(KEY *kp){
+    INDEX_NODE *update[INDEX_MAX_LEVEL];
+    INDEX_STRIPE *sp = index_stripe(kp);
+    pthread_rwlock_wrlock(&sp->lock);
+    INDEX_NODE *prev = index_find_before(sp, kp->blob, update);
+    INDEX_NODE *np = prev->next[0];
+    if(np == NULL || np->key != kp){
+        pthread_rwlock_unlock(&sp->lock);
+        debug("Key to be removed is not in the index");
+        return;
+    }
+    if(np->scan_id > prev->scan_id) prev->scan_id = np->scan_id;
+    for(int i = 0; i < np->level; i++) update[i]->next[i] = np->next[i];
+    while(sp->level > 1 && sp->head->next[sp->level - 1] == NULL) sp->level--;
+    pthread_rwlock_unlock(&sp->lock);
+    Free(np);
+}
+
+/*
+ * Find the keys in a range on behalf of a transaction, and record that the
+ * transaction has scanned that range.
+ *
+ * @param lo  Lowest key in the range, or NULL for no lower bound.
+ * @param hi  Key just past the end of the range, or NULL for no upper bound.
+ * @param id  The ID of the scanning transaction.
+ * @param keysp  Variable into which a pointer to an array of keys is stored.
+ *   The keys are new keys, in order, sharing the blobs of the keys in the
+ *   index.  The caller becomes responsible for the keys and for freeing the
+ *   array.
+ * @return  The number of keys in the array.
+ */
+int index_scan(BLOB *lo, BLOB *hi, unsigned int id, KEY ***keysp){
+    int count = 0, size = 16;
+    KEY **keys = Malloc(size * sizeof(KEY *));
+    for(int i = 0; i < INDEX_STRIPES; i++){
+        INDEX_STRIPE *sp = &stripes[i];
+        pthread_rwlock_rdlock(&sp->lock);
+        INDEX_NODE *np = lo != NULL ? index_find_before(sp, lo, NULL) : sp->head;
+        // The gap before the first key in the range is part of the range.
+        index_mark(np, id);
+        for(np = np->next[0]; np != NULL; np = np->next[0]){
+            if(hi != NULL && index_compare(np->key->blob, hi) >= 0) break;
+            index_mark(np, id);
+            if(count == size){
+                size *= 2;
+                keys = Realloc(keys, size * sizeof(KEY *));
+            }
+            keys[count++] = key_create(blob_ref(np->key->blob, "scanned key"));
+        }
+        pthread_rwlock_unlock(&sp->lock);
+    }
+    // Each stripe gave its keys in order; put them all in order.
+    qsort(keys, count, sizeof(KEY *), index_compare_keys);
+    *keysp = keys;
+    return count;
+}
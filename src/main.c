@@ -6,9 +6,14 @@
 
 #include "debug.h"
 #include "server.h"
+#include "server_ext.h"
 #include "client_registry.h"
 #include "transaction.h"
 #include "store.h"
+#include "store_ext.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "vlog.h"
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
@@ -23,20 +28,59 @@
 static void terminate(int status);
 CLIENT_REGISTRY *client_registry;
 char *input = NULL;
+static char *snapshot_path = NULL;
+static char *wal_path = NULL;
+
+static sem_t checkpoint_sem;
 
 // Function to handle SIGHUP signal
 void sighup_handler(int signo) {
     terminate(EXIT_SUCCESS);
 }
 
+// SIGUSR1 asks for a checkpoint, which is taken by checkpoint_thread.
+void sigusr1_handler(int signo) {
+    sem_post(&checkpoint_sem);
+}
+
+/*
+ * Thread that writes a snapshot each time one is asked for, while the
+ * server goes on serving requests.  It does not take the signals, so that
+ * a shutdown never runs on top of a checkpoint in this thread.
+ */
+static void *checkpoint_thread(void *arg) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    while(1) {
+        while(sem_wait(&checkpoint_sem) < 0 && errno == EINTR);
+        if(snapshot_write(snapshot_path) < 0) fprintf(stderr, "Checkpoint failed\n");
+    }
+    return NULL;
+}
+
 int main(int argc, char* argv[]){
     // Option processing should be performed here.
     // Option '-p <port>' is required in order to specify the port number
-    // on which the server should listen.
+    // on which the server should listen.  Option '-s <file>' names a
+    // snapshot file, which is loaded at startup and written at shutdown.
+    // Option '-w <file>' names a write-ahead log, which makes commits
+    // durable and is replayed at startup.  With '-s', SIGUSR1 writes a
+    // snapshot while the server keeps running.  Option '-m <megabytes>'
+    // caps the memory used for values, spilling cold ones to a scratch file.
+    // Option '-o' selects optimistic concurrency control.  Option
+    // '-r <retries>' sets how many times a BATCH that aborts is run again.
 
     int pflag = 0;
     int qflag = 0;
     int hflag = 0;
+    int sflag = 0;
+    int wflag = 0;
+    int mflag = 0;
+    int oflag = 0;
+    int rflag = 0;
     int portArgcNumber = 0;
 
     //checks arguments
@@ -51,9 +95,29 @@ int main(int argc, char* argv[]){
         if(strcmp(argv[i], "-h") == 0){
             hflag += 1;
         }
+        if(strcmp(argv[i], "-s") == 0 && i + 1 < argc){
+            sflag += 1;
+            snapshot_path = argv[i+1];
+        }
+        if(strcmp(argv[i], "-w") == 0 && i + 1 < argc){
+            wflag += 1;
+            wal_path = argv[i+1];
+        }
+        if(strcmp(argv[i], "-m") == 0 && i + 1 < argc){
+            mflag += 1;
+            store_memory_cap = strtoul(argv[i+1], NULL, 10) << 20;
+        }
+        if(strcmp(argv[i], "-o") == 0){
+            oflag += 1;
+            store_occ = 1;
+        }
+        if(strcmp(argv[i], "-r") == 0 && i + 1 < argc){
+            rflag += 1;
+            server_batch_retries = atoi(argv[i+1]);
+        }
     }
     // if(argc <)
-    if(argc < 3 || pflag != 1 || qflag > 1 || hflag > 1){
+    if(argc < 3 || pflag != 1 || qflag > 1 || hflag > 1 || sflag > 1 || wflag > 1 || mflag > 1 || oflag > 1 || rflag > 1){
         // fprintf(stderr, "no argument");
         exit(EXIT_SUCCESS);
     }
@@ -64,6 +128,11 @@ int main(int argc, char* argv[]){
     client_registry = creg_init();
     trans_init();
     store_init();
+    // A snapshot that cannot be loaded is not overwritten with an empty one.
+    if(snapshot_path != NULL && snapshot_load(snapshot_path) < 0) exit(EXIT_FAILURE);
+    if(wal_path != NULL && wal_open(wal_path) < 0) exit(EXIT_FAILURE);
+    if(store_memory_cap > 0 && vlog_open(NULL) < 0) exit(EXIT_FAILURE);
+    store_gc_start();
 
     // TODO: Set up the server socket and enter a loop to accept connections
     // on this socket.  For each connection, a thread should be started to
@@ -76,6 +145,14 @@ int main(int argc, char* argv[]){
     sa.sa_handler = sighup_handler;
     sa.sa_flags = 0;
     if(sigaction(SIGHUP, &sa, NULL) != 0) exit(EXIT_SUCCESS);
+    if(snapshot_path != NULL){
+        pthread_t checkpointer;
+        sem_init(&checkpoint_sem, 0, 0);
+        sa.sa_handler = sigusr1_handler;
+        sa.sa_flags = SA_RESTART;
+        if(sigaction(SIGUSR1, &sa, NULL) != 0) exit(EXIT_SUCCESS);
+        Pthread_create(&checkpointer, NULL, checkpoint_thread, NULL);
+    }
 
     // Start a server and make some threads
     int server_socket = 0;
@@ -109,6 +186,10 @@ void terminate(int status) {
     debug("Waiting for service threads to terminate...");
     creg_wait_for_empty(client_registry);
     debug("All service threads terminated.");
+    SERVER_BATCH_STATS bs;
+    server_get_batch_stats(&bs);
+    debug("%zu batches, %zu committed, %zu gave up, %.2f retries per commit", bs.batches,
+          bs.commits, bs.failures, bs.commits ? (double)bs.retries / bs.commits : 0.0);
 
     // Finalize modules.
     debug("4");
@@ -116,7 +197,12 @@ void terminate(int status) {
     debug("3");
     trans_fini();
     debug("2");
+    // Once everything in the log is in the snapshot, the log starts over.
+    if(snapshot_path != NULL) snapshot_write(snapshot_path);
+    wal_close();
     store_fini();
+    vlog_close();
+    snapshot_unmap();
     debug("1");
 
     debug("Xacto server terminating");
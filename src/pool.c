@@ -0,0 +1,193 @@
+#include <string.h>
+#include "pool.h"
+#include "csapp.h"
+#include "debug.h"
+
+int pool_caching = 1;
+
+/*
+ * A free object holds the link to the next free object in its cache or
+ * batch.  The first object of a batch in the shared list also holds the
+ * link to the next batch and the number of objects in its own batch.
+ * Objects smaller than this are given slots of this size.
+ */
+typedef struct pool_free {
+    struct pool_free *next;
+    struct pool_free *next_batch;
+    size_t count;
+} POOL_FREE;
+
+typedef struct pool_cache {
+    POOL_FREE *head;
+    int count;
+} POOL_CACHE;
+
+/*
+ * Pools get their slot in the thread caches the first time they are used.
+ * A thread is registered, so that its caches are flushed when it exits,
+ * the first time it uses any pool.
+ */
+static POOL *pools[POOL_MAX];
+static int num_pools = 0;
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+static __thread POOL_CACHE caches[POOL_MAX];
+static __thread int registered = 0;
+
+static size_t pool_slot_size(POOL *pp){
+    size_t size = pp->size > sizeof(POOL_FREE) ? pp->size : sizeof(POOL_FREE);
+    return (size + 15) & ~(size_t)15;
+}
+
+/*
+ * Move the first n objects of a thread cache to the shared list as one batch.
+ */
+static void pool_flush(POOL *pp, POOL_CACHE *cp, int n){
+    POOL_FREE *head = cp->head, *tail = head;
+    for(int i = 1; i < n; i++) tail = tail->next;
+    cp->head = tail->next;
+    cp->count -= n;
+    tail->next = NULL;
+    head->count = n;
+    pthread_mutex_lock(&pp->mutex);
+    head->next_batch = pp->batches;
+    pp->batches = head;
+    pp->free_objects += n;
+    pp->flushes++;
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+/*
+ * Called when a registered thread exits, to give its cached objects back.
+ */
+static void pool_thread_exit(void *arg){
+    int n = __atomic_load_n(&num_pools, __ATOMIC_ACQUIRE);
+    for(int i = 0; i < n; i++){
+        if(caches[i].count > 0) pool_flush(pools[i], &caches[i], caches[i].count);
+    }
+    registered = 0;
+}
+
+static void pool_make_key(void){
+    pthread_key_create(&pool_key, pool_thread_exit);
+}
+
+/*
+ * Get the calling thread's cache for a pool, giving the pool a slot and
+ * registering the thread if need be.
+ *
+ * @return  The cache, or NULL if there are already POOL_MAX pools, in
+ *   which case this pool just uses calloc and free.
+ */
+static POOL_CACHE *pool_cache(POOL *pp){
+    int index = __atomic_load_n(&pp->index, __ATOMIC_ACQUIRE);
+    if(index < 0){
+        pthread_mutex_lock(&pools_mutex);
+        if(pp->index < 0 && num_pools < POOL_MAX){
+            pools[num_pools] = pp;
+            __atomic_store_n(&pp->index, num_pools, __ATOMIC_RELEASE);
+            __atomic_store_n(&num_pools, num_pools + 1, __ATOMIC_RELEASE);
+            debug("Pool %s of %zu-byte objects", pp->name, pp->size);
+        }
+        index = pp->index;
+        pthread_mutex_unlock(&pools_mutex);
+        if(index < 0) return NULL;
+    }
+    if(!registered){
+        pthread_once(&pool_once, pool_make_key);
+        pthread_setspecific(pool_key, caches);
+        registered = 1;
+    }
+    return &caches[index];
+}
+
+/*
+ * Fill an empty thread cache with a batch from the shared list, or with a
+ * new slab if the shared list is empty.
+ */
+static void pool_refill(POOL *pp, POOL_CACHE *cp){
+    pthread_mutex_lock(&pp->mutex);
+    POOL_FREE *head = pp->batches;
+    if(head != NULL){
+        pp->batches = head->next_batch;
+        pp->free_objects -= head->count;
+        pp->refills++;
+        pthread_mutex_unlock(&pp->mutex);
+        cp->head = head;
+        cp->count = head->count;
+        return;
+    }
+    pp->slabs++;
+    pthread_mutex_unlock(&pp->mutex);
+    size_t slot = pool_slot_size(pp);
+    char *slab = Malloc(POOL_SLAB * slot);
+    for(int i = 0; i < POOL_SLAB; i++)
+        ((POOL_FREE *)(slab + i * slot))->next = i + 1 < POOL_SLAB ? (POOL_FREE *)(slab + (i + 1) * slot) : NULL;
+    cp->head = (POOL_FREE *)slab;
+    cp->count = POOL_SLAB;
+}
+
+/*
+ * Allocate an object from a pool.
+ *
+ * @param pp  The pool.
+ * @return  The object, zero-filled.
+ */
+void *pool_alloc(POOL *pp){
+    void *obj = pool_alloc_uninit(pp);
+    memset(obj, 0, pp->size);
+    return obj;
+}
+
+/*
+ * Allocate an object from a pool without zero-filling it, for callers that
+ * are about to fill in all of it.
+ *
+ * @param pp  The pool.
+ * @return  The object.
+ */
+void *pool_alloc_uninit(POOL *pp){
+    POOL_CACHE *cp = pool_caching ? pool_cache(pp) : NULL;
+    if(cp == NULL) return Malloc(pp->size);
+    if(cp->head == NULL) pool_refill(pp, cp);
+    POOL_FREE *fp = cp->head;
+    cp->head = fp->next;
+    cp->count--;
+    return fp;
+}
+
+/*
+ * Return an object to a pool.
+ *
+ * @param pp  The pool it was allocated from.
+ * @param obj  The object, or NULL.
+ */
+void pool_free(POOL *pp, void *obj){
+    if(obj == NULL) return;
+    POOL_CACHE *cp = pool_caching ? pool_cache(pp) : NULL;
+    if(cp == NULL){
+        Free(obj);
+        return;
+    }
+    POOL_FREE *fp = obj;
+    fp->next = cp->head;
+    cp->head = fp;
+    if(++cp->count >= 2 * POOL_BATCH) pool_flush(pp, cp, POOL_BATCH);
+}
+
+/*
+ * Get the counters for a pool.
+ *
+ * @param pp  The pool.
+ * @param sp  Structure into which the counters are stored.
+ */
+void pool_get_stats(POOL *pp, POOL_STATS *sp){
+    pthread_mutex_lock(&pp->mutex);
+    sp->slabs = pp->slabs;
+    sp->objects = pp->slabs * POOL_SLAB;
+    sp->free_objects = pp->free_objects;
+    sp->refills = pp->refills;
+    sp->flushes = pp->flushes;
+    pthread_mutex_unlock(&pp->mutex);
+}
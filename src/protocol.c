@@ -1,12 +1,43 @@
 //works DONE
 
 #include "protocol.h"
+#include "protocol_ext.h"
+#include "data_ext.h"
+#include "hash.h"
 #include "csapp.h"
 #include "debug.h"
+#include <sys/uio.h>
+
+/*
+ * Write all of a vector of buffers, resuming after short writes.
+ *
+ * @return  0 if everything was written, -1 otherwise.
+ */
+static int writev_all(int fd, struct iovec *iov, int count){
+    while(count > 0){
+        ssize_t n = writev(fd, iov, count);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        while(count > 0 && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
 
 /*
  * Send a packet header, followed by an associated data payload, if any.
  * Multi-byte fields in the packet header are stored in network byte oder.
+ * The header and the payload are written together, straight from where
+ * they are, with one system call unless the socket takes only part.
  *
  * @param fd    The file descriptor on which packet is to be sent.
  * 
@@ -30,15 +61,11 @@ int proto_send_packet(int fd, XACTO_PACKET *pkt, void *data){
     pkt->size = htonl(pkt->size);
     
     // Write the return packet
-    if(rio_writen(fd, pkt, sizeof(XACTO_PACKET)) < 0) {
+    struct iovec iov[2] = {{pkt, sizeof(XACTO_PACKET)}, {data, temp}};
+    if(writev_all(fd, iov, temp != 0 ? 2 : 1) < 0) {
         debug("wrong1");
         return -1;
     }
-    if(temp != 0){
-        if((rio_writen(fd, data, temp)) < 0 ){
-            return -1;
-        }
-    }    
     return 0;
 }
 
@@ -59,7 +86,8 @@ int proto_send_packet(int fd, XACTO_PACKET *pkt, void *data){
  *              latter case, errno is set to indicate the error.
  *
  * If the returned payload pointer is non-NULL, then the caller assumes
- * responsibility for freeing the storage.
+ * responsibility for freeing the storage.  The payload is followed by a
+ * null character, so it can become a blob without a copy (see blob_adopt).
  */
 int proto_recv_packet(int fd, XACTO_PACKET *pkt, void **datap){
     // Read the fixed-size header from the server
@@ -70,13 +98,60 @@ int proto_recv_packet(int fd, XACTO_PACKET *pkt, void **datap){
     // If length field of header is nonzero then read the payload from wire
     uint32_t x = htonl(pkt->size);
     if(!pkt->null && datap != NULL && x != 0) {
-        char *temp = Calloc(x, sizeof(char));
+        // Not zeroed: all of it is about to be overwritten.
+        char *temp = Malloc(x + 1);
         if(rio_readn(fd, temp, x) < 1) {
             Free(temp);
             debug("wrong2");
             return -1;
         }
+        temp[x] = '\0';
         *datap = temp;
     }
     return 0;
-}
\ No newline at end of file
+}
+/*
+ * Receive a data packet, blocking until one is available, and read its
+ * payload straight into a new blob (see blob_reserve()).  The returned
+ * structure has its multi-byte fields in network byte order.
+ *
+ * @param fd  The file descriptor from which the packet is to be received.
+ * @param pkt  Pointer to caller-supplied storage for the fixed-size
+ *   portion of the packet.
+ * @param bpp  Variable into which to store the blob, with one reference,
+ *   which becomes the caller's responsibility.  It is NULL for a null
+ *   packet, and an empty blob for one with an empty payload.
+ * @param hash  If nonzero, the payload is hashed piece by piece as it
+ *   arrives, and the hash is kept with the blob (see blob_set_hash()), so
+ *   that a key made from it needs no second pass over the content.
+ * @return  0 in case of successful reception, -1 otherwise.
+ */
+int proto_recv_blob(int fd, XACTO_PACKET *pkt, BLOB **bpp, int hash){
+    *bpp = NULL;
+    if(rio_readn(fd, pkt, sizeof(XACTO_PACKET)) < 1) {
+        debug("wrong1");
+        return -1;
+    }
+    if(pkt->null) return 0;
+    uint32_t x = htonl(pkt->size);
+    BLOB *bp = blob_reserve(x);
+    HASH_STATE hs;
+    if(hash) hash_init(&hs, 0);
+    // Each piece is hashed as soon as it has been read, while it is still
+    // in the cache.
+    size_t done = 0;
+    while(done < x){
+        ssize_t n = read(fd, bp->content + done, x - done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0){
+            blob_unref(bp, "payload not received");
+            debug("wrong2");
+            return -1;
+        }
+        if(hash) hash_update(&hs, bp->content + done, n);
+        done += n;
+    }
+    if(hash) blob_set_hash(bp, hash_final(&hs));
+    *bpp = bp;
+    return 0;
+}
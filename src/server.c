@@ -9,8 +9,13 @@
 #include "transaction.h"
 #include "protocol.h"
 #include "data.h"
+#include "data_ext.h"
 #include "store.h"
+#include "store_ext.h"
+#include "protocol_ext.h"
+#include "server_ext.h"
 #include <stdio.h>
+#include <sched.h>
 
 /*
  * Client registry that should be used to track the set of
@@ -18,247 +23,341 @@
  */
 // extern CLIENT_REGISTRY *client_registry;
 
+/*
+ * Send a data packet carrying the content of a blob, or a null data packet
+ * if the blob is NULL or empty.
+ *
+ * @return  0 if the packet was sent, -1 otherwise.
+ */
+static int send_data_packet(int fd, uint8_t type, uint32_t serial, uint8_t status, BLOB *bp){
+    struct timespec t;
+    XACTO_PACKET pkt = {0};
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    pkt.type = type;
+    pkt.status = status;
+    pkt.serial = serial;
+    pkt.timestamp_sec = t.tv_sec;
+    pkt.timestamp_nsec = t.tv_nsec;
+    if(bp == NULL || bp->size == 0){
+        pkt.null = 1;
+        return proto_send_packet(fd, &pkt, NULL);
+    }
+    pkt.size = bp->size;
+    return proto_send_packet(fd, &pkt, bp->content);
+}
+
+/*
+ * Send a REPLY packet with no data.
+ *
+ * @return  0 if the packet was sent, -1 otherwise.
+ */
+static int send_reply(int fd, uint32_t serial, uint8_t status){
+    struct timespec t;
+    XACTO_PACKET pkt = {0};
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    pkt.type = XACTO_REPLY_PKT;
+    pkt.status = status;
+    pkt.serial = serial;
+    pkt.timestamp_sec = t.tv_sec;
+    pkt.timestamp_nsec = t.tv_nsec;
+    return proto_send_packet(fd, &pkt, NULL);
+}
+
+/*
+ * State passed to send_scan_mapping while answering a SCAN request.
+ */
+typedef struct scan_arg {
+    int fd;            // Client connection.
+    uint32_t serial;   // Serial # of the SCAN request.
+    int failed;        // Set if sending to the client failed.
+} SCAN_ARG;
+
+/*
+ * Callback for store_scan: send one mapping to the client as a KEY packet
+ * followed by a VALUE packet.
+ */
+static int send_scan_mapping(BLOB *key, BLOB *value, void *arg){
+    SCAN_ARG *sa = arg;
+    if(send_data_packet(sa->fd, XACTO_KEY_PKT, sa->serial, TRANS_PENDING, key) != 0 ||
+       send_data_packet(sa->fd, XACTO_VALUE_PKT, sa->serial, TRANS_PENDING, value) != 0){
+        sa->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+int server_batch_retries = SERVER_BATCH_RETRIES;
+
+static size_t batch_count = 0;
+static size_t batch_commits = 0;
+static size_t batch_failures = 0;
+static size_t batch_retries = 0;
+
+/*
+ * One operation of a batch.
+ */
+typedef struct batch_op {
+    uint8_t type;      // XACTO_PUT_PKT or XACTO_GET_PKT.
+    BLOB *key;
+    BLOB *value;       // Value to put, or value got by the last try.
+} BATCH_OP;
+
+/*
+ * Receive a data packet and make a blob of its payload, which is read
+ * straight into the blob.  Keys are hashed as they arrive.
+ *
+ * @param hash  Nonzero if the payload is a key.
+ * @return  0 if successful, otherwise -1.  *bpp is NULL for a null packet,
+ *   and an empty blob for one with an empty payload.
+ */
+static int recv_data_blob(int fd, BLOB **bpp, int hash){
+    XACTO_PACKET pkt = {0};
+    return proto_recv_blob(fd, &pkt, bpp, hash);
+}
+
+/*
+ * Receive the operations of a batch, up to and including its COMMIT.
+ *
+ * @return  The number of operations, or -1 if the connection failed or
+ *   something other than PUT, GET or COMMIT was sent.
+ */
+static int recv_batch(int fd, BATCH_OP **opsp){
+    int count = 0, size = 8;
+    BATCH_OP *ops = Malloc(size * sizeof(BATCH_OP));
+    for(;;){
+        XACTO_PACKET pkt = {0};
+        if(proto_recv_packet(fd, &pkt, NULL) != 0) break;
+        if(pkt.type == XACTO_COMMIT_PKT){
+            *opsp = ops;
+            return count;
+        }
+        if(pkt.type != XACTO_PUT_PKT && pkt.type != XACTO_GET_PKT) break;
+        if(count == size){
+            size *= 2;
+            ops = Realloc(ops, size * sizeof(BATCH_OP));
+        }
+        BATCH_OP *op = &ops[count];
+        op->type = pkt.type;
+        op->value = NULL;
+        if(recv_data_blob(fd, &op->key, 1) != 0 || op->key == NULL) break;
+        count++;
+        if(pkt.type == XACTO_PUT_PKT && recv_data_blob(fd, &op->value, 0) != 0) break;
+    }
+    for(int i = 0; i < count; i++){
+        blob_unref(ops[i].key, "batch failed");
+        blob_unref(ops[i].value, "batch failed");
+    }
+    Free(ops);
+    return -1;
+}
+
+/*
+ * Run the operations of a batch in a new transaction and try to commit it.
+ * The values got by GETs replace whatever the ops held from an earlier try.
+ *
+ * @return  The final status of the transaction.
+ */
+static TRANS_STATUS run_batch(BATCH_OP *ops, int count){
+    TRANSACTION *tp = trans_create();
+    for(int i = 0; i < count; i++){
+        BATCH_OP *op = &ops[i];
+        TRANS_STATUS status;
+        KEY *key = key_create(blob_ref(op->key, "batch key"));
+        if(op->type == XACTO_PUT_PKT){
+            status = store_put(tp, key, blob_ref(op->value, "batch value"));
+        } else {
+            blob_unref(op->value, "earlier try");
+            op->value = NULL;
+            status = store_get(tp, key, &op->value);
+        }
+        if(status == TRANS_ABORTED) return trans_abort(tp);
+    }
+    return trans_commit(tp);
+}
+
+/*
+ * Serve a BATCH request: receive the whole transaction, run it until it
+ * commits or the retry budget is spent, and send the final outcome.
+ *
+ * @param fd  Client connection.
+ * @param serial  Serial # of the BATCH request.
+ * @return  0 if successful, -1 if the connection failed.
+ */
+static int serve_batch(int fd, uint32_t serial){
+    BATCH_OP *ops = NULL;
+    int count = recv_batch(fd, &ops);
+    if(count < 0) return -1;
+    __atomic_fetch_add(&batch_count, 1, __ATOMIC_RELAXED);
+    TRANS_STATUS status = run_batch(ops, count);
+    for(int tries = 0; status == TRANS_ABORTED && tries < server_batch_retries; tries++){
+        __atomic_fetch_add(&batch_retries, 1, __ATOMIC_RELAXED);
+        sched_yield();
+        status = run_batch(ops, count);
+    }
+    __atomic_fetch_add(status == TRANS_COMMITTED ? &batch_commits : &batch_failures, 1, __ATOMIC_RELAXED);
+
+    int ret = send_reply(fd, serial, status);
+    for(int i = 0; i < count; i++){
+        if(ret == 0 && status == TRANS_COMMITTED && ops[i].type == XACTO_GET_PKT &&
+           send_data_packet(fd, XACTO_VALUE_PKT, serial, status, ops[i].value) != 0)
+            ret = -1;
+        blob_unref(ops[i].key, "batch done");
+        blob_unref(ops[i].value, "batch done");
+    }
+    Free(ops);
+    return ret;
+}
+
+/*
+ * Get the counters for batches.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void server_get_batch_stats(SERVER_BATCH_STATS *sp){
+    sp->batches = __atomic_load_n(&batch_count, __ATOMIC_RELAXED);
+    sp->commits = __atomic_load_n(&batch_commits, __ATOMIC_RELAXED);
+    sp->failures = __atomic_load_n(&batch_failures, __ATOMIC_RELAXED);
+    sp->retries = __atomic_load_n(&batch_retries, __ATOMIC_RELAXED);
+}
+
 /*
  * Thread function for the thread that handles client requests.
  *
+ * A connection carries any number of transactions, one after another.
+ * The current transaction ends when it commits or aborts, and the next
+ * request starts a new one.
+ *
  * @param  Pointer to a variable that holds the file descriptor for
  * the client connection.  This pointer must be freed once the file
  * descriptor has been retrieved.
  */
 void *xacto_client_service(void *arg){
-    struct timespec t;
     int fdNum = *(int*)arg;
     free(arg);
 
     //makes sure the file detaches after
     if(pthread_detach(pthread_self()) != 0) debug("error");
     creg_register(client_registry, fdNum);
-    TRANSACTION *newTrans = trans_create();
+    // Created when a request needs it, so that a client that disconnects
+    // between transactions leaves nothing to abort.
+    TRANSACTION *newTrans = NULL;
     int end = 1;
     while(end){
         XACTO_PACKET *packet = Calloc(sizeof(XACTO_PACKET), sizeof(char));
         if(proto_recv_packet(fdNum, packet, NULL) == -1){
-            debug("hello1");
-            trans_abort(newTrans);
-            debug("transaborted");
-            end = 0;
-        } else {
-            switch(packet->type){
-                case XACTO_GET_PKT:
-                    debug("GET packet Recieved");
-                    void **key11 = Calloc(sizeof(char), sizeof(void**));
-                    XACTO_PACKET *packet11 = Calloc(sizeof(XACTO_PACKET), sizeof(char)); 
-                    if(proto_recv_packet(fdNum, packet11, key11) != 0){
-                        debug("hello6");
-                        trans_abort(newTrans);
-                        Free(packet);
-                        Free(packet11);
-                        Free(key11);
-                        end = 0;
-                        break;
-                    }
-                    debug("Recieved key, size %d", ntohl(packet11->size));
-                    BLOB *blob11 = blob_create(*key11, ntohl(packet11->size));
-                    KEY *key21 = key_create(blob11);
-                    debug("temp");
-                    if(store_get(newTrans, key21, &blob11) == TRANS_ABORTED){
-                        debug("hello7");
-                        trans_abort(newTrans);
-                        Free(key11);
-                        Free(packet11);
-                        if(blob11 != NULL) Free(blob11->content);
-                        Free(blob11);
-                        Free(packet);
-                        Free(key21);
-                        end = 0;
-                        break;
-                    }
-                    clock_gettime(CLOCK_MONOTONIC, &t);
-                    packet->timestamp_sec = t.tv_sec;
-                    packet->timestamp_nsec = t.tv_nsec;
-                    packet->type = XACTO_REPLY_PKT;
-                    packet->status = trans_get_status(newTrans);
-                    packet->null = 0;
-                    packet->size = 0;
-                    
-                    debug("2");
-                    //sending reply
-                    if(proto_send_packet(fdNum, packet, NULL) != 0){
-                        debug("hello8");
-                        trans_abort(newTrans);
-                        Free(key11);
-                        Free(packet11);
-                        if(blob11 != NULL) Free(blob11->content);
-                        Free(blob11);
-                        Free(packet);
-                        Free(key21);
-                        end = 0;
-                        break;
-                    }
-
-                    clock_gettime(CLOCK_MONOTONIC, &t);
-                    packet->timestamp_sec = t.tv_sec;
-                    packet->timestamp_nsec = t.tv_nsec;
-                    packet->status = trans_get_status(newTrans);
-                    packet->type = XACTO_VALUE_PKT;
-                    
-                    if(blob11 == NULL){
-                        packet->null = 1;
-                        packet->size = 0;
-                        if(proto_send_packet(fdNum, packet, blob11) != 0){
-                            debug("hello9");
-                            trans_abort(newTrans);
-                            Free(key11);
-                            Free(packet11);
-                            Free(packet);
-                            Free(key21);
-                            end = 0;
-                            break;
-                        }
-                    } else {
-                        if(blob11->size == 0){
-                            debug("2");
-                            packet->null = 1;
-                            packet->size = 0;
-                            if(proto_send_packet(fdNum, packet, blob11) != 0){
-                                debug("hello9");
-                                trans_abort(newTrans);
-                                Free(key11);
-                                Free(packet11);
-                                if(blob11 != NULL) Free(blob11->content);
-                                Free(blob11);
-                                Free(packet);
-                                Free(key21);
-                                end = 0;
-                                break;
-                            }
-                            debug("3");
-                        } else {
-                            debug("4");
-                            packet->null = 0;
-                            packet->size = blob11->size;
-                            if(proto_send_packet(fdNum, packet, blob11->content) != 0){
-                                debug("hello9");
-                                trans_abort(newTrans);
-                                Free(key11);
-                                Free(packet11);
-                                if(blob11 != NULL) Free(blob11->content);
-                                Free(blob11);
-                                Free(packet);
-                                Free(key21);
-                                end = 0;
-                                break;
-                            }
-                            debug("5");
-                        }
-                    }
-                    debug("reached end of get");
+            debug("connection closed");
+            Free(packet);
+            break;
+        }
+        uint32_t serial = packet->serial;
+        if(newTrans == NULL && packet->type != XACTO_BATCH_PKT) newTrans = trans_create();
+        switch(packet->type){
+            case XACTO_GET_PKT: {
+                debug("GET packet Recieved");
+                // The store consumes the key but not our reference to the
+                // transaction.  An aborted GET still gets its VALUE packet,
+                // a null one, so that every GET reply has the same shape.
+                BLOB *kb = NULL, *value = NULL;
+                if(recv_data_blob(fdNum, &kb, 1) != 0){
+                    end = 0;
                     break;
-                case XACTO_COMMIT_PKT:
-                    if(trans_get_status(newTrans) == TRANS_ABORTED){
-                        trans_abort(newTrans);
-                        Free(packet);
-                        break;
-                    }
-
-                    //reply is always NULL
-                    packet->type = XACTO_REPLY_PKT;
-                    packet->status = XACTO_PUT_PKT;
-                    clock_gettime(CLOCK_MONOTONIC, &t);
-                    packet->timestamp_sec = t.tv_sec;
-                    packet->timestamp_nsec = t.tv_nsec;
-                    packet->size = 0;
-                    packet->null = 0;
-
-                    if(proto_send_packet(fdNum, packet, NULL) != 0){
-                        trans_abort(newTrans);
-                        Free(packet);
-                        break;
-                    }
+                }
+                TRANS_STATUS status = store_get(newTrans, key_create(kb), &value);
+                if(send_reply(fdNum, serial, status) != 0 ||
+                   send_data_packet(fdNum, XACTO_VALUE_PKT, serial, status, value) != 0){
+                    debug("GET reply not sent");
+                    end = 0;
+                }
+                blob_unref(value, "sent to client");
+                if(status == TRANS_ABORTED){
+                    trans_abort(newTrans);
+                    newTrans = NULL;
+                }
+                break;
+            }
+            case XACTO_COMMIT_PKT:
+                //reply is always NULL, with the final status of the
+                //transaction.  trans_commit consumes our reference
+                //whether or not it commits.
+                if(send_reply(fdNum, serial, trans_commit(newTrans)) != 0){
+                    debug("commit reply not sent");
+                    end = 0;
+                }
+                newTrans = NULL;
+                break;
+            case XACTO_PUT_PKT: {
+                BLOB *kb = NULL, *value = NULL;
+                if(recv_data_blob(fdNum, &kb, 1) != 0 || recv_data_blob(fdNum, &value, 0) != 0){
+                    blob_unref(kb, "PUT not received");
+                    blob_unref(value, "PUT not received");
                     end = 0;
                     break;
-                case XACTO_PUT_PKT:
-                    void **key1 = Calloc(sizeof(void**), sizeof(char)); 
-                    XACTO_PACKET *packet1 = Calloc(sizeof(XACTO_PACKET), sizeof(char)); 
-                    int x = 0;
-                    if(proto_recv_packet(fdNum, packet1, key1) != 0){
-                        debug("hello2");
-                        trans_abort(newTrans);
-                        Free(key1);
-                        Free(packet1);
-                        Free(packet);
-                        x = 1;
-                        end = 0;
-                        break;
-                    }
-
-                    void **key2 = Calloc(sizeof(void**), sizeof(char));
-                    XACTO_PACKET *packet2 = Calloc(sizeof(XACTO_PACKET), sizeof(char));
-                    if(proto_recv_packet(fdNum, packet2, key2) != 0){
-                        debug("hello3");
-                        trans_abort(newTrans);
-                        Free(key1);
-                        Free(packet1);
-                        Free(key2);
-                        Free(packet2);
-                        Free(packet);
-                        end = 0;
-                        break;
+                }
+                //reply is always NULL
+                TRANS_STATUS status = store_put(newTrans, key_create(kb), value);
+                if(send_reply(fdNum, serial, status) != 0){
+                    debug("PUT reply not sent");
+                    end = 0;
+                }
+                if(status == TRANS_ABORTED){
+                    trans_abort(newTrans);
+                    newTrans = NULL;
+                }
+                break;
+            }
+            case XACTO_SCAN_PKT: {
+                debug("SCAN packet Recieved");
+                // The two bounds of the range follow as KEY packets.
+                BLOB *range[2] = {NULL, NULL};
+                XACTO_PACKET *bpacket = Calloc(sizeof(XACTO_PACKET), sizeof(char));
+                SCAN_ARG sa = {fdNum, serial, 0};
+                for(int i = 0; i < 2 && !sa.failed; i++){
+                    void *bound = NULL;
+                    if(proto_recv_packet(fdNum, bpacket, &bound) != 0){
+                        sa.failed = 1;
+                    } else if(bound != NULL){
+                        range[i] = blob_adopt(bound, ntohl(bpacket->size));
                     }
-                    if(x == 0){
-                        BLOB *p1 = blob_create(*key1, htonl(packet1->size));
-                        KEY *key3 = key_create(p1);
-                        BLOB *p2 = blob_create(*key2, htonl(packet2->size));
-
-                        if(store_put(newTrans, key3, p2) == TRANS_ABORTED){
-                            debug("hello4");
-                            trans_abort(newTrans);
-                            Free(key1);
-                            Free(packet1);
-                            Free(key2);
-                            Free(packet2);
-                            Free(packet);
-                            if(key1 != NULL) Free(p1->content);
-                            Free(p1);
-                            if(key2 != NULL) Free(p2->content);
-                            Free(p2);
-                            end = 0;
-                            break;
-                        } else {
-                            //reply is always NULL
-                            packet->type = XACTO_REPLY_PKT;
-                            packet->status = trans_get_status(newTrans);
-                            struct timespec t;
-                            clock_gettime(CLOCK_MONOTONIC, &t);
-                            packet->timestamp_sec = t.tv_sec;
-                            packet->timestamp_nsec = t.tv_nsec;
-                            packet->serial = packet->serial;
-                            packet->size = 0;
-                            packet->null = 0;
+                }
+                Free(bpacket);
 
-                            if(proto_send_packet(fdNum, packet, NULL) != 0){
-                                debug("hello5");
-                                trans_abort(newTrans);
-                                Free(key1);
-                                Free(packet1);
-                                Free(key2);
-                                Free(packet);
-                                Free(packet2);
-                                if(key1 != NULL) Free(p1->content);
-                                Free(p1);
-                                if(key2 != NULL) Free(p2->content);
-                                Free(p2);
-                                end = 0;
-                                break;
-                            }
-                        }
-                    }
-                    break;
-                default: 
-                    break;
+                if(!sa.failed && send_reply(fdNum, serial, trans_get_status(newTrans)) != 0)
+                    sa.failed = 1;
+                TRANS_STATUS status = TRANS_ABORTED;
+                if(!sa.failed){
+                    status = store_scan(newTrans, range[0], range[1], send_scan_mapping, &sa);
+                    if(!sa.failed &&
+                       send_data_packet(fdNum, XACTO_KEY_PKT, serial, status, NULL) != 0)
+                        sa.failed = 1;
+                }
+                blob_unref(range[0], "scan done");
+                blob_unref(range[1], "scan done");
+                if(sa.failed){
+                    debug("scan failed");
+                    end = 0;
+                } else if(status == TRANS_ABORTED){
+                    // The client learns of it from the final KEY packet.
+                    trans_abort(newTrans);
+                    newTrans = NULL;
+                }
+                break;
             }
+            case XACTO_BATCH_PKT:
+                // A batch is a transaction of its own, so it may only come
+                // between transactions.
+                debug("BATCH packet Recieved");
+                if(newTrans != NULL || serve_batch(fdNum, serial) != 0){
+                    debug("batch failed");
+                    end = 0;
+                }
+                break;
+            default: 
+                break;
         }
-        if(end == 0) Free(packet);
+        Free(packet);
     }
+    if(newTrans != NULL) trans_abort(newTrans);
+    creg_unregister(client_registry, fdNum);
+    close(fdNum);
     return NULL;
-} 
\ No newline at end of file
+}
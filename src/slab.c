@@ -0,0 +1,165 @@
+#include "slab.h"
+#include "pool.h"
+#include "csapp.h"
+#include "debug.h"
+
+/*
+ * One pool per size class, in order of size.
+ */
+static POOL classes[SLAB_CLASSES] = {
+    POOL_INITIALIZER("slab 96", 96),     POOL_INITIALIZER("slab 128", 128),
+    POOL_INITIALIZER("slab 160", 160),   POOL_INITIALIZER("slab 192", 192),
+    POOL_INITIALIZER("slab 224", 224),   POOL_INITIALIZER("slab 256", 256),
+    POOL_INITIALIZER("slab 320", 320),   POOL_INITIALIZER("slab 384", 384),
+    POOL_INITIALIZER("slab 448", 448),   POOL_INITIALIZER("slab 512", 512),
+    POOL_INITIALIZER("slab 640", 640),   POOL_INITIALIZER("slab 768", 768),
+    POOL_INITIALIZER("slab 896", 896),   POOL_INITIALIZER("slab 1024", 1024),
+    POOL_INITIALIZER("slab 1280", 1280), POOL_INITIALIZER("slab 1536", 1536),
+    POOL_INITIALIZER("slab 1792", 1792), POOL_INITIALIZER("slab 2048", 2048),
+    POOL_INITIALIZER("slab 2560", 2560), POOL_INITIALIZER("slab 3072", 3072),
+    POOL_INITIALIZER("slab 3584", 3584), POOL_INITIALIZER("slab 4096", 4096),
+    POOL_INITIALIZER("slab 5120", 5120), POOL_INITIALIZER("slab 6144", 6144),
+    POOL_INITIALIZER("slab 7168", 7168), POOL_INITIALIZER("slab 8192", 8192),
+};
+
+/*
+ * The counters are kept per thread, so that allocating and freeing touch no
+ * shared cache line.  Only slab_get_stats() adds them up, over the threads
+ * still running and the totals left by those that have exited.  A thread
+ * may free what another allocated, so one thread's counts can wrap below
+ * zero; the sum is still right.
+ */
+typedef struct slab_counters {
+    size_t in_use;
+    size_t requested;
+    size_t large;
+    struct slab_counters *next;     // Next running thread.
+    struct slab_counters *prev;
+} SLAB_COUNTERS;
+
+static __thread SLAB_COUNTERS counters;
+static __thread int registered = 0;
+static SLAB_COUNTERS threads = { 0, 0, 0, &threads, &threads };
+static SLAB_COUNTERS exited;
+static pthread_mutex_t counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t counters_once = PTHREAD_ONCE_INIT;
+static pthread_key_t counters_key;
+
+/*
+ * Called when a registered thread exits, to move its counts to the totals.
+ */
+static void slab_thread_exit(void *arg){
+    SLAB_COUNTERS *cp = arg;
+    pthread_mutex_lock(&counters_mutex);
+    exited.in_use += cp->in_use;
+    exited.requested += cp->requested;
+    exited.large += cp->large;
+    cp->prev->next = cp->next;
+    cp->next->prev = cp->prev;
+    pthread_mutex_unlock(&counters_mutex);
+    registered = 0;
+}
+
+static void slab_make_key(void){
+    pthread_key_create(&counters_key, slab_thread_exit);
+}
+
+/*
+ * Get the calling thread's counters, registering the thread if need be.
+ */
+static SLAB_COUNTERS *slab_counters(void){
+    if(!registered){
+        pthread_once(&counters_once, slab_make_key);
+        counters = (SLAB_COUNTERS){ 0 };
+        pthread_mutex_lock(&counters_mutex);
+        counters.next = threads.next;
+        counters.prev = &threads;
+        threads.next->prev = &counters;
+        threads.next = &counters;
+        pthread_mutex_unlock(&counters_mutex);
+        pthread_setspecific(counters_key, &counters);
+        registered = 1;
+    }
+    return &counters;
+}
+
+/*
+ * Add to one of the calling thread's counters.  Only this thread writes
+ * it, so there is no read-modify-write, just a store others may read.
+ */
+static void slab_count(size_t *cp, size_t n){
+    __atomic_store_n(cp, *cp + n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Find the size class for a size of at most SLAB_MAX bytes.
+ */
+static int slab_class(size_t size){
+    if(size <= 96) return 0;
+    if(size <= 256) return (size - 96 + 31) / 32;
+    // Above 256 bytes, the classes between 2^p and 2^(p+1) are 2^(p-2) apart.
+    int p = 63 - __builtin_clzl(size - 1);
+    return 6 + (p - 8) * 4 + ((size - 1 - ((size_t)1 << p)) >> (p - 2));
+}
+
+/*
+ * Allocate memory, which is not zero-filled.
+ *
+ * @param size  The number of bytes needed.
+ * @return  The memory.
+ */
+void *slab_alloc(size_t size){
+    SLAB_COUNTERS *cp = slab_counters();
+    if(size > SLAB_MAX){
+        slab_count(&cp->large, size);
+        return Malloc(size);
+    }
+    POOL *pp = &classes[slab_class(size)];
+    slab_count(&cp->in_use, pp->size);
+    slab_count(&cp->requested, size);
+    return pool_alloc_uninit(pp);
+}
+
+/*
+ * Free memory allocated by slab_alloc().
+ *
+ * @param ptr  The memory, or NULL.
+ * @param size  The size that was given to slab_alloc().
+ */
+void slab_free(void *ptr, size_t size){
+    if(ptr == NULL) return;
+    SLAB_COUNTERS *cp = slab_counters();
+    if(size > SLAB_MAX){
+        slab_count(&cp->large, -size);
+        Free(ptr);
+        return;
+    }
+    POOL *pp = &classes[slab_class(size)];
+    slab_count(&cp->in_use, -pp->size);
+    slab_count(&cp->requested, -size);
+    pool_free(pp, ptr);
+}
+
+/*
+ * Get the counters for the slab allocator.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void slab_get_stats(SLAB_STATS *sp){
+    sp->reserved = 0;
+    for(int i = 0; i < SLAB_CLASSES; i++){
+        POOL_STATS ps;
+        pool_get_stats(&classes[i], &ps);
+        sp->reserved += ps.objects * classes[i].size;
+    }
+    pthread_mutex_lock(&counters_mutex);
+    sp->in_use = exited.in_use;
+    sp->requested = exited.requested;
+    sp->large = exited.large;
+    for(SLAB_COUNTERS *cp = threads.next; cp != &threads; cp = cp->next){
+        sp->in_use += __atomic_load_n(&cp->in_use, __ATOMIC_RELAXED);
+        sp->requested += __atomic_load_n(&cp->requested, __ATOMIC_RELAXED);
+        sp->large += __atomic_load_n(&cp->large, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&counters_mutex);
+}
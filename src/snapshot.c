@@ -0,0 +1,295 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include "snapshot.h"
+#include "data_ext.h"
+#include "store_ext.h"
+#include "transaction_ext.h"
+#include "wal.h"
+#include "vlog.h"
+#include "index.h"
+#include "hash.h"
+#include "csapp.h"
+#include "debug.h"
+
+typedef struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;       // sizeof(SNAPSHOT_HEADER), as written.
+    uint64_t num_records;
+    uint64_t records_offset;    // Offset of the record section in the file.
+    uint64_t records_size;
+    uint64_t values_offset;     // Offset of the value section in the file.
+    uint64_t values_size;
+    uint64_t records_check;     // Hash of the record section.
+    uint64_t header_check;      // Hash of the header, with this field zero.
+} SNAPSHOT_HEADER;
+
+typedef struct snapshot_record {
+    uint32_t key_size;
+    uint32_t reserved;
+    uint64_t value_offset;      // Offset of the value in the value section.
+    uint64_t value_size;
+    uint64_t value_check;       // Hash of the value.
+    char key[];                 // Padded to a multiple of 8 bytes.
+} SNAPSHOT_RECORD;
+
+#define SNAPSHOT_PAD(n) (((n) + 7) & ~(uint64_t)7)
+
+/*
+ * The mapping of the loaded snapshot, if any.
+ */
+static char *map_base = NULL;
+static size_t map_size = 0;
+
+/*
+ * Only one snapshot is written at a time.
+ */
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Mappings collected from the store while writing a snapshot.
+ */
+typedef struct snapshot_item {
+    BLOB *key;
+    BLOB *value;
+} SNAPSHOT_ITEM;
+
+typedef struct snapshot_list {
+    SNAPSHOT_ITEM *items;
+    size_t count;
+    size_t size;
+} SNAPSHOT_LIST;
+
+static void snapshot_collect(BLOB *key, BLOB *value, void *arg){
+    SNAPSHOT_LIST *lp = arg;
+    if(lp->count == lp->size){
+        lp->size = lp->size ? 2 * lp->size : 1024;
+        lp->items = Realloc(lp->items, lp->size * sizeof(SNAPSHOT_ITEM));
+    }
+    lp->items[lp->count].key = blob_ref(key, "collected for snapshot");
+    lp->items[lp->count].value = blob_ref(value, "collected for snapshot");
+    lp->count++;
+}
+
+static int snapshot_item_compare(const void *a, const void *b){
+    return index_compare(((SNAPSHOT_ITEM *)a)->key, ((SNAPSHOT_ITEM *)b)->key);
+}
+
+static uint64_t snapshot_header_check(SNAPSHOT_HEADER *hp){
+    SNAPSHOT_HEADER h = *hp;
+    h.header_check = 0;
+    return hash_bytes(&h, sizeof(h), 0);
+}
+
+/*
+ * Write the collected mappings to a file in snapshot format.
+ *
+ * @return  0 if successful, otherwise -1.
+ */
+static int snapshot_write_file(FILE *f, SNAPSHOT_LIST *lp){
+    uint64_t records_size = 0, values_size = 0;
+    for(size_t i = 0; i < lp->count; i++){
+        records_size += sizeof(SNAPSHOT_RECORD) + SNAPSHOT_PAD(lp->items[i].key->size);
+        values_size += lp->items[i].value->size;
+    }
+    char *records = Calloc(1, records_size ? records_size : 1);
+    char *rp = records;
+    uint64_t offset = 0;
+    for(size_t i = 0; i < lp->count; i++){
+        BLOB *kb = lp->items[i].key, *vb = lp->items[i].value;
+        SNAPSHOT_RECORD *rec = (SNAPSHOT_RECORD *)rp;
+        rec->key_size = kb->size;
+        rec->value_offset = offset;
+        rec->value_size = vb->size;
+        // A spilled value carries the hash of its content.
+        if(!blob_is_spilled(vb, NULL, &rec->value_check))
+            rec->value_check = hash_bytes(vb->content, vb->size, 0);
+        if(kb->size > 0) memcpy(rec->key, kb->content, kb->size);
+        rp += sizeof(SNAPSHOT_RECORD) + SNAPSHOT_PAD(kb->size);
+        offset += vb->size;
+    }
+
+    SNAPSHOT_HEADER h = {0};
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.header_size = sizeof(SNAPSHOT_HEADER);
+    h.num_records = lp->count;
+    h.records_offset = sizeof(SNAPSHOT_HEADER);
+    h.records_size = records_size;
+    h.values_offset = h.records_offset + records_size;
+    h.values_size = values_size;
+    h.records_check = hash_bytes(records, records_size, 0);
+    h.header_check = snapshot_header_check(&h);
+
+    int err = fwrite(&h, sizeof(h), 1, f) != 1 ||
+              (records_size > 0 && fwrite(records, records_size, 1, f) != 1);
+    Free(records);
+    for(size_t i = 0; !err && i < lp->count; i++){
+        BLOB *vb = lp->items[i].value;
+        // Spilled values are read back one at a time, and not kept.
+        BLOB *loaded = blob_is_spilled(vb, NULL, NULL) ? vlog_load(vb) : NULL;
+        if(loaded != NULL) vb = loaded;
+        if(vb->size > 0 && (vb->content == NULL || fwrite(vb->content, vb->size, 1, f) != 1)) err = 1;
+        blob_unref(loaded, "written to snapshot");
+    }
+    if(!err && (fflush(f) != 0 || fsync(fileno(f)) != 0)) err = 1;
+    return err ? -1 : 0;
+}
+
+/*
+ * Write a snapshot of the store, as of the moment this is called, while
+ * requests go on.  The snapshot holds the values left by the transactions
+ * that had committed by then (see store_each_as_of in store_ext.h).  If the
+ * write-ahead log is open, it is rotated at the same point, and its old
+ * segment is removed once the snapshot is safely written.
+ *
+ * @param path  Name of the snapshot file.
+ * @return  0 if the snapshot was written, otherwise -1.
+ */
+int snapshot_write(char *path){
+    SNAPSHOT_LIST list = {0};
+    pthread_mutex_lock(&write_mutex);
+    store_checkpoint_begin();
+    unsigned long seq;
+    int rotated = wal_rotate(&seq) == 0;
+    if(!rotated) seq = trans_last_sequence();
+    store_each_as_of(seq, snapshot_collect, &list);
+    store_checkpoint_end();
+    qsort(list.items, list.count, sizeof(SNAPSHOT_ITEM), snapshot_item_compare);
+
+    size_t len = strlen(path);
+    char *tmp = Malloc(len + 5);
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+    int ret = -1;
+    FILE *f = fopen(tmp, "w");
+    if(f == NULL){
+        error("Cannot create snapshot %s: %s", tmp, strerror(errno));
+    } else {
+        int err = snapshot_write_file(f, &list);
+        if(fclose(f) != 0) err = -1;
+        if(err == 0 && rename(tmp, path) == 0){
+            ret = 0;
+        } else {
+            error("Cannot write snapshot %s: %s", path, strerror(errno));
+            unlink(tmp);
+        }
+    }
+    if(ret == 0 && rotated) wal_remove_old();
+    pthread_mutex_unlock(&write_mutex);
+    debug("Snapshot of %zu keys as of commit %lu written to %s", list.count, seq, path);
+    for(size_t i = 0; i < list.count; i++){
+        blob_unref(list.items[i].key, "snapshot written");
+        blob_unref(list.items[i].value, "snapshot written");
+    }
+    Free(list.items);
+    Free(tmp);
+    return ret;
+}
+
+/*
+ * Check that the header of a mapped snapshot is valid and that the
+ * sections it describes lie within the file.
+ *
+ * @return  NULL if the snapshot is valid, otherwise what is wrong with it.
+ */
+static char *snapshot_check(char *base, size_t size){
+    SNAPSHOT_HEADER *hp = (SNAPSHOT_HEADER *)base;
+    if(size < sizeof(SNAPSHOT_HEADER) || memcmp(hp->magic, SNAPSHOT_MAGIC, sizeof(hp->magic)) != 0)
+        return "not a snapshot";
+    if(hp->version != SNAPSHOT_VERSION || hp->header_size != sizeof(SNAPSHOT_HEADER))
+        return "unsupported snapshot version";
+    if(snapshot_header_check(hp) != hp->header_check)
+        return "header checksum mismatch";
+    if(hp->records_offset < sizeof(SNAPSHOT_HEADER) || hp->records_offset % 8 != 0 ||
+       hp->records_offset > size || hp->records_size > size - hp->records_offset ||
+       hp->values_offset > size || hp->values_size > size - hp->values_offset)
+        return "sections out of range";
+    if(hash_bytes(base + hp->records_offset, hp->records_size, 0) != hp->records_check)
+        return "record checksum mismatch";
+    return NULL;
+}
+
+/*
+ * Load a snapshot into the store, which must have been initialized and
+ * should be empty.  The values are entered by a single transaction which
+ * is committed before this returns, so this must be done before any other
+ * transaction is created.  The file stays mapped until snapshot_unmap()
+ * is called.
+ *
+ * @param path  Name of the snapshot file.
+ * @return  The number of keys loaded, 0 if there is no such file, or -1 if
+ *   the file could not be read or is not a valid snapshot.
+ */
+long snapshot_load(char *path){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        if(errno == ENOENT) return 0;
+        error("Cannot open snapshot %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size == 0){
+        close(fd);
+        error("Cannot read snapshot %s", path);
+        return -1;
+    }
+    size_t size = st.st_size;
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        error("Cannot map snapshot %s: %s", path, strerror(errno));
+        return -1;
+    }
+    char *problem = snapshot_check(base, size);
+    if(problem != NULL){
+        error("Snapshot %s is invalid: %s", path, problem);
+        munmap(base, size);
+        return -1;
+    }
+    SNAPSHOT_HEADER *hp = (SNAPSHOT_HEADER *)base;
+    char *values = base + hp->values_offset;
+    // Values are paged in as they are read, in no particular order.
+    if(hp->values_size > 0) madvise(base + (hp->values_offset & ~(uint64_t)(getpagesize() - 1)),
+                                    hp->values_size + (hp->values_offset & (getpagesize() - 1)),
+                                    MADV_RANDOM);
+
+    TRANSACTION *tp = trans_create();
+    char *rp = base + hp->records_offset, *end = rp + hp->records_size;
+    uint64_t n;
+    for(n = 0; n < hp->num_records; n++){
+        SNAPSHOT_RECORD *rec = (SNAPSHOT_RECORD *)rp;
+        if((size_t)(end - rp) < sizeof(SNAPSHOT_RECORD) ||
+           SNAPSHOT_PAD(rec->key_size) > (size_t)(end - rp) - sizeof(SNAPSHOT_RECORD) ||
+           rec->value_offset > hp->values_size || rec->value_size > hp->values_size - rec->value_offset)
+            break;
+        BLOB *vb = blob_create_borrowed(values + rec->value_offset, rec->value_size);
+        blob_expect(vb, rec->value_check);
+        KEY *kp = key_create(blob_create_borrowed(rec->key, rec->key_size));
+        if(store_put(tp, kp, vb) == TRANS_ABORTED) break;
+        rp += sizeof(SNAPSHOT_RECORD) + SNAPSHOT_PAD(rec->key_size);
+    }
+    if(n < hp->num_records || trans_commit(tp) != TRANS_COMMITTED){
+        if(n < hp->num_records) trans_abort(tp);
+        error("Snapshot %s is invalid: bad record %lu", path, (unsigned long)n);
+        // The aborted versions still refer to the mapping, so it is kept.
+        map_base = base;
+        map_size = size;
+        return -1;
+    }
+    map_base = base;
+    map_size = size;
+    debug("Loaded %lu keys from snapshot %s", (unsigned long)n, path);
+    return n;
+}
+
+/*
+ * Unmap a snapshot that was loaded.  This may only be done once the store
+ * has been finalized and nothing refers to the values in the snapshot.
+ */
+void snapshot_unmap(void){
+    if(map_base == NULL) return;
+    munmap(map_base, map_size);
+    map_base = NULL;
+    map_size = 0;
+}
@@ -0,0 +1,1272 @@
+#include <limits.h>
+#include "store.h"
+#include "store_ext.h"
+#include "data_ext.h"
+#include "transaction_ext.h"
+#include "index.h"
+#include "epoch.h"
+#include "vlog.h"
+#include "csapp.h"
+#include "debug.h"
+
+/*
+ * The map is split into segments, each of which is an independent hash
+ * table with its own mutex, so that operations on keys in different segments
+ * do not contend with each other.  The top store_segment_bits bits of a key's
+ * hash select the segment and the low bits select the bucket within it.
+ * The single table and mutex in the_map (store.h) are not used.
+ *
+ * While a segment is being resized, its entries live in two tables: table,
+ * which is the new table, and old_table, which is being drained into it.
+ * Buckets of old_table below rehash_index have already been moved.
+ * New entries always go into table.
+ *
+ * Reads of settled values (see STORE_ENTRY) walk the current table without
+ * the segment mutex.  For their sake, a table carries its own size, and
+ * the table pointer, bucket heads and entry links are stored atomically,
+ * with each entry fully set up before it is linked in.  Such a reader can
+ * be carried into the wrong chain by a concurrent rehash, in which case it
+ * just misses and falls back to the locked path.  Tables and entries that
+ * such a reader might be looking at are freed through epoch_retire(), as
+ * versions and blobs always are.
+ */
+typedef struct store_table {
+    int num_buckets;
+    MAP_ENTRY *buckets[];
+} STORE_TABLE;
+
+typedef struct store_segment {
+    pthread_mutex_t mutex;      // Protects everything in the segment.
+    STORE_TABLE *table;         // Current table.
+    STORE_TABLE *old_table;     // Table being drained, or NULL.
+    int rehash_index;           // Next bucket of old_table to be moved.
+    size_t num_entries;
+    size_t grows;
+    size_t shrinks;
+    size_t rehashed;
+    size_t reclaimed;           // Versions removed by garbage collection.
+    size_t cascaded;            // Creators aborted by garbage collection.
+    size_t removed;             // Entries removed for having no versions.
+} STORE_SEGMENT;
+
+/*
+ * Every map entry is allocated as a STORE_ENTRY.  When the version list of
+ * an entry consists of a single committed version, settled points to it,
+ * and a GET can return its value without taking the segment mutex or
+ * creating a version of its own.  Instead the reader records its ID in
+ * max_reader, and no transaction with a smaller ID may then access the key,
+ * just as if the reader had left a version behind.  A transaction with a
+ * larger ID does not need to depend on the reader, because the reader
+ * changed nothing.
+ *
+ * Anyone changing the version list first clears settled and only then looks
+ * at max_reader; a reader first raises max_reader and only then checks that
+ * settled has not changed.  Whichever comes second sees the other, so either
+ * the reader falls back to the locked path or the writer sees the read.
+ *
+ * Every GET sets referenced, which is the CLOCK bit for choosing values to
+ * spill to the value log: the collector clears it as it passes, and spills
+ * the settled value of an entry whose bit is already clear.  The blob of a
+ * settled version may be swapped for a spilled one (see data_ext.h) while
+ * lock-free readers look at it, so it is read and written atomically.
+ */
+typedef struct store_entry {
+    MAP_ENTRY entry;            // Must be first.
+    VERSION *settled;           // Sole committed version, if known to be.
+    unsigned int max_reader;    // Greatest ID of a reader of settled.
+    unsigned char referenced;   // Read since the collector last passed.
+} STORE_ENTRY;
+
+/*
+ * A settled value chosen by the collector to be spilled.
+ */
+typedef struct store_spill {
+    STORE_ENTRY *entry;
+    VERSION *version;
+    BLOB *blob;                 // The value, with a reference of its own.
+} STORE_SPILL;
+
+int store_segment_bits = STORE_SEGMENT_BITS;
+int store_fast_reads = 1;
+int store_occ = 0;
+int store_gc_budget = STORE_GC_BUDGET;
+size_t store_memory_cap = 0;
+
+/*
+ * State of the collector thread.  gc_running is also read without the
+ * mutex by store_access, to decide how much collection to do inline.
+ */
+static pthread_mutex_t gc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gc_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t gc_thread;
+static int gc_running = 0;
+static int gc_stop = 0;
+static size_t gc_passes = 0;
+static double gc_last_pass_ms = 0;
+static double gc_max_pass_ms = 0;
+static double gc_busy_ms = 0;
+
+/*
+ * While a checkpoint is reading the store (see store_each_as_of), gc_cut is
+ * the commit sequence number it reads as of, and garbage collection keeps
+ * the last version committed up to then.  Before the checkpoint has chosen
+ * its cut, gc_cut is 0, which keeps every version.  Segments are not
+ * resized during a checkpoint, so that it can walk each table in batches.
+ */
+#define STORE_NO_CUT ULONG_MAX
+static unsigned long gc_cut = STORE_NO_CUT;
+
+/*
+ * In optimistic mode, committing transactions are validated one at a time
+ * under occ_mutex, which also protects the counters.
+ */
+static pthread_mutex_t occ_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t occ_validations = 0;
+static size_t occ_conflicts = 0;
+
+static STORE_SEGMENT *segments = NULL;
+static int num_segments = 0;
+static int segment_shift = 0;
+
+/*
+ * Segment that holds a key.
+ */
+static STORE_SEGMENT *store_segment(KEY *key){
+    return &segments[(unsigned int)((unsigned long)(unsigned int)key->hash >> segment_shift)];
+}
+
+/*
+ * Index of the bucket for a key in a table with the given number of buckets.
+ * Table sizes are always powers of two.
+ */
+static int store_bucket(KEY *key, int num_buckets){
+    return (unsigned int)key->hash & (num_buckets - 1);
+}
+
+/*
+ * Compare two keys for equality.  The content of a key never changes once
+ * it has been created, so no locking is needed, and keys whose hashes
+ * differ are rejected without looking at their contents.
+ */
+static int store_key_equal(KEY *kp1, KEY *kp2){
+    BLOB *bp1 = kp1->blob, *bp2 = kp2->blob;
+    if(kp1->hash != kp2->hash || bp1->size != bp2->size) return 0;
+    return bp1 == bp2 || bp1->size == 0 || memcmp(bp1->content, bp2->content, bp1->size) == 0;
+}
+
+static STORE_TABLE *store_table_create(int num_buckets){
+    STORE_TABLE *tab = Calloc(1, sizeof(STORE_TABLE) + num_buckets * sizeof(MAP_ENTRY *));
+    tab->num_buckets = num_buckets;
+    return tab;
+}
+
+/*
+ * Functions passed to epoch_retire().
+ */
+static void store_retire_table(void *tab){
+    Free(tab);
+}
+
+static void store_retire_entry(void *ep){
+    key_dispose(((MAP_ENTRY *)ep)->key);
+    Free(ep);
+}
+
+/*
+ * Drop the reference a version held to a blob it no longer points to.
+ * This is deferred, because a lock-free reader may have loaded the blob
+ * from the version just before and be about to take a reference of its
+ * own, which must not bring the blob back from a count of zero.
+ */
+static void store_release_blob(void *bp){
+    blob_unref(bp, "replaced in version");
+}
+
+/*
+ * Link an entry in at the head of a bucket.
+ */
+static void store_link(STORE_TABLE *tab, int i, MAP_ENTRY *ep){
+    __atomic_store_n(&ep->next, tab->buckets[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&tab->buckets[i], ep, __ATOMIC_RELEASE);
+}
+
+/*
+ * Move up to count buckets from the old table of a segment into its
+ * current table.  When the old table has been emptied it is freed.
+ * The segment mutex must be held.
+ */
+static void store_rehash_step(STORE_SEGMENT *sp, int count){
+    while(sp->old_table != NULL && count-- > 0){
+        MAP_ENTRY *ep = sp->old_table->buckets[sp->rehash_index];
+        while(ep != NULL){
+            MAP_ENTRY *next = ep->next;
+            store_link(sp->table, store_bucket(ep->key, sp->table->num_buckets), ep);
+            sp->rehashed++;
+            ep = next;
+        }
+        __atomic_store_n(&sp->old_table->buckets[sp->rehash_index], NULL, __ATOMIC_RELAXED);
+        sp->rehash_index++;
+        if(sp->rehash_index == sp->old_table->num_buckets){
+            debug("Resize of segment %ld to %d buckets complete", sp - segments, sp->table->num_buckets);
+            epoch_retire(sp->old_table, store_retire_table);
+            sp->old_table = NULL;
+            sp->rehash_index = 0;
+        }
+    }
+}
+
+/*
+ * Start a resize of a segment if its load factor is out of range.
+ * If a previous resize is still in progress, it is finished first.
+ * The segment mutex must be held.
+ */
+static void store_maybe_resize(STORE_SEGMENT *sp){
+    if(__atomic_load_n(&gc_cut, __ATOMIC_SEQ_CST) != STORE_NO_CUT) return;
+    int size = sp->table->num_buckets;
+    if(sp->num_entries > (size_t)size * STORE_MAX_LOAD){
+        size *= 2;
+        sp->grows++;
+    } else if(size > NUM_BUCKETS && sp->num_entries * STORE_MIN_LOAD_DIV < (size_t)size){
+        size /= 2;
+        sp->shrinks++;
+    } else {
+        return;
+    }
+    if(sp->old_table != NULL) store_rehash_step(sp, sp->old_table->num_buckets);
+    debug("Resizing segment %ld from %d to %d buckets (%zu entries)",
+          sp - segments, sp->table->num_buckets, size, sp->num_entries);
+    sp->old_table = sp->table;
+    sp->rehash_index = 0;
+    __atomic_store_n(&sp->table, store_table_create(size), __ATOMIC_RELEASE);
+}
+
+/*
+ * Find the map entry for a key, looking in both tables of the segment if
+ * a resize is in progress.  Keys whose hashes differ are skipped without
+ * looking at their contents.
+ * The segment mutex must be held.
+ *
+ * @return  The entry, or NULL if there is none.
+ */
+static MAP_ENTRY *store_lookup(STORE_SEGMENT *sp, KEY *key){
+    MAP_ENTRY *ep = sp->table->buckets[store_bucket(key, sp->table->num_buckets)];
+    for(; ep != NULL; ep = ep->next){
+        if(store_key_equal(ep->key, key)) return ep;
+    }
+    if(sp->old_table != NULL){
+        int i = store_bucket(key, sp->old_table->num_buckets);
+        if(i >= sp->rehash_index){
+            for(ep = sp->old_table->buckets[i]; ep != NULL; ep = ep->next){
+                if(store_key_equal(ep->key, key)) return ep;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Find the map entry for a key, creating one if there is none.  A new key is
+ * also added to the index, which fails if a range scan by a later transaction
+ * has already passed over the place where it belongs.
+ * The key is inherited: it is either stored in the new entry or disposed of.
+ * The segment mutex must be held.
+ *
+ * @return  The entry, or NULL if the key could not be added on behalf of tp.
+ */
+static MAP_ENTRY *store_find_entry(STORE_SEGMENT *sp, KEY *key, TRANSACTION *tp){
+    MAP_ENTRY *ep = store_lookup(sp, key);
+    if(ep != NULL){
+        key_dispose(key);
+        return ep;
+    }
+    if(index_insert(key, tp->id) < 0){
+        key_dispose(key);
+        return NULL;
+    }
+    ep = Calloc(1, sizeof(STORE_ENTRY));
+    ep->key = key;
+    ep->versions = NULL;
+    store_link(sp->table, store_bucket(key, sp->table->num_buckets), ep);
+    sp->num_entries++;
+    store_maybe_resize(sp);
+    return ep;
+}
+
+/*
+ * Garbage collection pass over the version list of a map entry.
+ * If there is an aborted version, it and all later versions are removed
+ * and their creators aborted.  Then, if trim is set, all but the most
+ * recent committed version are removed, except what a checkpoint in
+ * progress still needs.
+ * The mutex of the segment containing the entry must be held.  Everything
+ * touched here belongs to the one entry, so nothing else needs locking.
+ */
+static void store_gc(STORE_SEGMENT *sp, MAP_ENTRY *ep, int trim){
+    VERSION *vp = ep->versions;
+    while(vp != NULL && trans_get_status(vp->creator) != TRANS_ABORTED) vp = vp->next;
+    if(vp != NULL){
+        if(vp->prev != NULL) {
+            vp->prev->next = NULL;
+        } else {
+            ep->versions = NULL;
+        }
+        while(vp != NULL){
+            VERSION *next = vp->next;
+            if(trans_get_status(vp->creator) == TRANS_PENDING){
+                trans_abort(trans_ref(vp->creator, "aborting creator in gc"));
+                sp->cascaded++;
+            }
+            version_dispose(vp);
+            sp->reclaimed++;
+            vp = next;
+        }
+    }
+    if(!trim) return;
+
+    unsigned long cut = __atomic_load_n(&gc_cut, __ATOMIC_SEQ_CST);
+    VERSION *last = NULL;
+    for(vp = ep->versions; vp != NULL; vp = vp->next){
+        if(trans_get_status(vp->creator) != TRANS_COMMITTED) break;
+        if(cut != STORE_NO_CUT && trans_sequence(vp->creator) > cut) break;
+        last = vp;
+    }
+    while(last != NULL && ep->versions != last){
+        vp = ep->versions;
+        ep->versions = vp->next;
+        ep->versions->prev = NULL;
+        version_dispose(vp);
+        sp->reclaimed++;
+    }
+}
+
+/*
+ * Find the last version of an entry that was created by a committed
+ * transaction, provided every version of the entry was.
+ * The mutex of the segment containing the entry must be held.
+ *
+ * @return  The version, or NULL if there are no versions or some version
+ *   is not committed.
+ */
+static VERSION *store_settled_version(MAP_ENTRY *ep){
+    VERSION *vp = ep->versions;
+    while(vp != NULL && trans_get_status(vp->creator) == TRANS_COMMITTED){
+        if(vp->next == NULL) return vp;
+        vp = vp->next;
+    }
+    return NULL;
+}
+
+/*
+ * Record a read of the settled version of an entry by a transaction.
+ *
+ * @return  The previous value of max_reader.
+ */
+static unsigned int store_record_read(STORE_ENTRY *se, unsigned int id){
+    unsigned int old = __atomic_load_n(&se->max_reader, __ATOMIC_SEQ_CST);
+    while(old < id && !__atomic_compare_exchange_n(&se->max_reader, &old, id, 0,
+                                                   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    return old;
+}
+
+/*
+ * Set the CLOCK bit of an entry, writing it only if it is clear, so that
+ * readers of a hot key do not keep dirtying its cache line.
+ */
+static void store_touch(STORE_ENTRY *se){
+    if(!__atomic_load_n(&se->referenced, __ATOMIC_RELAXED))
+        __atomic_store_n(&se->referenced, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Try to read the settled value for a key without taking the segment mutex.
+ * This gives up, leaving the work to store_access, whenever the key is not
+ * in the current table of its segment, its value is not settled, or the
+ * transaction is too old to read it.  If it gives up after recording the
+ * read, a writer older than tp may later be aborted needlessly, but never
+ * wrongly.  In optimistic mode the version read is added to the read set
+ * of tp instead.
+ *
+ * @return  Nonzero if the value was read and stored in *valuep.
+ */
+static int store_get_settled(TRANSACTION *tp, KEY *key, BLOB **valuep){
+    STORE_SEGMENT *sp = store_segment(key);
+    int found = 0;
+    epoch_enter();
+    STORE_TABLE *tab = __atomic_load_n(&sp->table, __ATOMIC_ACQUIRE);
+    MAP_ENTRY *ep = __atomic_load_n(&tab->buckets[store_bucket(key, tab->num_buckets)], __ATOMIC_ACQUIRE);
+    while(ep != NULL && !store_key_equal(ep->key, key)) ep = __atomic_load_n(&ep->next, __ATOMIC_ACQUIRE);
+    if(ep != NULL){
+        STORE_ENTRY *se = (STORE_ENTRY *)ep;
+        VERSION *vp = __atomic_load_n(&se->settled, __ATOMIC_SEQ_CST);
+        BLOB *bp = vp != NULL ? __atomic_load_n(&vp->blob, __ATOMIC_ACQUIRE) : NULL;
+        // Spilled values are read back by the locked path.  In optimistic
+        // mode the read is checked when the transaction commits instead.
+        if(vp != NULL && !blob_is_spilled(bp, NULL, NULL) &&
+           (store_occ || (vp->creator->id <= tp->id && store_record_read(se, tp->id) <= tp->id &&
+                          __atomic_load_n(&se->settled, __ATOMIC_SEQ_CST) == vp))){
+            if(store_occ) trans_add_read(tp, key->blob, vp->creator->id);
+            *valuep = blob_ref(bp, "returned by get");
+            store_touch(se);
+            found = 1;
+        }
+    }
+    epoch_exit();
+    return found;
+}
+
+/*
+ * Add a version created by a transaction at the end of the version list of
+ * an entry, replacing the last version if the transaction created that one
+ * too.  The version inherits the caller's reference to the value.
+ * The mutex of the segment containing the entry must be held.
+ *
+ * @param last  The last version of the entry, or NULL if it has none.
+ */
+static void store_append(MAP_ENTRY *ep, VERSION *last, TRANSACTION *tp, BLOB *value){
+    VERSION *np = version_create(tp, value);
+    if(last != NULL && last->creator == tp){
+        np->prev = last->prev;
+        if(last->prev != NULL) {
+            last->prev->next = np;
+        } else {
+            ep->versions = np;
+        }
+        version_dispose(last);
+    } else if(last != NULL){
+        last->next = np;
+        np->prev = last;
+    } else {
+        ep->versions = np;
+    }
+}
+
+/*
+ * Common code for store_put and store_get.  For a PUT, value is the new
+ * value and one reference on it is consumed.  For a GET, value is ignored
+ * and the value read is stored in *valuep; if that value is spilled, a
+ * reference to the key blob is stored in *keyp, for store_unspill.
+ */
+static TRANS_STATUS store_access(TRANSACTION *tp, KEY *key, BLOB *value, BLOB **valuep, BLOB **keyp){
+    if(tp == NULL || key == NULL) return TRANS_ABORTED;
+    STORE_SEGMENT *sp = store_segment(key);
+    pthread_mutex_lock(&sp->mutex);
+    store_rehash_step(sp, STORE_REHASH_STEP);
+    MAP_ENTRY *ep = store_find_entry(sp, key, tp);
+    if(ep == NULL){
+        pthread_mutex_unlock(&sp->mutex);
+        debug("Transaction %d creates a key in a range already scanned", tp->id);
+        if(valuep == NULL) blob_unref(value, "aborted put");
+        return trans_abort(trans_ref(tp, "aborting in store"));
+    }
+    STORE_ENTRY *se = (STORE_ENTRY *)ep;
+    __atomic_store_n(&se->settled, NULL, __ATOMIC_SEQ_CST);
+    // Aborted versions have to go now, but superseded committed versions
+    // can be left to the collector thread if it is running.
+    store_gc(sp, ep, !__atomic_load_n(&gc_running, __ATOMIC_RELAXED));
+
+    VERSION *last = ep->versions;
+    while(last != NULL && last->next != NULL) last = last->next;
+    unsigned int max_reader = __atomic_load_n(&se->max_reader, __ATOMIC_SEQ_CST);
+    if((last != NULL && last->creator->id > tp->id) || max_reader > tp->id){
+        pthread_mutex_unlock(&sp->mutex);
+        debug("Transaction %d is too old for key (last creator %d, last reader %d)",
+              tp->id, last != NULL ? last->creator->id : 0, max_reader);
+        if(valuep == NULL) blob_unref(value, "aborted put");
+        return trans_abort(trans_ref(tp, "aborting in store"));
+    }
+
+    if(valuep != NULL && store_fast_reads && last != NULL && store_settled_version(ep) == last){
+        // The value is settled: read it as store_get_settled would, and let
+        // later readers do the same without the mutex.
+        store_record_read(se, tp->id);
+        *valuep = blob_ref(last->blob, "returned by get");
+        __atomic_store_n(&se->settled, last, __ATOMIC_SEQ_CST);
+        store_touch(se);
+        if(blob_is_spilled(*valuep, NULL, NULL)) *keyp = blob_ref(ep->key->blob, "key to unspill");
+        pthread_mutex_unlock(&sp->mutex);
+        return trans_get_status(tp);
+    }
+
+    for(VERSION *vp = ep->versions; vp != NULL; vp = vp->next){
+        if(vp->creator != tp && trans_get_status(vp->creator) == TRANS_PENDING)
+            trans_add_dependency(tp, vp->creator);
+    }
+
+    if(valuep != NULL){
+        // A GET reads the value of the immediately preceding version.
+        value = last != NULL ? blob_ref(last->blob, "value read by get") : NULL;
+        *valuep = blob_ref(value, "returned by get");
+        store_touch(se);
+        if(blob_is_spilled(value, NULL, NULL)) *keyp = blob_ref(ep->key->blob, "key to unspill");
+    }
+    store_append(ep, last, tp, value);
+    if(valuep == NULL && trans_track_writes) trans_add_write(tp, ep->key->blob, value);
+    pthread_mutex_unlock(&sp->mutex);
+    return trans_get_status(tp);
+}
+
+/*
+ * Look for a key in the write set of a transaction, for a GET in
+ * optimistic mode.  The last write of the key is the one that counts.
+ *
+ * @return  Nonzero if the key was found, in which case a reference to the
+ *   value written is stored in *valuep.
+ */
+static int store_occ_own_write(TRANSACTION *tp, KEY *key, BLOB **valuep){
+    int found = 0;
+    for(TRANS_WRITE *wp = trans_get_writes(tp); wp != NULL; wp = wp->next){
+        if(wp->key->size == key->blob->size && blob_compare(wp->key, key->blob) == 0){
+            *valuep = wp->value;
+            found = 1;
+        }
+    }
+    if(found) blob_ref(*valuep, "returned by get");
+    return found;
+}
+
+/*
+ * Last version of an entry that was created by a committed transaction.
+ * The mutex of the segment containing the entry must be held.
+ */
+static VERSION *store_last_committed(MAP_ENTRY *ep){
+    VERSION *vp = ep->versions;
+    while(vp != NULL && vp->next != NULL) vp = vp->next;
+    while(vp != NULL && trans_get_status(vp->creator) != TRANS_COMMITTED) vp = vp->prev;
+    return vp;
+}
+
+/*
+ * GET in optimistic mode, when the value is not settled.  The last
+ * committed value is read, whatever pending versions follow it, and the
+ * version read is added to the read set of the transaction.  Nothing is
+ * added to the key.  If the value is spilled, a reference to the key blob
+ * is stored in *keyp, as by store_access.
+ */
+static TRANS_STATUS store_occ_read(TRANSACTION *tp, KEY *key, BLOB **valuep, BLOB **keyp){
+    if(tp == NULL || key == NULL) return TRANS_ABORTED;
+    STORE_SEGMENT *sp = store_segment(key);
+    pthread_mutex_lock(&sp->mutex);
+    store_rehash_step(sp, STORE_REHASH_STEP);
+    MAP_ENTRY *ep = store_lookup(sp, key);
+    VERSION *vp = NULL;
+    if(ep != NULL){
+        STORE_ENTRY *se = (STORE_ENTRY *)ep;
+        vp = store_last_committed(ep);
+        if(vp != NULL){
+            *valuep = blob_ref(vp->blob, "returned by get");
+            store_touch(se);
+            if(store_fast_reads && store_settled_version(ep) == vp)
+                __atomic_store_n(&se->settled, vp, __ATOMIC_SEQ_CST);
+            if(blob_is_spilled(*valuep, NULL, NULL)) *keyp = blob_ref(ep->key->blob, "key to unspill");
+        }
+    }
+    trans_add_read(tp, key->blob, vp != NULL ? vp->creator->id : 0);
+    pthread_mutex_unlock(&sp->mutex);
+    key_dispose(key);
+    return trans_get_status(tp);
+}
+
+/*
+ * PUT in optimistic mode: the write only goes in the write set of the
+ * transaction, until it commits.
+ */
+static TRANS_STATUS store_occ_put(TRANSACTION *tp, KEY *key, BLOB *value){
+    if(tp == NULL || key == NULL){
+        key_dispose(key);
+        blob_unref(value, "aborted put");
+        return TRANS_ABORTED;
+    }
+    trans_add_write(tp, key->blob, value);
+    key_dispose(key);
+    blob_unref(value, "in write set");
+    return trans_get_status(tp);
+}
+
+/*
+ * Validate hook (see transaction_ext.h) for optimistic mode.  Every key in
+ * the read set must still have, as its last version that is not aborted,
+ * the version that was read, or none if none was read.  If so, the write
+ * set is installed as versions created by the transaction, before any
+ * other transaction can be validated.  A write that lands after a version
+ * whose creator has been validated but not yet committed makes the
+ * transaction depend on that creator, so the two commit, and reach the
+ * commit hook, in the order they were validated.
+ *
+ * @return  0 if the transaction may go on to commit, -1 if it must abort.
+ */
+static int store_occ_validate(TRANSACTION *tp){
+    TRANS_READ *reads = trans_get_reads(tp);
+    TRANS_WRITE *writes = trans_get_writes(tp);
+    if(reads == NULL && writes == NULL) return 0;
+    pthread_mutex_lock(&occ_mutex);
+    occ_validations++;
+    for(TRANS_READ *rp = reads; rp != NULL; rp = rp->next){
+        KEY key = { .hash = blob_hash(rp->key), .blob = rp->key };
+        STORE_SEGMENT *sp = store_segment(&key);
+        pthread_mutex_lock(&sp->mutex);
+        MAP_ENTRY *ep = store_lookup(sp, &key);
+        VERSION *last = NULL;
+        if(ep != NULL){
+            store_gc(sp, ep, 0);
+            for(last = ep->versions; last != NULL && last->next != NULL; last = last->next);
+        }
+        unsigned int version = last != NULL ? last->creator->id : 0;
+        pthread_mutex_unlock(&sp->mutex);
+        if(version != rp->version){
+            debug("Transaction %d read a version of a key that has since been replaced", tp->id);
+            occ_conflicts++;
+            pthread_mutex_unlock(&occ_mutex);
+            return -1;
+        }
+    }
+    for(TRANS_WRITE *wp = writes; wp != NULL; wp = wp->next){
+        KEY *key = key_create(blob_ref(wp->key, "installed"));
+        STORE_SEGMENT *sp = store_segment(key);
+        pthread_mutex_lock(&sp->mutex);
+        store_rehash_step(sp, STORE_REHASH_STEP);
+        MAP_ENTRY *ep = store_find_entry(sp, key, tp);
+        if(ep == NULL){
+            // Versions already installed go when the transaction aborts.
+            pthread_mutex_unlock(&sp->mutex);
+            occ_conflicts++;
+            pthread_mutex_unlock(&occ_mutex);
+            return -1;
+        }
+        STORE_ENTRY *se = (STORE_ENTRY *)ep;
+        __atomic_store_n(&se->settled, NULL, __ATOMIC_SEQ_CST);
+        // Only committing writes add versions, so trimming here keeps hot
+        // keys short enough for readers without waiting for the collector.
+        store_gc(sp, ep, 1);
+        VERSION *last = NULL;
+        for(VERSION *vp = ep->versions; vp != NULL; vp = vp->next){
+            if(vp->creator != tp && trans_get_status(vp->creator) == TRANS_PENDING)
+                trans_add_dependency(tp, vp->creator);
+            last = vp;
+        }
+        store_append(ep, last, tp, blob_ref(wp->value, "installed"));
+        pthread_mutex_unlock(&sp->mutex);
+    }
+    pthread_mutex_unlock(&occ_mutex);
+    return 0;
+}
+
+/*
+ * Put a value read back from the value log in place of the spilled blob
+ * it was read from, in every version of the key that still has it, so
+ * that the next reads find it in memory.
+ *
+ * @param kb  The key blob.
+ * @param spilled  The spilled blob.
+ * @param bp  The value read back.
+ */
+static void store_unspill(BLOB *kb, BLOB *spilled, BLOB *bp){
+    KEY key = { .hash = blob_hash(kb), .blob = kb };
+    STORE_SEGMENT *sp = store_segment(&key);
+    pthread_mutex_lock(&sp->mutex);
+    MAP_ENTRY *ep = store_lookup(sp, &key);
+    for(VERSION *vp = ep != NULL ? ep->versions : NULL; vp != NULL; vp = vp->next){
+        if(vp->blob == spilled){
+            __atomic_store_n(&vp->blob, blob_ref(bp, "unspilled"), __ATOMIC_RELEASE);
+            epoch_retire(spilled, store_release_blob);
+        }
+    }
+    pthread_mutex_unlock(&sp->mutex);
+}
+
+/*
+ * Is more blob content in memory than the memory cap allows?
+ */
+static int store_over_cap(void){
+    return store_memory_cap > 0 && blob_resident_bytes() > store_memory_cap;
+}
+
+/*
+ * Second-chance (CLOCK) choice of a value to spill: the settled value of
+ * an entry that nobody has read since the collector last passed, if it is
+ * big enough to be worth it.  The segment mutex must be held.
+ *
+ * @return  Nonzero if the value was chosen and described in *cp.
+ */
+static int store_clock(STORE_ENTRY *se, STORE_SPILL *cp){
+    if(__atomic_exchange_n(&se->referenced, 0, __ATOMIC_RELAXED)) return 0;
+    VERSION *vp = se->settled;
+    if(vp == NULL || !blob_is_owned(vp->blob) || vp->blob->size < STORE_SPILL_MIN) return 0;
+    cp->entry = se;
+    cp->version = vp;
+    cp->blob = vp->blob;
+    return 1;
+}
+
+/*
+ * Write the chosen values of a segment to the value log without holding the
+ * segment mutex, and then put the spilled blobs in their place, unless the
+ * value has been replaced or unsettled in the meantime.  The caller must be
+ * in an epoch read section (see epoch.h) from before the values were
+ * chosen, so that the entries, versions and blobs have not been freed
+ * even though no references to them are held.
+ */
+static void store_spill(STORE_SEGMENT *sp, STORE_SPILL *spills, int n){
+    BLOB *spilled[STORE_SPILL_BATCH];
+    for(int i = 0; i < n; i++) spilled[i] = vlog_spill(spills[i].blob);
+    pthread_mutex_lock(&sp->mutex);
+    for(int i = 0; i < n; i++){
+        STORE_SPILL *cp = &spills[i];
+        if(spilled[i] != NULL && cp->entry->settled == cp->version && cp->version->blob == cp->blob){
+            __atomic_store_n(&cp->version->blob, spilled[i], __ATOMIC_RELEASE);
+            epoch_retire(cp->blob, store_release_blob);
+            spilled[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&sp->mutex);
+    for(int i = 0; i < n; i++) blob_unref(spilled[i], "not needed");
+}
+
+/*
+ * Collect garbage in up to count buckets of the current table of a segment,
+ * starting at bucket *cursor, and advance *cursor.  Entries left with no
+ * versions at all are removed, and entries left with only committed
+ * versions are marked settled, so that cold keys are served by the lock-free
+ * read path too.  Resizes in progress are also moved along, so that a segment
+ * nobody touches does not hold on to its old table.
+ *
+ * @return  Nonzero if the end of the table has been reached.
+ */
+static int store_sweep(STORE_SEGMENT *sp, int *cursor, int count){
+    STORE_SPILL spills[STORE_SPILL_BATCH];
+    int nspills = 0;
+    int spill = store_over_cap();
+    if(spill) epoch_enter();
+    pthread_mutex_lock(&sp->mutex);
+    store_rehash_step(sp, count);
+    STORE_TABLE *tab = sp->table;
+    int i;
+    for(i = *cursor; i < tab->num_buckets && count-- > 0; i++){
+        MAP_ENTRY **epp = &tab->buckets[i];
+        while(*epp != NULL){
+            MAP_ENTRY *ep = *epp;
+            STORE_ENTRY *se = (STORE_ENTRY *)ep;
+            // If the entry is settled, this can only remove versions before
+            // the settled one, which lock-free readers never look at.
+            store_gc(sp, ep, 1);
+            if(ep->versions == NULL){
+                __atomic_store_n(epp, ep->next, __ATOMIC_RELEASE);
+                index_remove(ep->key);
+                epoch_retire(ep, store_retire_entry);
+                sp->num_entries--;
+                sp->removed++;
+                continue;
+            }
+            if(se->settled == NULL && store_fast_reads)
+                __atomic_store_n(&se->settled, store_settled_version(ep), __ATOMIC_SEQ_CST);
+            if(spill && nspills < STORE_SPILL_BATCH && store_clock(se, &spills[nspills]))
+                nspills++;
+            epp = &ep->next;
+        }
+    }
+    *cursor = i;
+    int done = i >= tab->num_buckets;
+    store_maybe_resize(sp);
+    pthread_mutex_unlock(&sp->mutex);
+    if(spill){
+        if(nspills > 0) store_spill(sp, spills, nspills);
+        epoch_exit();
+    }
+    return done;
+}
+
+static long store_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * Sleep in the collector thread for the given time, or until it is told
+ * to stop.  The gc mutex must be held.
+ *
+ * @return  Nonzero if the thread should stop.
+ */
+static int store_gc_wait(long ns){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ns / 1000000000L;
+    ts.tv_nsec += ns % 1000000000L;
+    if(ts.tv_nsec >= 1000000000L){
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    while(!gc_stop && pthread_cond_timedwait(&gc_cond, &gc_mutex, &ts) == 0);
+    return gc_stop;
+}
+
+/*
+ * Thread function of the collector.  It sweeps the segments a few buckets
+ * at a time, holding each segment mutex only for one batch.  To keep to its
+ * CPU budget, it sleeps for (100 - budget) / budget times as long as it
+ * spends sweeping, paying off the debt whenever it exceeds a millisecond.
+ * A full pass over the store starts at most every STORE_GC_INTERVAL_MS.
+ * While the store is over its memory cap, neither limit applies.
+ * It does not take the server's signals, so that a shutdown never runs
+ * in this thread, which it would have to join, possibly in the middle of
+ * a sweep holding a segment mutex.
+ */
+static void *store_gc_thread(void *arg){
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    long debt = 0;
+    pthread_mutex_lock(&gc_mutex);
+    while(!gc_stop){
+        int budget = store_gc_budget < 1 ? 1 : store_gc_budget > 100 ? 100 : store_gc_budget;
+        pthread_mutex_unlock(&gc_mutex);
+        long pass_start = store_now_ns(), busy = 0;
+        int stop = 0;
+        for(int s = 0; s < num_segments && !stop; s++){
+            int cursor = 0, done = 0;
+            while(!done && !stop){
+                long t = store_now_ns();
+                done = store_sweep(&segments[s], &cursor, STORE_GC_BUCKETS);
+                t = store_now_ns() - t;
+                busy += t;
+                // Over the memory cap, spilling cannot wait for the budget.
+                if(!store_over_cap()) debt += t * (100 - budget) / budget;
+                if(debt >= 1000000){
+                    pthread_mutex_lock(&gc_mutex);
+                    stop = store_gc_wait(debt);
+                    pthread_mutex_unlock(&gc_mutex);
+                    debt = 0;
+                }
+            }
+        }
+        long elapsed = store_now_ns() - pass_start;
+        pthread_mutex_lock(&gc_mutex);
+        if(stop) break;
+        gc_passes++;
+        gc_last_pass_ms = elapsed / 1e6;
+        if(gc_last_pass_ms > gc_max_pass_ms) gc_max_pass_ms = gc_last_pass_ms;
+        gc_busy_ms += busy / 1e6;
+        // Over the memory cap, the next pass starts at once to spill more.
+        if(elapsed < STORE_GC_INTERVAL_MS * 1000000L && !store_over_cap())
+            store_gc_wait(STORE_GC_INTERVAL_MS * 1000000L - elapsed);
+    }
+    pthread_mutex_unlock(&gc_mutex);
+    return NULL;
+}
+
+/*
+ * Start the garbage collector thread, if it is not already running.
+ * While it runs, store operations leave superseded committed versions
+ * for it to remove, rather than removing them inline.
+ */
+void store_gc_start(void){
+    pthread_mutex_lock(&gc_mutex);
+    if(!gc_running){
+        gc_stop = 0;
+        __atomic_store_n(&gc_running, 1, __ATOMIC_RELAXED);
+        pthread_create(&gc_thread, NULL, store_gc_thread, NULL);
+        debug("Garbage collector started (budget %d%%)", store_gc_budget);
+    }
+    pthread_mutex_unlock(&gc_mutex);
+}
+
+/*
+ * Stop the garbage collector thread, if it is running, and wait for it
+ * to finish.
+ */
+void store_gc_stop(void){
+    pthread_mutex_lock(&gc_mutex);
+    if(!gc_running){
+        pthread_mutex_unlock(&gc_mutex);
+        return;
+    }
+    gc_stop = 1;
+    pthread_cond_broadcast(&gc_cond);
+    pthread_mutex_unlock(&gc_mutex);
+    pthread_join(gc_thread, NULL);
+    __atomic_store_n(&gc_running, 0, __ATOMIC_RELAXED);
+    debug("Garbage collector stopped");
+}
+
+/*
+ * Initialize the store.
+ */
+void store_init(void){
+    if(store_segment_bits < 0 || store_segment_bits > 16) store_segment_bits = STORE_SEGMENT_BITS;
+    num_segments = 1 << store_segment_bits;
+    segment_shift = 32 - store_segment_bits;
+    segments = Calloc(num_segments, sizeof(STORE_SEGMENT));
+    for(int i = 0; i < num_segments; i++){
+        STORE_SEGMENT *sp = &segments[i];
+        pthread_mutex_init(&sp->mutex, NULL);
+        sp->table = store_table_create(NUM_BUCKETS);
+    }
+    index_init();
+    trans_set_validate_hook(store_occ ? store_occ_validate : NULL);
+    occ_validations = occ_conflicts = 0;
+    gc_passes = 0;
+    gc_last_pass_ms = gc_max_pass_ms = gc_busy_ms = 0;
+    debug("Store initialized with %d segments", num_segments);
+}
+
+/*
+ * Free all the entries in a table, along with the table itself.
+ */
+static void store_free_table(STORE_TABLE *tab){
+    for(int i = 0; i < tab->num_buckets; i++){
+        MAP_ENTRY *ep = tab->buckets[i];
+        while(ep != NULL){
+            MAP_ENTRY *next = ep->next;
+            VERSION *vp = ep->versions;
+            while(vp != NULL){
+                VERSION *vnext = vp->next;
+                version_dispose(vp);
+                vp = vnext;
+            }
+            key_dispose(ep->key);
+            Free(ep);
+            ep = next;
+        }
+    }
+    Free(tab);
+}
+
+/*
+ * Finalize the store.
+ */
+void store_fini(void){
+    store_gc_stop();
+    for(int i = 0; i < num_segments; i++){
+        STORE_SEGMENT *sp = &segments[i];
+        pthread_mutex_lock(&sp->mutex);
+        if(sp->old_table != NULL) store_free_table(sp->old_table);
+        store_free_table(sp->table);
+        pthread_mutex_unlock(&sp->mutex);
+        pthread_mutex_destroy(&sp->mutex);
+    }
+    Free(segments);
+    segments = NULL;
+    num_segments = 0;
+    index_fini();
+    trans_set_validate_hook(NULL);
+    // Everything disposed of above was only retired.
+    epoch_reclaim_all();
+}
+
+/*
+ * Put a key/value mapping in the store.  The key must not be NULL.
+ * The value may be NULL, in which case this operation amounts to
+ * deleting any existing mapping for the given key.
+ *
+ * This operation inherits the key and consumes one reference on
+ * the value.
+ *
+ * @param tp  The transaction in which the operation is being performed.
+ * @param key  The key.
+ * @param value  The value.
+ * @return  Updated status of the transation, either TRANS_PENDING,
+ *   or TRANS_ABORTED.  The purpose is to be able to avoid doing further
+ *   operations in an already aborted transaction.
+ */
+TRANS_STATUS store_put(TRANSACTION *tp, KEY *key, BLOB *value){
+    if(store_occ) return store_occ_put(tp, key, value);
+    return store_access(tp, key, value, NULL, NULL);
+}
+
+/*
+ * Get the value associated with a specified key.  A pointer to the
+ * associated value is stored in the specified variable.
+ *
+ * This operation inherits the key.  The caller is responsible for
+ * one reference on any returned value.
+ *
+ * @param tp  The transaction in which the operation is being performed.
+ * @param key  The key.
+ * @param valuep  A variable into which a returned value pointer may be
+ *   stored.  The value pointer stored may be NULL, indicating that there
+ *   is no value currently associated in the store with the specified key.
+ * @return  Updated status of the transation, either TRANS_PENDING,
+ *   or TRANS_ABORTED.  The purpose is to be able to avoid doing further
+ *   operations in an already aborted transaction.
+ */
+TRANS_STATUS store_get(TRANSACTION *tp, KEY *key, BLOB **valuep){
+    if(valuep == NULL) return TRANS_ABORTED;
+    *valuep = NULL;
+    TRANS_STATUS status;
+    BLOB *kb = NULL;
+    if(store_occ && tp != NULL && key != NULL && store_occ_own_write(tp, key, valuep)){
+        key_dispose(key);
+        return trans_get_status(tp);
+    }
+    if(store_fast_reads && tp != NULL && key != NULL && store_get_settled(tp, key, valuep)){
+        key_dispose(key);
+        status = trans_get_status(tp);
+    } else if(store_occ){
+        status = store_occ_read(tp, key, valuep, &kb);
+    } else {
+        status = store_access(tp, key, NULL, valuep, &kb);
+    }
+    if(kb != NULL){
+        BLOB *bp = vlog_load(*valuep);
+        if(bp != NULL) store_unspill(kb, *valuep, bp);
+        blob_unref(kb, "unspilled");
+        blob_unref(*valuep, "unspilled");
+        *valuep = bp;
+        if(bp == NULL) return trans_abort(trans_ref(tp, "aborting in store"));
+    }
+    // Values loaded from a snapshot are checked when they are first read.
+    if(blob_check(*valuep) < 0){
+        error("Value of %zu bytes does not match its checksum", (*valuep)->size);
+        blob_unref(*valuep, "corrupt value");
+        *valuep = NULL;
+        return trans_abort(trans_ref(tp, "aborting in store"));
+    }
+    return status;
+}
+
+/*
+ * Get the values for all the keys in a range, in key order.
+ * Each key in the range is read as if by store_get, so the scan follows
+ * the same rules about transaction IDs and dependencies.  In addition the
+ * range itself is recorded as having been read by the transaction, so that
+ * a transaction with a smaller ID can no longer create a key in it.
+ * Keys whose value is NULL are skipped.
+ *
+ * @param tp  The transaction in which the operation is being performed.
+ * @param lo  Lowest key in the range, or NULL for no lower bound.
+ * @param hi  Key just past the end of the range, or NULL for no upper bound.
+ * @param fn  Function called with each key and value.  It does not
+ *   inherit the references passed to it.  If it returns nonzero the scan is
+ *   stopped.
+ * @param arg  Argument passed through to fn.
+ * @return  Updated status of the transation, either TRANS_PENDING,
+ *   or TRANS_ABORTED.
+ */
+TRANS_STATUS store_scan(TRANSACTION *tp, BLOB *lo, BLOB *hi,
+                        int (*fn)(BLOB *key, BLOB *value, void *arg), void *arg){
+    if(tp == NULL || fn == NULL) return TRANS_ABORTED;
+    KEY **keys = NULL;
+    // Optimistic transactions do not mark the range (see store_ext.h).
+    int n = index_scan(lo, hi, store_occ ? 0 : tp->id, &keys);
+    TRANS_STATUS status = trans_get_status(tp);
+    int i = 0;
+    while(i < n && status != TRANS_ABORTED){
+        BLOB *kb = blob_ref(keys[i]->blob, "key for scan callback");
+        BLOB *value = NULL;
+        status = store_get(tp, keys[i++], &value);
+        int stop = status != TRANS_ABORTED && value != NULL && fn(kb, value, arg) != 0;
+        blob_unref(value, "scan callback done");
+        blob_unref(kb, "scan callback done");
+        if(stop) break;
+    }
+    for(; i < n; i++) key_dispose(keys[i]);
+    Free(keys);
+    return status;
+}
+
+/*
+ * Start a checkpoint.  From now until store_checkpoint_end(), garbage
+ * collection keeps every version that store_each_as_of() may need, and
+ * segments are not resized.  Only one checkpoint may be in progress.
+ */
+void store_checkpoint_begin(void){
+    __atomic_store_n(&gc_cut, 0, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Finish a checkpoint, letting garbage collection and resizing go on as
+ * before.
+ */
+void store_checkpoint_end(void){
+    __atomic_store_n(&gc_cut, STORE_NO_CUT, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Find the version of an entry that holds its value as of a commit
+ * sequence number: the last one created by a transaction that committed
+ * with a number up to seq.  Along the version list, committed versions
+ * have increasing sequence numbers, since a version is only created after
+ * every earlier one has committed or by a transaction that depends on it.
+ * The mutex of the segment containing the entry must be held.
+ *
+ * @param waitp  Variable into which a transaction that has been given a
+ *   number up to seq but is not yet committed is stored, if there is one,
+ *   with a new reference on it.  The answer is not known until it has
+ *   committed or aborted.
+ * @return  The version, or NULL if there is none.
+ */
+static VERSION *store_version_as_of(MAP_ENTRY *ep, unsigned long seq, TRANSACTION **waitp){
+    VERSION *found = NULL;
+    for(VERSION *vp = ep->versions; vp != NULL; vp = vp->next){
+        TRANS_STATUS status = trans_get_status(vp->creator);
+        if(status == TRANS_ABORTED) continue;
+        unsigned long s = trans_sequence(vp->creator);
+        if(s == 0 || s > seq) break;
+        if(status == TRANS_PENDING){
+            *waitp = trans_ref(vp->creator, "awaited by checkpoint");
+            return NULL;
+        }
+        found = vp;
+    }
+    return found;
+}
+
+/*
+ * Visit up to STORE_GC_BUCKETS buckets of a segment for store_each_as_of,
+ * starting at bucket *cursor, and advance *cursor.  A resize in progress
+ * is finished first, a batch at a time, so that the table being visited
+ * holds every entry.  If some value is not yet known, the batch is given up
+ * before calling fn for any of it, and tried again once the transaction
+ * it waits for is done.
+ *
+ * @return  Nonzero if the end of the table has been reached.
+ */
+static int store_visit_as_of(STORE_SEGMENT *sp, int *cursor, unsigned long seq,
+                             void (*fn)(BLOB *key, BLOB *value, void *arg), void *arg){
+    pthread_mutex_lock(&sp->mutex);
+    if(sp->old_table != NULL){
+        store_rehash_step(sp, STORE_GC_BUCKETS);
+        pthread_mutex_unlock(&sp->mutex);
+        return 0;
+    }
+    STORE_TABLE *tab = sp->table;
+    int end = *cursor + STORE_GC_BUCKETS < tab->num_buckets ? *cursor + STORE_GC_BUCKETS : tab->num_buckets;
+    TRANSACTION *wait = NULL;
+    for(int i = *cursor; i < end && wait == NULL; i++){
+        for(MAP_ENTRY *ep = tab->buckets[i]; ep != NULL && wait == NULL; ep = ep->next)
+            store_version_as_of(ep, seq, &wait);
+    }
+    if(wait != NULL){
+        pthread_mutex_unlock(&sp->mutex);
+        trans_wait(wait);
+        trans_unref(wait, "awaited by checkpoint");
+        return 0;
+    }
+    for(int i = *cursor; i < end; i++){
+        for(MAP_ENTRY *ep = tab->buckets[i]; ep != NULL; ep = ep->next){
+            VERSION *vp = store_version_as_of(ep, seq, &wait);
+            if(vp != NULL && vp->blob != NULL) fn(ep->key->blob, vp->blob, arg);
+        }
+    }
+    *cursor = end;
+    pthread_mutex_unlock(&sp->mutex);
+    return end >= tab->num_buckets;
+}
+
+/*
+ * Call a function with every key in the store and its value as of a commit
+ * sequence number (see transaction_ext.h), which is the value left by the
+ * transactions that committed with numbers up to seq.  Keys with no value
+ * then, or a NULL one, are skipped.  This must be called between
+ * store_checkpoint_begin() and store_checkpoint_end(), with seq chosen
+ * after the checkpoint began.
+ *
+ * Requests go on while the store is read: a segment mutex is held only
+ * for a batch of STORE_GC_BUCKETS buckets, and fn is called with it held,
+ * so fn must not call back into the store.  A transaction that had been
+ * given its number but was not yet committed when seq was chosen is
+ * waited for.
+ *
+ * @param seq  The commit sequence number.
+ * @param fn  Function called with each key and value.  It does not
+ *   inherit the references passed to it.
+ * @param arg  Argument passed through to fn.
+ */
+void store_each_as_of(unsigned long seq, void (*fn)(BLOB *key, BLOB *value, void *arg), void *arg){
+    __atomic_store_n(&gc_cut, seq, __ATOMIC_SEQ_CST);
+    for(int s = 0; s < num_segments; s++){
+        int cursor = 0;
+        while(!store_visit_as_of(&segments[s], &cursor, seq, fn, arg));
+    }
+}
+
+/*
+ * Get the current counters for the store.  The segments are locked one
+ * at a time, so the totals are not an atomic snapshot.  The max_chain field
+ * requires a walk over every bucket, so this is not meant for the request path.
+ *
+ * @param stp  Structure into which the counters are stored.
+ */
+void store_get_stats(STORE_STATS *stp){
+    memset(stp, 0, sizeof(*stp));
+    stp->num_segments = num_segments;
+    for(int s = 0; s < num_segments; s++){
+        STORE_SEGMENT *sp = &segments[s];
+        pthread_mutex_lock(&sp->mutex);
+        stp->num_entries += sp->num_entries;
+        stp->num_buckets += sp->table->num_buckets;
+        if(sp->old_table != NULL) stp->old_num_buckets += sp->old_table->num_buckets;
+        stp->grows += sp->grows;
+        stp->shrinks += sp->shrinks;
+        stp->rehashed += sp->rehashed;
+        stp->reclaimed += sp->reclaimed;
+        stp->cascaded += sp->cascaded;
+        stp->removed += sp->removed;
+        for(int t = 0; t < 2; t++){
+            STORE_TABLE *tab = t == 0 ? sp->table : sp->old_table;
+            for(int i = 0; tab != NULL && i < tab->num_buckets; i++){
+                size_t len = 0;
+                for(MAP_ENTRY *ep = tab->buckets[i]; ep != NULL; ep = ep->next) len++;
+                if(len > stp->max_chain) stp->max_chain = len;
+            }
+        }
+        pthread_mutex_unlock(&sp->mutex);
+    }
+    stp->load_factor = (double)stp->num_entries / stp->num_buckets;
+    pthread_mutex_lock(&gc_mutex);
+    stp->gc_passes = gc_passes;
+    stp->gc_last_pass_ms = gc_last_pass_ms;
+    stp->gc_max_pass_ms = gc_max_pass_ms;
+    stp->gc_busy_ms = gc_busy_ms;
+    pthread_mutex_unlock(&gc_mutex);
+    pthread_mutex_lock(&occ_mutex);
+    stp->occ_validations = occ_validations;
+    stp->occ_conflicts = occ_conflicts;
+    pthread_mutex_unlock(&occ_mutex);
+}
+
+/*
+ * Print one map entry and its version list to stderr.
+ */
+static void store_show_entry(MAP_ENTRY *ep){
+    BLOB *kb = ep->key->blob;
+    fprintf(stderr, "\t{key: %p [%.*s], versions: ", kb, (int)kb->size, kb->content);
+    for(VERSION *vp = ep->versions; vp != NULL; vp = vp->next){
+        fprintf(stderr, "{creator=%d (%s), ", vp->creator->id,
+                vp->creator->status == TRANS_COMMITTED ? "committed" :
+                vp->creator->status == TRANS_ABORTED ? "aborted" : "pending");
+        if(blob_is_spilled(vp->blob, NULL, NULL)) {
+            fprintf(stderr, "blob=%p (spilled)}", vp->blob);
+        } else if(vp->blob != NULL) {
+            fprintf(stderr, "blob=%p [%.*s]}", vp->blob, (int)vp->blob->size, vp->blob->content);
+        } else {
+            fprintf(stderr, "(NULL blob)}");
+        }
+    }
+    fprintf(stderr, "}\n");
+}
+
+/*
+ * Print the contents of the store to stderr.
+ * No locking is performed, so this is not thread-safe.
+ * This should only be used for debugging.
+ */
+void store_show(void){
+    fprintf(stderr, "CONTENTS OF STORE (%d segments):\n", num_segments);
+    for(int s = 0; s < num_segments; s++){
+        STORE_SEGMENT *sp = &segments[s];
+        for(int i = 0; i < sp->table->num_buckets; i++){
+            for(MAP_ENTRY *ep = sp->table->buckets[i]; ep != NULL; ep = ep->next){
+                fprintf(stderr, "%d/%d:", s, i);
+                store_show_entry(ep);
+            }
+        }
+        for(int i = sp->rehash_index; sp->old_table != NULL && i < sp->old_table->num_buckets; i++){
+            for(MAP_ENTRY *ep = sp->old_table->buckets[i]; ep != NULL; ep = ep->next){
+                fprintf(stderr, "%d/old %d:", s, i);
+                store_show_entry(ep);
+            }
+        }
+    }
+}
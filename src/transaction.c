@@ -1,7 +1,118 @@
+#include <time.h>
+#include <unistd.h>
 #include "transaction.h"
+#include "transaction_ext.h"
+#include "pool.h"
 #include "csapp.h"
 #include "debug.h" 
 
+/*
+ * The dependency set of a transaction is kept in TRANS_DEPS rather than in
+ * the depends list of transaction.h, which stays NULL.  The transactions
+ * are kept in an array, at first the inline one and later one on the heap,
+ * so that commit walks them in order without chasing pointers.  A small
+ * set is searched directly for duplicates; once it has more than
+ * TRANS_DEPS_INLINE members it also gets an open-addressing hash table on
+ * transaction ID, kept at most half full, so that adding stays O(1).
+ */
+#define TRANS_DEPS_INLINE 8
+
+typedef struct trans_deps {
+    TRANSACTION **items;        // The members, in the order added.
+    unsigned int count;
+    unsigned int capacity;      // Size of items.
+    TRANSACTION **table;        // Hash table of the members, or NULL.
+    unsigned int table_size;    // A power of two, or 0.
+    TRANSACTION *inline_items[TRANS_DEPS_INLINE];
+} TRANS_DEPS;
+
+/*
+ * Each transaction also keeps the reverse of the dependency sets: the list
+ * of its dependents, which are the transactions that added it to their
+ * dependency sets while it was pending.  Each entry holds a reference to
+ * the dependent.  When the transaction commits, it decrements the
+ * outstanding count of each dependent; when it aborts, it aborts each
+ * dependent, and so on down the chain (see trans_cascade_abort).  Either
+ * way the list is then freed, which breaks the reference cycle.
+ */
+typedef struct trans_dependent {
+    TRANSACTION *trans;
+    struct trans_dependent *next;
+} TRANS_DEPENDENT;
+
+/*
+ * Every transaction other than trans_list is allocated with some extra
+ * fields that transaction.h has no room for.
+ *
+ * The outstanding count is the number of dependencies still pending,
+ * plus 1 until the transaction starts to wait for them in trans_commit.
+ * Whoever brings it to 0 posts deps_sem, which is also posted when the
+ * transaction is aborted by a cascade, to wake it from its commit.
+ */
+typedef struct trans_ext {
+    TRANSACTION trans;          // Must be first.
+    TRANS_DEPS deps;            // Dependency set.
+    TRANS_DEPENDENT *dependents;// Transactions that depend on this one.
+    unsigned int outstanding;   // Pending dependencies, plus 1 (see above).
+    sem_t deps_sem;             // Posted when the commit may go on.
+    TRANS_WRITE *writes;        // Write set, oldest first.
+    TRANS_WRITE **writes_tail;  // Where the next write is linked in.
+    TRANS_READ *reads;          // Read set, newest first.
+    unsigned long sequence;     // Commit sequence number, or 0.
+} TRANS_EXT;
+
+/*
+ * Live transactions are kept in TRANS_SHARDS lists rather than in
+ * trans_list, so that creating and freeing them does not serialize on one
+ * list head.  A transaction goes in the shard picked by its ID, so
+ * transactions created one after another go in different shards.  Each
+ * shard list is doubly linked through the next and prev fields and ends
+ * in NULL; trans_list stays empty.  Shards are a cache line apart.
+ */
+typedef struct trans_shard {
+    pthread_mutex_t mutex;
+    TRANSACTION *head;
+    char pad[64 - (sizeof(pthread_mutex_t) + sizeof(TRANSACTION *)) % 64];
+} TRANS_SHARD;
+
+int trans_track_writes = 0;
+static TRANS_COMMIT_HOOK *commit_hook = NULL;
+static TRANS_COMMIT_HOOK *validate_hook = NULL;
+static unsigned long last_sequence = 0;
+static unsigned int next_id = 0;
+static TRANS_SHARD shards[TRANS_SHARDS];
+
+/*
+ * Transactions and write set entries come from object pools (see pool.h),
+ * so the request path does not go through malloc for them.
+ */
+static POOL trans_pool = POOL_INITIALIZER("transaction", sizeof(TRANS_EXT));
+static POOL dependent_pool = POOL_INITIALIZER("dependent", sizeof(TRANS_DEPENDENT));
+
+/*
+ * A committer spins for up to spin_limit rounds waiting for its
+ * dependencies before it sleeps.  The limit doubles each time spinning
+ * was enough, up to TRANS_SPIN_MAX, and halves each time it was not.  With
+ * a single CPU there is no spinning, since the dependency cannot make
+ * progress while the committer spins.  The counters below are updated
+ * with atomic operations.
+ */
+static int spin_limit = 0;
+static int spin_max = TRANS_SPIN_MAX;
+static size_t wait_commits = 0;
+static size_t wait_waits = 0;
+static size_t wait_spun = 0;
+static size_t wait_slept = 0;
+static size_t wait_histogram[TRANS_WAIT_BUCKETS];
+static POOL write_pool = POOL_INITIALIZER("write", sizeof(TRANS_WRITE));
+static POOL read_pool = POOL_INITIALIZER("read", sizeof(TRANS_READ));
+
+static void trans_cascade_abort(TRANSACTION *tp);
+
+static TRANS_SHARD *trans_shard(TRANSACTION *tp){
+    return &shards[tp->id % TRANS_SHARDS];
+}
+
 /*
  * Initialize the transaction manager.
  */
@@ -15,74 +126,64 @@ void trans_init(void){
     trans_list.prev = &trans_list;
     sem_init(&trans_list.sem, 0, 0);
     pthread_mutex_init(&trans_list.mutex, NULL);
+    for(int i = 0; i < TRANS_SHARDS; i++){
+        pthread_mutex_init(&shards[i].mutex, NULL);
+        shards[i].head = NULL;
+    }
+    spin_max = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? TRANS_SPIN_MAX : 0;
+    spin_limit = spin_max / 16;
 }
 
 /*
- * Finalize the transaction manager.
+ * Finalize the transaction manager.  Transactions still referenced from
+ * elsewhere (such as from versions in the store) are freed when those
+ * references are dropped, so they are only counted here.
  */
 void trans_fini(void){
-    TRANSACTION *transptr = &trans_list;
-    TRANSACTION *start = &trans_list;
-    while(transptr->next != start){
-        TRANSACTION *prevptr = transptr->prev;
-        prevptr->next = transptr->next;
-        pthread_mutex_lock(&transptr->mutex);
-        DEPENDENCY *dependent = transptr->depends;
-        DEPENDENCY *next = transptr->depends->next;
-        if(next != NULL){
-            while(dependent != NULL && next != NULL){
-                dependent->trans = NULL;
-                dependent->next = NULL;
-                Free(dependent);
-                dependent = NULL;
-                dependent = next;
-                next = next->next;
-            }
-            if(dependent != NULL){
-                dependent->trans = NULL;
-                dependent->next = NULL;
-                Free(dependent);
-                dependent = NULL;
-            }
-        } else{    // pthread_mutex_lock(&cr->mutex);
-            Free(dependent);
-        }
-        pthread_mutex_unlock(&transptr->mutex);
-        pthread_mutex_destroy(&transptr->mutex);
-        Free(transptr);
-        transptr = transptr->next;
-    }
+    size_t live = trans_count_live();
+    if(live > 0) debug("%zu transactions still live", live);
 }
 
 /*
- * Create a new transaction.
+ * Create a new transaction.  IDs come from a single atomic counter, so a
+ * transaction created after another has finished being created always
+ * gets a greater ID, which the store relies on for ordering.
  *
  * @return  A pointer to the new transaction (with reference count 1)
  * is returned if creation is successful, otherwise NULL is returned.
  */
-int idNum = 0;
-
 TRANSACTION *trans_create(void){
-    TRANSACTION *trans = Calloc(sizeof(char), sizeof(TRANSACTION));
-    if(trans == NULL) return NULL;
-    if(pthread_mutex_init(&trans->mutex, NULL) < 0 || sem_init(&trans->sem, 0, 0) < 0){
-        Free(trans);
+    TRANS_EXT *xp = pool_alloc(&trans_pool);
+    if(xp == NULL) return NULL;
+    xp->writes_tail = &xp->writes;
+    xp->deps.items = xp->deps.inline_items;
+    xp->deps.capacity = TRANS_DEPS_INLINE;
+    xp->outstanding = 1;
+    TRANSACTION *trans = &xp->trans;
+    if(pthread_mutex_init(&trans->mutex, NULL) < 0 || sem_init(&trans->sem, 0, 0) < 0 ||
+       sem_init(&xp->deps_sem, 0, 0) < 0){
+        pool_free(&trans_pool, xp);
         return NULL;
     }
     trans->depends = NULL;
-    trans->id = idNum;
-    idNum++;
-    trans->next = &trans_list;
-    trans->prev = trans_list.prev;
-    trans_list.prev = trans;
+    trans->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_SEQ_CST);
     trans->refcnt = 1;
     trans->status = TRANS_PENDING;
     trans->waitcnt = 0;
+    TRANS_SHARD *sp = trans_shard(trans);
+    pthread_mutex_lock(&sp->mutex);
+    trans->prev = NULL;
+    trans->next = sp->head;
+    if(sp->head != NULL) sp->head->prev = trans;
+    sp->head = trans;
+    pthread_mutex_unlock(&sp->mutex);
     return trans;
 }
 
 /*
- * Increase the reference count on a transaction.
+ * Increase the reference count on a transaction.  The count is changed
+ * with an atomic operation rather than under the transaction mutex, as
+ * for blobs (see blob_ref).
  *
  * @param tp  The transaction.
  * @param why  Short phrase explaining the purpose of the increase.
@@ -90,44 +191,102 @@ TRANSACTION *trans_create(void){
  */
 TRANSACTION *trans_ref(TRANSACTION *tp, char *why){
     if(tp == NULL) return NULL;
-    if(pthread_mutex_lock(&tp->mutex) < 0) return NULL;
-    tp->refcnt++;
-    if(pthread_mutex_unlock(&tp->mutex) < 0) return NULL;
+    __atomic_fetch_add(&tp->refcnt, 1, __ATOMIC_RELAXED);
     return tp;
 }
 
+/*
+ * Take a transaction whose last reference has been dropped out of its
+ * shard, so that its list links can be reused by trans_unref.
+ */
+static void trans_unlink(TRANSACTION *tp){
+    TRANS_SHARD *sp = trans_shard(tp);
+    pthread_mutex_lock(&sp->mutex);
+    if(tp->prev != NULL) tp->prev->next = tp->next;
+    else sp->head = tp->next;
+    if(tp->next != NULL) tp->next->prev = tp->prev;
+    pthread_mutex_unlock(&sp->mutex);
+}
+
 /*
  * Decrease the reference count on a transaction.
- * If the reference count reaches zero, the transaction is freed.
+ * If the reference count reaches zero, the transaction is freed.  The
+ * thread that drops the last reference synchronizes with every earlier
+ * release before freeing, and needs no lock, as nobody else can see the
+ * transaction any more.  Freeing a transaction releases its dependencies,
+ * which may free them in turn; since dependency chains can be long, those
+ * are put on a list linked through next and freed in a loop rather than
+ * by recursion.
  *
  * @param tp  The transaction.
  * @param why  Short phrase explaining the purpose of the decrease.
  */
 void trans_unref(TRANSACTION *tp, char *why){
     if(tp == NULL) return;
-    if(pthread_mutex_lock(&tp->mutex) < 0 || tp->refcnt <= 0) return;
-    tp->refcnt--;
-    if(tp->refcnt == 0){
-        DEPENDENCY *dep = NULL;
-        if(tp->depends != NULL) { 
-            dep = tp->depends;
-            while(dep->next != NULL){
-                Free(dep);
-                dep = dep->next;
+    if(__atomic_sub_fetch(&tp->refcnt, 1, __ATOMIC_RELEASE) != 0) return;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    trans_unlink(tp);
+    tp->next = NULL;
+    while(tp != NULL){
+        TRANSACTION *work = tp->next;
+        TRANS_DEPS *dp = &((TRANS_EXT *)tp)->deps;
+        for(unsigned int i = 0; i < dp->count; i++){
+            TRANSACTION *dtp = dp->items[i];
+            if(__atomic_sub_fetch(&dtp->refcnt, 1, __ATOMIC_RELEASE) == 0){
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                trans_unlink(dtp);
+                dtp->next = work;
+                work = dtp;
             }
-            Free(dep);
         }
-        tp->prev = tp->next;
-        tp->next->prev = tp->prev;
-        if(pthread_mutex_unlock(&tp->mutex) < 0 || pthread_mutex_destroy(&tp->mutex) < 0) return;
-        if(sem_destroy(&tp->sem) < 0) return;
-        Free(tp);
-    } else {
-        if(pthread_mutex_unlock(&tp->mutex) < 0) return;
+        if(dp->items != dp->inline_items) Free(dp->items);
+        Free(dp->table);
+        TRANS_WRITE *wp = ((TRANS_EXT *)tp)->writes;
+        while(wp != NULL){
+            TRANS_WRITE *next = wp->next;
+            blob_unref(wp->key, "write set freed");
+            blob_unref(wp->value, "write set freed");
+            pool_free(&write_pool, wp);
+            wp = next;
+        }
+        TRANS_READ *rp = ((TRANS_EXT *)tp)->reads;
+        while(rp != NULL){
+            TRANS_READ *next = rp->next;
+            blob_unref(rp->key, "read set freed");
+            pool_free(&read_pool, rp);
+            rp = next;
+        }
+        pthread_mutex_destroy(&tp->mutex);
+        sem_destroy(&tp->sem);
+        sem_destroy(&((TRANS_EXT *)tp)->deps_sem);
+        pool_free(&trans_pool, tp);
+        tp = work;
     }
 }
 
 
+/*
+ * Find the slot of a transaction in the hash table of a dependency set,
+ * or the empty slot where it would go.
+ */
+static TRANSACTION **trans_deps_slot(TRANS_DEPS *dp, TRANSACTION *dtp){
+    unsigned int mask = dp->table_size - 1;
+    unsigned int i = (dtp->id * 2654435761u) & mask;
+    while(dp->table[i] != NULL && dp->table[i] != dtp) i = (i + 1) & mask;
+    return &dp->table[i];
+}
+
+/*
+ * Rebuild the hash table of a dependency set with the given size.
+ */
+static void trans_deps_rehash(TRANS_DEPS *dp, unsigned int size){
+    Free(dp->table);
+    dp->table = Calloc(size, sizeof(TRANSACTION *));
+    dp->table_size = size;
+    for(unsigned int i = 0; i < dp->count; i++)
+        *trans_deps_slot(dp, dp->items[i]) = dp->items[i];
+}
+
 /*
  * Add a transaction to the dependency set for this transaction.
  *
@@ -136,28 +295,166 @@ void trans_unref(TRANSACTION *tp, char *why){
  */
 void trans_add_dependency(TRANSACTION *tp, TRANSACTION *dtp){
     if(tp == NULL || dtp == NULL) return;
+    TRANS_DEPS *dp = &((TRANS_EXT *)tp)->deps;
     if(pthread_mutex_lock(&tp->mutex) < 0) return;
-    DEPENDENCY *dep = Calloc(sizeof(char), sizeof(DEPENDENCY));
-    dep->trans = dtp;
-    dep->next = NULL;
-    if(tp->depends == NULL){
-        tp->depends = dep;
+    TRANSACTION **slot = NULL;
+    if(dp->table != NULL){
+        slot = trans_deps_slot(dp, dtp);
+        if(*slot != NULL){
+            pthread_mutex_unlock(&tp->mutex);
+            return;
+        }
     } else {
-        DEPENDENCY *depptr = tp->depends;
-        while(depptr->next != NULL){
-            //check if it contains it already
-            if(depptr->trans == dtp) {
+        for(unsigned int i = 0; i < dp->count; i++){
+            if(dp->items[i] == dtp){
                 pthread_mutex_unlock(&tp->mutex);
                 return;
             }
-            depptr = depptr->next;
         }
-        depptr->next = dep;
     }
-    trans_ref(dtp, NULL);
-    if(pthread_mutex_unlock(&tp->mutex) < 0) return;
-    tp->waitcnt++;
+    if(dp->count == dp->capacity){
+        dp->capacity *= 2;
+        if(dp->items == dp->inline_items){
+            dp->items = Malloc(dp->capacity * sizeof(TRANSACTION *));
+            memcpy(dp->items, dp->inline_items, sizeof(dp->inline_items));
+        } else {
+            dp->items = Realloc(dp->items, dp->capacity * sizeof(TRANSACTION *));
+        }
+    }
+    dp->items[dp->count++] = trans_ref(dtp, "added to dependency set");
+    if(slot != NULL && 2 * dp->count <= dp->table_size){
+        *slot = dtp;
+    } else if(dp->count > TRANS_DEPS_INLINE){
+        trans_deps_rehash(dp, dp->table_size ? 2 * dp->table_size : 4 * TRANS_DEPS_INLINE);
+    }
+    pthread_mutex_unlock(&tp->mutex);
 
+    // Register as a dependent.  The reference is taken before locking dtp,
+    // so that no two transaction mutexes are ever held at once.
+    TRANS_DEPENDENT *np = pool_alloc(&dependent_pool);
+    np->trans = trans_ref(tp, "registered as dependent");
+    pthread_mutex_lock(&dtp->mutex);
+    TRANS_STATUS status = dtp->status;
+    if(status == TRANS_PENDING){
+        np->next = ((TRANS_EXT *)dtp)->dependents;
+        ((TRANS_EXT *)dtp)->dependents = np;
+        __atomic_add_fetch(&((TRANS_EXT *)tp)->outstanding, 1, __ATOMIC_ACQ_REL);
+    }
+    pthread_mutex_unlock(&dtp->mutex);
+    if(status != TRANS_PENDING){
+        pool_free(&dependent_pool, np);
+        // The abort of dtp happened before it could cascade to tp.
+        if(status == TRANS_ABORTED) trans_cascade_abort(tp);
+        else trans_unref(tp, "dependency already committed");
+    }
+}
+
+/*
+ * Wake up every transaction waiting for this one to commit or abort, and
+ * take its list of dependents.  The transaction mutex must be held, and
+ * the status already final.
+ *
+ * @return  The dependents, for the caller to deal with once it has
+ *   released the mutex.
+ */
+static TRANS_DEPENDENT *trans_wake_waiters(TRANSACTION *tp){
+    while(tp->waitcnt > 0){
+        V(&tp->sem);
+        tp->waitcnt--;
+    }
+    TRANS_DEPENDENT *list = ((TRANS_EXT *)tp)->dependents;
+    ((TRANS_EXT *)tp)->dependents = NULL;
+    return list;
+}
+
+/*
+ * Abort a transaction and, through the lists of dependents, every
+ * transaction that depends on it directly or indirectly.  The work list
+ * is kept on the heap rather than on the stack, so a chain of any depth
+ * can be aborted.  Transactions that have already aborted are skipped
+ * (as are committed ones, which cannot depend on a pending transaction).
+ * Each aborted transaction is also woken, in case it is waiting in
+ * trans_commit.
+ *
+ * @param tp  The transaction, of which one reference is consumed.
+ */
+static void trans_cascade_abort(TRANSACTION *tp){
+    TRANS_DEPENDENT *work = NULL;
+    while(tp != NULL){
+        pthread_mutex_lock(&tp->mutex);
+        if(tp->status == TRANS_PENDING){
+            tp->status = TRANS_ABORTED;
+            TRANS_DEPENDENT *np = trans_wake_waiters(tp);
+            V(&((TRANS_EXT *)tp)->deps_sem);
+            while(np != NULL){
+                TRANS_DEPENDENT *next = np->next;
+                np->next = work;
+                work = np;
+                np = next;
+            }
+        }
+        pthread_mutex_unlock(&tp->mutex);
+        trans_unref(tp, "aborted");
+        tp = NULL;
+        if(work != NULL){
+            TRANS_DEPENDENT *np = work;
+            work = np->next;
+            tp = np->trans;
+            pool_free(&dependent_pool, np);
+        }
+    }
+}
+
+static inline void trans_cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static long trans_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * Record how long a commit waited for its dependencies.
+ */
+static void trans_record_wait(long ns, int spun){
+    int b = 0;
+    for(long us = ns / 1000; us > 0 && b < TRANS_WAIT_BUCKETS - 1; us >>= 1) b++;
+    __atomic_fetch_add(&wait_histogram[b], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&wait_waits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(spun ? &wait_spun : &wait_slept, 1, __ATOMIC_RELAXED);
+    int limit = __atomic_load_n(&spin_limit, __ATOMIC_RELAXED);
+    if(spun) limit = limit < spin_max / 2 ? 2 * limit + 1 : spin_max;
+    else limit /= 2;
+    __atomic_store_n(&spin_limit, limit, __ATOMIC_RELAXED);
+}
+
+/*
+ * Wait until every dependency of a committing transaction has committed,
+ * or the transaction has been aborted because one of them aborted.  The
+ * dependencies are not waited for one by one: the transaction drops the 1
+ * that its outstanding count started with, and if that leaves it nonzero,
+ * waits for the last dependency to bring it to 0.  It first spins
+ * briefly, and then sleeps on its own semaphore.
+ *
+ * @param tp  The transaction.
+ */
+static void trans_wait_dependencies(TRANSACTION *tp){
+    TRANS_EXT *xp = (TRANS_EXT *)tp;
+    __atomic_fetch_add(&wait_commits, 1, __ATOMIC_RELAXED);
+    if(__atomic_sub_fetch(&xp->outstanding, 1, __ATOMIC_ACQ_REL) != 0){
+        long start = trans_now_ns();
+        int limit = __atomic_load_n(&spin_limit, __ATOMIC_RELAXED), spun = 0;
+        for(int n = 0; n < limit && !spun; n++){
+            if(sem_trywait(&xp->deps_sem) == 0) spun = 1;
+            else trans_cpu_relax();
+        }
+        if(!spun) P(&xp->deps_sem);
+        trans_record_wait(trans_now_ns() - start, spun);
+    }
 }
 
 /*
@@ -175,34 +472,39 @@ void trans_add_dependency(TRANSACTION *tp, TRANSACTION *dtp){
  * or TRANS_COMMITTED.
  */
 TRANS_STATUS trans_commit(TRANSACTION *tp){
-    if(tp == NULL || tp->status == TRANS_ABORTED) return TRANS_ABORTED;
-    DEPENDENCY *dep = tp->depends;
-
-    //waits for the whole thing to finish
-    while(dep != NULL){
-        TRANSACTION *trans = dep->trans;
-        //semwait but with csapp wrapper
-        P(&trans->sem);
-        dep = dep->next;
+    if(tp == NULL) return TRANS_ABORTED;
+    if(trans_get_status(tp) == TRANS_ABORTED){
+        trans_unref(tp, "already aborted");
+        return TRANS_ABORTED;
     }
-
-    //check for aborted at all. Set to beginning
-    dep = tp->depends;
-    while(dep != NULL){
-        if(dep->trans->status == TRANS_ABORTED) return trans_abort(tp);
-        dep = dep->next;
+    if(validate_hook != NULL && validate_hook(tp) < 0) return trans_abort(tp);
+    if(((TRANS_EXT *)tp)->deps.count > 0){
+        trans_wait_dependencies(tp);
+        if(trans_get_status(tp) == TRANS_ABORTED) return trans_abort(tp);
     }
 
-    int count = tp->waitcnt;
+    if(commit_hook != NULL && commit_hook(tp) < 0) return trans_abort(tp);
 
-    while(count > 0){
-        //sempost in csapp
-        V(&tp->sem);
-        pthread_mutex_lock(&tp->mutex);
-        count--;
+    trans_assign_sequence(tp);
+    pthread_mutex_lock(&tp->mutex);
+    if(tp->status == TRANS_ABORTED){
         pthread_mutex_unlock(&tp->mutex);
+        trans_unref(tp, "aborted while committing");
+        return TRANS_ABORTED;
     }
     tp->status = TRANS_COMMITTED;
+    TRANS_DEPENDENT *np = trans_wake_waiters(tp);
+    pthread_mutex_unlock(&tp->mutex);
+    // A dependent may go on as soon as its count reaches 0, but the
+    // reference held for it keeps it from being freed until released here.
+    while(np != NULL){
+        TRANS_DEPENDENT *next = np->next;
+        if(__atomic_sub_fetch(&((TRANS_EXT *)np->trans)->outstanding, 1, __ATOMIC_ACQ_REL) == 0)
+            V(&((TRANS_EXT *)np->trans)->deps_sem);
+        trans_unref(np->trans, "dependency committed");
+        pool_free(&dependent_pool, np);
+        np = next;
+    }
     trans_unref(tp, "commited");
     return TRANS_COMMITTED;
 }
@@ -221,31 +523,162 @@ TRANS_STATUS trans_commit(TRANSACTION *tp){
  * @return  TRANS_ABORTED.
  */
 TRANS_STATUS trans_abort(TRANSACTION *tp){
-    if(tp == NULL || tp->status == TRANS_ABORTED) {
-        trans_unref(tp, "transaborted");
-        return TRANS_ABORTED;
-    }
+    if(tp == NULL) return TRANS_ABORTED;
+    pthread_mutex_lock(&tp->mutex);
     if(tp->status == TRANS_COMMITTED) {
+        pthread_mutex_unlock(&tp->mutex);
         trans_unref(tp, NULL);
         abort();
     }
-    if(tp->status == TRANS_PENDING) tp->status = TRANS_ABORTED;
+    pthread_mutex_unlock(&tp->mutex);
+    trans_cascade_abort(tp);
+    return TRANS_ABORTED;
+}
 
-    while(tp->waitcnt > 0){
-        V(&tp->sem);
-        pthread_mutex_lock(&tp->mutex);
-        tp->waitcnt--;
+/*
+ * Add a PUT to the write set of a transaction.
+ *
+ * @param tp  The transaction.
+ * @param key  The key blob, of which the write set takes a new reference.
+ * @param value  The value blob, of which the write set takes a new
+ *   reference, or NULL.
+ */
+void trans_add_write(TRANSACTION *tp, BLOB *key, BLOB *value){
+    if(tp == NULL || key == NULL) return;
+    TRANS_EXT *xp = (TRANS_EXT *)tp;
+    TRANS_WRITE *wp = pool_alloc(&write_pool);
+    wp->key = blob_ref(key, "added to write set");
+    wp->value = blob_ref(value, "added to write set");
+    wp->next = NULL;
+    *xp->writes_tail = wp;
+    xp->writes_tail = &wp->next;
+}
+
+/*
+ * Get the write set of a transaction.
+ *
+ * @param tp  The transaction.
+ * @return  The first write, or NULL if the write set is empty.  The writes
+ *   belong to the transaction and are freed with it.
+ */
+TRANS_WRITE *trans_get_writes(TRANSACTION *tp){
+    return tp != NULL ? ((TRANS_EXT *)tp)->writes : NULL;
+}
+
+/*
+ * Add a read to the read set of a transaction.
+ *
+ * @param tp  The transaction.
+ * @param key  The key blob, of which the read set takes a new reference.
+ * @param version  The ID of the creator of the version read, or 0.
+ */
+void trans_add_read(TRANSACTION *tp, BLOB *key, unsigned int version){
+    if(tp == NULL || key == NULL) return;
+    TRANS_EXT *xp = (TRANS_EXT *)tp;
+    TRANS_READ *rp = pool_alloc(&read_pool);
+    rp->key = blob_ref(key, "added to read set");
+    rp->version = version;
+    rp->next = xp->reads;
+    xp->reads = rp;
+}
+
+/*
+ * Get the read set of a transaction.
+ *
+ * @param tp  The transaction.
+ * @return  The first read, or NULL if the read set is empty.  The reads
+ *   belong to the transaction and are freed with it.
+ */
+TRANS_READ *trans_get_reads(TRANSACTION *tp){
+    return tp != NULL ? ((TRANS_EXT *)tp)->reads : NULL;
+}
+
+/*
+ * Set the commit hook, replacing any previous one.
+ *
+ * @param hook  The hook, or NULL for none.
+ */
+void trans_set_commit_hook(TRANS_COMMIT_HOOK *hook){
+    commit_hook = hook;
+}
+
+/*
+ * Set the validate hook, replacing any previous one.
+ *
+ * @param hook  The hook, or NULL for none.
+ */
+void trans_set_validate_hook(TRANS_COMMIT_HOOK *hook){
+    validate_hook = hook;
+}
+
+/*
+ * Wait until a transaction has committed or aborted.  Registering as a
+ * waiter and checking the status happen under the same lock that the
+ * status is changed under, so the wakeup cannot be missed.
+ *
+ * @param tp  The transaction, on which the caller must hold a reference.
+ * @return  The final status of the transaction.
+ */
+TRANS_STATUS trans_wait(TRANSACTION *tp){
+    pthread_mutex_lock(&tp->mutex);
+    if(tp->status == TRANS_PENDING){
+        tp->waitcnt++;
+        pthread_mutex_unlock(&tp->mutex);
+        //semwait but with csapp wrapper
+        P(&tp->sem);
+    } else {
         pthread_mutex_unlock(&tp->mutex);
     }
+    return trans_get_status(tp);
+}
 
-    DEPENDENCY *ptr = tp->depends;
-    while(ptr != NULL){
-        ptr->trans->status = TRANS_ABORTED;
-        ptr = ptr->next;
+/*
+ * Give a committing transaction its commit sequence number, if it does not
+ * have one yet.
+ *
+ * @param tp  The transaction.
+ * @return  The sequence number of the transaction.
+ */
+unsigned long trans_assign_sequence(TRANSACTION *tp){
+    TRANS_EXT *xp = (TRANS_EXT *)tp;
+    unsigned long seq = __atomic_load_n(&xp->sequence, __ATOMIC_SEQ_CST);
+    if(seq == 0){
+        seq = __atomic_add_fetch(&last_sequence, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&xp->sequence, seq, __ATOMIC_SEQ_CST);
     }
-    trans_unref(tp, NULL);
-debug("huh");
-    return TRANS_ABORTED;
+    return seq;
+}
+
+/*
+ * Get the counters for commit waits.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void trans_get_wait_stats(TRANS_WAIT_STATS *sp){
+    sp->commits = __atomic_load_n(&wait_commits, __ATOMIC_RELAXED);
+    sp->waits = __atomic_load_n(&wait_waits, __ATOMIC_RELAXED);
+    sp->spun = __atomic_load_n(&wait_spun, __ATOMIC_RELAXED);
+    sp->slept = __atomic_load_n(&wait_slept, __ATOMIC_RELAXED);
+    sp->spin_limit = __atomic_load_n(&spin_limit, __ATOMIC_RELAXED);
+    for(int i = 0; i < TRANS_WAIT_BUCKETS; i++)
+        sp->histogram[i] = __atomic_load_n(&wait_histogram[i], __ATOMIC_RELAXED);
+}
+
+/*
+ * Get the commit sequence number of a transaction.
+ *
+ * @param tp  The transaction.
+ * @return  The sequence number, or 0 if it has not been given one.
+ */
+unsigned long trans_sequence(TRANSACTION *tp){
+    return __atomic_load_n(&((TRANS_EXT *)tp)->sequence, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Get the greatest commit sequence number given out so far.
+ */
+unsigned long trans_last_sequence(void){
+    return __atomic_load_n(&last_sequence, __ATOMIC_SEQ_CST);
 }
 
 /*
@@ -279,14 +712,30 @@ void trans_show(TRANSACTION *tp){
 
 /*
  * Print information about all transactions to stderr.
- * No locking is performed, so this is not thread-safe.
- * This should only be used for debugging.
+ * Only the registry is locked, so this should only be used for debugging.
  */
 void trans_show_all(void){
-    TRANSACTION *ptr = trans_list.next;
-    while(ptr != &trans_list){
-        trans_show(ptr);
-        ptr = ptr->next;
+    for(int i = 0; i < TRANS_SHARDS; i++){
+        pthread_mutex_lock(&shards[i].mutex);
+        for(TRANSACTION *ptr = shards[i].head; ptr != NULL; ptr = ptr->next)
+            trans_show(ptr);
+        pthread_mutex_unlock(&shards[i].mutex);
+    }
+}
+
+/*
+ * Count the transactions that have not yet been freed.
+ *
+ * @return  The number of live transactions.
+ */
+size_t trans_count_live(void){
+    size_t count = 0;
+    for(int i = 0; i < TRANS_SHARDS; i++){
+        pthread_mutex_lock(&shards[i].mutex);
+        for(TRANSACTION *ptr = shards[i].head; ptr != NULL; ptr = ptr->next)
+            count++;
+        pthread_mutex_unlock(&shards[i].mutex);
     }
+    return count;
 }
  
\ No newline at end of file
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include "vlog.h"
+#include "data_ext.h"
+#include "hash.h"
+#include "csapp.h"
+#include "debug.h"
+
+/*
+ * Space is handed out from vlog_end with an atomic add, so spilling
+ * threads do not wait for each other.  The counters are updated the same
+ * way.
+ */
+static int vlog_fd = -1;
+static uint64_t vlog_end = 0;
+static size_t spills = 0;
+static size_t spilled_bytes = 0;
+static size_t reloads = 0;
+static uint64_t reload_ns = 0;
+static uint64_t reload_max_ns = 0;
+static size_t errors = 0;
+
+static uint64_t vlog_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Open the value log.
+ *
+ * @param path  Name of the file, which is replaced if it exists, or NULL
+ *   for an unnamed temporary file.
+ * @return  0 if successful, otherwise -1.
+ */
+int vlog_open(char *path){
+    int fd;
+    if(path == NULL){
+        char name[] = "/tmp/xacto_vlog.XXXXXX";
+        fd = mkstemp(name);
+        if(fd >= 0) unlink(name);
+    } else {
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    }
+    if(fd < 0){
+        error("Cannot create value log: %s", strerror(errno));
+        return -1;
+    }
+    vlog_end = 0;
+    spills = spilled_bytes = reloads = errors = 0;
+    reload_ns = reload_max_ns = 0;
+    __atomic_store_n(&vlog_fd, fd, __ATOMIC_RELEASE);
+    debug("Value log opened");
+    return 0;
+}
+
+/*
+ * Close the value log.  Spilled blobs must not be read after this.
+ */
+void vlog_close(void){
+    int fd = __atomic_exchange_n(&vlog_fd, -1, __ATOMIC_ACQ_REL);
+    if(fd >= 0) close(fd);
+}
+
+/*
+ * Write the content of a blob to the value log.
+ *
+ * @param bp  The blob, whose content must be in memory.
+ * @return  A spilled blob standing for the content, with one reference,
+ *   or NULL if the log is not open or could not be written.
+ */
+BLOB *vlog_spill(BLOB *bp){
+    int fd = __atomic_load_n(&vlog_fd, __ATOMIC_ACQUIRE);
+    if(fd < 0 || bp == NULL || bp->content == NULL) return NULL;
+    uint64_t offset = __atomic_fetch_add(&vlog_end, bp->size, __ATOMIC_RELAXED);
+    size_t done = 0;
+    while(done < bp->size){
+        ssize_t n = pwrite(fd, bp->content + done, bp->size - done, offset + done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0){
+            __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+            fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, bp->size);
+            return NULL;
+        }
+        done += n;
+    }
+    __atomic_fetch_add(&spills, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&spilled_bytes, bp->size, __ATOMIC_RELAXED);
+    return blob_create_spilled(bp->size, offset, hash_bytes(bp->content, bp->size, 0));
+}
+
+/*
+ * Read a spilled value back from the value log.
+ *
+ * @param bp  The spilled blob.
+ * @return  A new blob with the content, with one reference, or NULL if it
+ *   could not be read or did not match its hash.
+ */
+BLOB *vlog_load(BLOB *bp){
+    uint64_t offset, check;
+    int fd = __atomic_load_n(&vlog_fd, __ATOMIC_ACQUIRE);
+    if(fd < 0 || !blob_is_spilled(bp, &offset, &check)) return NULL;
+    uint64_t start = vlog_now_ns();
+    char *buf = Malloc(bp->size + 1);
+    size_t done = 0;
+    while(done < bp->size){
+        ssize_t n = pread(fd, buf + done, bp->size - done, offset + done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        done += n;
+    }
+    BLOB *loaded = NULL;
+    if(done == bp->size && hash_bytes(buf, bp->size, 0) == check){
+        buf[bp->size] = '\0';
+        loaded = blob_adopt(buf, bp->size);
+    } else {
+        error("Cannot read back value of %zu bytes from the value log", bp->size);
+        __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+        Free(buf);
+    }
+    uint64_t ns = vlog_now_ns() - start;
+    __atomic_fetch_add(&reloads, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&reload_ns, ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&reload_max_ns, __ATOMIC_RELAXED);
+    while(ns > max && !__atomic_compare_exchange_n(&reload_max_ns, &max, ns, 0,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return loaded;
+}
+
+/*
+ * Release the space of a spilled value.  This is called when a spilled
+ * blob is freed.
+ *
+ * @param offset  Where the value starts in the log.
+ * @param size  Size of the value.
+ */
+void vlog_release(uint64_t offset, size_t size){
+    int fd = __atomic_load_n(&vlog_fd, __ATOMIC_ACQUIRE);
+    if(fd < 0) return;
+    if(size > 0) fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size);
+    __atomic_fetch_sub(&spilled_bytes, size, __ATOMIC_RELAXED);
+}
+
+/*
+ * Get the counters for the value log.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void vlog_get_stats(VLOG_STATS *sp){
+    sp->resident_bytes = blob_resident_bytes();
+    sp->spills = __atomic_load_n(&spills, __ATOMIC_RELAXED);
+    sp->spilled_bytes = __atomic_load_n(&spilled_bytes, __ATOMIC_RELAXED);
+    sp->reloads = __atomic_load_n(&reloads, __ATOMIC_RELAXED);
+    sp->reload_avg_us = sp->reloads > 0 ? __atomic_load_n(&reload_ns, __ATOMIC_RELAXED) / 1e3 / sp->reloads : 0;
+    sp->reload_max_us = __atomic_load_n(&reload_max_ns, __ATOMIC_RELAXED) / 1e3;
+    sp->errors = __atomic_load_n(&errors, __ATOMIC_RELAXED);
+}
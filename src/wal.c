@@ -0,0 +1,514 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include "wal.h"
+#include "transaction_ext.h"
+#include "store.h"
+#include "hash.h"
+#include "csapp.h"
+#include "debug.h"
+
+typedef struct wal_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} WAL_HEADER;
+
+typedef struct wal_record {
+    uint32_t size;              // Size of the body that follows.
+    uint32_t count;             // Number of writes in the body.
+    uint64_t check;             // Hash of the body.
+} WAL_RECORD;
+
+/*
+ * In the body of a record, each write is a key size and a value size,
+ * followed by the key and the value.
+ */
+#define WAL_NULL_VALUE UINT32_MAX
+
+/*
+ * Everything below is protected by wal_mutex.  Records are appended to the
+ * pending buffer; the leader of a group swaps it for the spare buffer and
+ * writes and syncs it without the mutex.  appended and durable count bytes
+ * of records since the log was opened, so a committer knows its record is
+ * on disk once durable has passed the end of it.
+ */
+static pthread_mutex_t wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wal_cond = PTHREAD_COND_INITIALIZER;
+static char *wal_path = NULL;
+static int wal_fd = -1;
+static int wal_failed = 0;      // A write or sync failed; nothing more is durable.
+static int flushing = 0;        // A leader is writing and syncing.
+static char *pending = NULL;
+static size_t pending_len = 0, pending_size = 0;
+static size_t pending_count = 0;
+static char *spare = NULL;
+static size_t spare_size = 0;
+static uint64_t appended = 0;
+static uint64_t durable = 0;
+static WAL_STATS stats;
+
+int wal_group_window_us = 0;
+
+/*
+ * Encode the write set of a transaction as a log record.
+ *
+ * @param lenp  Variable into which the length of the record is stored.
+ * @return  The record, which the caller must free, or NULL if the write
+ *   set is empty.
+ */
+static char *wal_encode(TRANSACTION *tp, size_t *lenp){
+    TRANS_WRITE *writes = trans_get_writes(tp);
+    if(writes == NULL) return NULL;
+    size_t size = 0;
+    uint32_t count = 0;
+    for(TRANS_WRITE *wp = writes; wp != NULL; wp = wp->next){
+        size += 2 * sizeof(uint32_t) + wp->key->size + (wp->value != NULL ? wp->value->size : 0);
+        count++;
+    }
+    char *buf = Malloc(sizeof(WAL_RECORD) + size);
+    char *bp = buf + sizeof(WAL_RECORD);
+    for(TRANS_WRITE *wp = writes; wp != NULL; wp = wp->next){
+        uint32_t sizes[2] = { wp->key->size, wp->value != NULL ? wp->value->size : WAL_NULL_VALUE };
+        memcpy(bp, sizes, sizeof(sizes));
+        bp += sizeof(sizes);
+        if(wp->key->size > 0) memcpy(bp, wp->key->content, wp->key->size);
+        bp += wp->key->size;
+        if(wp->value != NULL && wp->value->size > 0) memcpy(bp, wp->value->content, wp->value->size);
+        if(wp->value != NULL) bp += wp->value->size;
+    }
+    WAL_RECORD rec = { .size = size, .count = count };
+    rec.check = hash_bytes(buf + sizeof(WAL_RECORD), size, 0);
+    memcpy(buf, &rec, sizeof(rec));
+    *lenp = sizeof(WAL_RECORD) + size;
+    return buf;
+}
+
+/*
+ * Write all of a buffer to the log and sync it.
+ *
+ * @return  0 if successful, otherwise -1.
+ */
+static int wal_write_sync(int fd, char *buf, size_t len){
+    while(len > 0){
+        ssize_t n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return fdatasync(fd);
+}
+
+/*
+ * Commit hook: append the write set of the transaction to the log and wait
+ * until it is on disk, leading a group commit if no one else is.
+ */
+static int wal_commit(TRANSACTION *tp){
+    size_t len;
+    char *rec = wal_encode(tp, &len);
+    if(rec == NULL) return 0;
+    pthread_mutex_lock(&wal_mutex);
+    if(wal_fd < 0 || wal_failed){
+        pthread_mutex_unlock(&wal_mutex);
+        Free(rec);
+        return -1;
+    }
+    if(pending_len + len > pending_size){
+        pending_size = pending_len + len > 2 * pending_size ? pending_len + len : 2 * pending_size;
+        pending = Realloc(pending, pending_size);
+    }
+    memcpy(pending + pending_len, rec, len);
+    Free(rec);
+    // Records are in the log in the order of their sequence numbers, so a
+    // rotation of the log is also a cut in that order.
+    trans_assign_sequence(tp);
+    pending_len += len;
+    pending_count++;
+    appended += len;
+    uint64_t end = appended;
+    stats.commits++;
+    stats.bytes += len;
+
+    while(durable < end && !wal_failed){
+        if(flushing){
+            pthread_cond_wait(&wal_cond, &wal_mutex);
+            continue;
+        }
+        flushing = 1;
+        if(wal_group_window_us > 0){
+            pthread_mutex_unlock(&wal_mutex);
+            usleep(wal_group_window_us);
+            pthread_mutex_lock(&wal_mutex);
+        }
+        char *buf = pending;
+        size_t buf_len = pending_len, buf_size = pending_size, count = pending_count;
+        uint64_t target = appended;
+        pending = spare;
+        pending_size = spare_size;
+        pending_len = pending_count = 0;
+        int fd = wal_fd;
+        pthread_mutex_unlock(&wal_mutex);
+        int err = wal_write_sync(fd, buf, buf_len);
+        pthread_mutex_lock(&wal_mutex);
+        spare = buf;
+        spare_size = buf_size;
+        if(err){
+            error("Write-ahead log write failed: %s", strerror(errno));
+            wal_failed = 1;
+        } else {
+            durable = target;
+            stats.syncs++;
+            if(count > stats.max_batch) stats.max_batch = count;
+        }
+        flushing = 0;
+        pthread_cond_broadcast(&wal_cond);
+    }
+    int ret = durable >= end ? 0 : -1;
+    pthread_mutex_unlock(&wal_mutex);
+    return ret;
+}
+
+/*
+ * Name of one of the other files of a log: the log name followed by a suffix.
+ * The caller must free the name.
+ */
+static char *wal_name(char *path, char *suffix){
+    size_t len = strlen(path), slen = strlen(suffix);
+    char *name = Malloc(len + slen + 1);
+    memcpy(name, path, len);
+    memcpy(name + len, suffix, slen + 1);
+    return name;
+}
+
+/*
+ * Create an empty log, replacing any file of the same name.
+ *
+ * @return  A descriptor open for appending, or -1 if the log could not be
+ *   created.
+ */
+static int wal_create(char *name){
+    int fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    WAL_HEADER h = { .version = WAL_VERSION };
+    memcpy(h.magic, WAL_MAGIC, sizeof(h.magic));
+    if(fd < 0 || wal_write_sync(fd, (char *)&h, sizeof(h)) < 0){
+        error("Cannot create write-ahead log %s: %s", name, strerror(errno));
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Append the records of one log to another log and sync it.
+ *
+ * @param fd  Descriptor of the log to copy from.
+ * @param name  Name of the log to append to.
+ * @return  0 if successful, otherwise -1.
+ */
+static int wal_append_to(int fd, char *name){
+    int dfd = open(name, O_WRONLY | O_APPEND);
+    if(dfd < 0) return -1;
+    char *buf = Malloc(65536);
+    off_t off = sizeof(WAL_HEADER);
+    ssize_t n;
+    int err = 0;
+    while(!err && (n = pread(fd, buf, 65536, off)) != 0){
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) err = -1;
+        else {
+            size_t len = n;
+            char *bp = buf;
+            while(!err && len > 0){
+                ssize_t m = write(dfd, bp, len);
+                if(m < 0 && errno == EINTR) continue;
+                if(m <= 0) err = -1;
+                else {
+                    bp += m;
+                    len -= m;
+                }
+            }
+            off += n;
+        }
+    }
+    Free(buf);
+    if(!err) err = fdatasync(dfd);
+    close(dfd);
+    return err;
+}
+
+/*
+ * Replay the records in a mapped log into the store, on behalf of a
+ * transaction.
+ *
+ * @param validp  Variable into which the length of the valid part of the
+ *   log is stored.
+ * @return  The number of records replayed, or -1 if the transaction aborted.
+ */
+static long wal_replay(TRANSACTION *tp, char *base, size_t size, size_t *validp){
+    size_t off = sizeof(WAL_HEADER);
+    long n = 0;
+    TRANS_STATUS status = TRANS_PENDING;
+    while(status != TRANS_ABORTED && size - off >= sizeof(WAL_RECORD)){
+        WAL_RECORD rec;
+        memcpy(&rec, base + off, sizeof(rec));
+        char *body = base + off + sizeof(WAL_RECORD);
+        if(rec.size > size - off - sizeof(WAL_RECORD) || hash_bytes(body, rec.size, 0) != rec.check)
+            break;
+        char *bp = body, *end = body + rec.size;
+        uint32_t i;
+        for(i = 0; i < rec.count && end - bp >= 2 * sizeof(uint32_t); i++){
+            uint32_t sizes[2];
+            memcpy(sizes, bp, sizeof(sizes));
+            bp += sizeof(sizes);
+            size_t vsize = sizes[1] == WAL_NULL_VALUE ? 0 : sizes[1];
+            if(sizes[0] > (size_t)(end - bp) || vsize > (size_t)(end - bp) - sizes[0]) break;
+            KEY *kp = key_create(blob_create(bp, sizes[0]));
+            bp += sizes[0];
+            BLOB *vb = sizes[1] == WAL_NULL_VALUE ? NULL : blob_create(bp, vsize);
+            bp += vsize;
+            status = store_put(tp, kp, vb);
+        }
+        if(i < rec.count) break;
+        off += sizeof(WAL_RECORD) + rec.size;
+        n++;
+    }
+    *validp = off;
+    return status == TRANS_ABORTED ? -1 : n;
+}
+
+/*
+ * Open one file of the log, creating it if it does not exist, replay it
+ * into the store on behalf of a transaction, and cut off anything after
+ * its last valid record.
+ *
+ * @param countp  Variable to which the number of records replayed is added.
+ * @return  A descriptor open for appending, or -1 if the file could not be
+ *   opened or replayed.
+ */
+static int wal_load(char *name, TRANSACTION *tp, long *countp){
+    int fd = open(name, O_RDWR | O_CREAT | O_APPEND, 0644);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0){
+        error("Cannot open write-ahead log %s: %s", name, strerror(errno));
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    size_t size = st.st_size, valid = size;
+    if(size == 0){
+        close(fd);
+        return wal_create(name);
+    }
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    WAL_HEADER *hp = (WAL_HEADER *)base;
+    if(base == MAP_FAILED || size < sizeof(WAL_HEADER) ||
+       memcmp(hp->magic, WAL_MAGIC, sizeof(hp->magic)) != 0 || hp->version != WAL_VERSION){
+        error("%s is not a write-ahead log of version %d", name, WAL_VERSION);
+        if(base != MAP_FAILED) munmap(base, size);
+        close(fd);
+        return -1;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+    long n = wal_replay(tp, base, size, &valid);
+    munmap(base, size);
+    if(n < 0){
+        error("Replay of write-ahead log %s failed", name);
+        close(fd);
+        return -1;
+    }
+    *countp += n;
+    if(valid < size){
+        // The rest was being written when the server stopped.
+        debug("Discarding %zu bytes at the end of %s", size - valid, name);
+        if(ftruncate(fd, valid) < 0 || fdatasync(fd) < 0){
+            error("Cannot truncate write-ahead log %s: %s", name, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/*
+ * Open the log, creating it if it does not exist, and replay it into the
+ * store, using a single transaction that is committed before this returns.
+ * If an old segment was left by a checkpoint that did not finish, it is
+ * replayed first, and the current segment is then appended to it, so that
+ * the log is back to a single file.
+ * This must be done after the store has been initialized (and any snapshot
+ * loaded) and before any other transaction is created.  From then on,
+ * trans_commit logs every transaction that wrote something.
+ *
+ * @param path  Name of the log file.
+ * @return  The number of transactions replayed, or -1 if the log could not
+ *   be opened or is not a log.
+ */
+long wal_open(char *path){
+    char *old = wal_name(path, WAL_OLD_SUFFIX), *new = wal_name(path, WAL_NEW_SUFFIX);
+    unlink(new);
+    int has_old = access(old, F_OK) == 0;
+    long n = 0;
+    TRANSACTION *tp = trans_create();
+    int ofd = has_old ? wal_load(old, tp, &n) : -1;
+    int fd = !has_old || ofd >= 0 ? wal_load(path, tp, &n) : -1;
+    if(ofd >= 0) close(ofd);
+    if(fd < 0){
+        trans_abort(tp);
+        Free(old);
+        Free(new);
+        return -1;
+    }
+    if(trans_commit(tp) != TRANS_COMMITTED){
+        error("Replay of write-ahead log %s failed", path);
+        close(fd);
+        Free(old);
+        Free(new);
+        return -1;
+    }
+    if(has_old){
+        if(wal_append_to(fd, old) < 0 || rename(old, path) < 0){
+            error("Cannot merge write-ahead log %s: %s", old, strerror(errno));
+            close(fd);
+            Free(old);
+            Free(new);
+            return -1;
+        }
+        close(fd);
+        fd = open(path, O_RDWR | O_APPEND);
+    }
+    Free(old);
+    Free(new);
+    if(fd < 0){
+        error("Cannot open write-ahead log %s: %s", path, strerror(errno));
+        return -1;
+    }
+    pthread_mutex_lock(&wal_mutex);
+    wal_path = strdup(path);
+    wal_fd = fd;
+    wal_failed = 0;
+    appended = durable = 0;
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&wal_mutex);
+    trans_track_writes = 1;
+    trans_set_commit_hook(wal_commit);
+    debug("Replayed %ld transactions from %s", n, path);
+    return n;
+}
+
+/*
+ * Start a new segment of the log, for a checkpoint.  Everything appended
+ * so far is synced and moved to the old segment, and later commits go to
+ * the new one.  If an old segment is already there, because an earlier
+ * checkpoint did not finish, the records are appended to it instead.
+ *
+ * @param seqp  Variable into which is stored the commit sequence number
+ *   (see transaction_ext.h) that separates the two segments: transactions
+ *   in the old segment have numbers up to it, and those in the new
+ *   segment have greater numbers.
+ * @return  0 if successful, -1 if the log is not open or could not be
+ *   rotated, in which case it stays as it was.
+ */
+int wal_rotate(unsigned long *seqp){
+    pthread_mutex_lock(&wal_mutex);
+    char *path = wal_path != NULL ? strdup(wal_path) : NULL;
+    pthread_mutex_unlock(&wal_mutex);
+    if(path == NULL) return -1;
+    char *old = wal_name(path, WAL_OLD_SUFFIX), *new = wal_name(path, WAL_NEW_SUFFIX);
+    // The new segment is prepared without the mutex, so that committers
+    // only wait for the renames, and for a sync they would do anyway.
+    int fd = wal_create(new);
+    int err = fd < 0;
+    pthread_mutex_lock(&wal_mutex);
+    while(flushing) pthread_cond_wait(&wal_cond, &wal_mutex);
+    if(!err) err = wal_fd < 0 || wal_failed;
+    if(!err && pending_len > 0){
+        if(wal_write_sync(wal_fd, pending, pending_len) < 0){
+            error("Write-ahead log write failed: %s", strerror(errno));
+            wal_failed = 1;
+            err = 1;
+        } else {
+            durable = appended;
+            stats.syncs++;
+            if(pending_count > stats.max_batch) stats.max_batch = pending_count;
+        }
+        pending_len = pending_count = 0;
+        pthread_cond_broadcast(&wal_cond);
+    }
+    if(!err){
+        int moved = 0;
+        if(access(old, F_OK) == 0){
+            err = wal_append_to(wal_fd, old) < 0;
+        } else {
+            err = rename(path, old) < 0;
+            moved = !err;
+        }
+        if(!err && rename(new, path) < 0){
+            // Put the current segment back where later commits will go.
+            if(moved) rename(old, path);
+            err = 1;
+        }
+        if(err) error("Cannot rotate write-ahead log %s: %s", path, strerror(errno));
+    }
+    if(err){
+        if(fd >= 0){
+            close(fd);
+            unlink(new);
+        }
+    } else {
+        close(wal_fd);
+        wal_fd = fd;
+        *seqp = trans_last_sequence();
+    }
+    pthread_mutex_unlock(&wal_mutex);
+    Free(old);
+    Free(new);
+    Free(path);
+    return err ? -1 : 0;
+}
+
+/*
+ * Remove the old segment of the log, once everything in it has been saved
+ * in some other way, such as in a snapshot.
+ *
+ * @return  0 if successful, otherwise -1.
+ */
+int wal_remove_old(void){
+    pthread_mutex_lock(&wal_mutex);
+    int ret = -1;
+    if(wal_path != NULL){
+        char *old = wal_name(wal_path, WAL_OLD_SUFFIX);
+        ret = unlink(old);
+        Free(old);
+    }
+    pthread_mutex_unlock(&wal_mutex);
+    return ret;
+}
+
+/*
+ * Close the log.  Transactions committed after this are not logged.
+ */
+void wal_close(void){
+    trans_set_commit_hook(NULL);
+    trans_track_writes = 0;
+    pthread_mutex_lock(&wal_mutex);
+    while(flushing) pthread_cond_wait(&wal_cond, &wal_mutex);
+    if(wal_fd >= 0) close(wal_fd);
+    wal_fd = -1;
+    Free(wal_path);
+    wal_path = NULL;
+    Free(pending);
+    Free(spare);
+    pending = spare = NULL;
+    pending_len = pending_size = spare_size = pending_count = 0;
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+/*
+ * Get the counters for the log.
+ *
+ * @param sp  Structure into which the counters are stored.
+ */
+void wal_get_stats(WAL_STATS *sp){
+    pthread_mutex_lock(&wal_mutex);
+    *sp = stats;
+    pthread_mutex_unlock(&wal_mutex);
+}
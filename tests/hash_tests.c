@@ -0,0 +1,45 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include "hash.h"
+
+#define MAX_LEN 3000
+#define SPLITS 20
+
+/*
+ * Hash data in pieces of random sizes, some of them empty.
+ */
+static uint64_t hash_pieces(unsigned char *data, size_t len, uint64_t seed, unsigned int *rand_seed) {
+    HASH_STATE hs;
+    hash_init(&hs, seed);
+    size_t done = 0;
+    while(done < len) {
+        size_t n = rand_r(rand_seed) % 70;
+        if(n > len - done) n = len - done;
+        hash_update(&hs, data + done, n);
+        done += n;
+    }
+    return hash_final(&hs);
+}
+
+Test(hash_suite, 00_known_values, .timeout = 5) {
+    // Published values of XXH64 with seed 0.
+    cr_assert_eq(hash_bytes("", 0, 0), 0xef46db3751d8e999ULL);
+    cr_assert_eq(hash_bytes("a", 1, 0), 0xd24ec4f1a98c6e5bULL);
+    cr_assert_eq(hash_bytes("abc", 3, 0), 0x44bc2cf5ad770999ULL);
+}
+
+Test(hash_suite, 01_pieces_match_whole, .timeout = 10) {
+    // Every length up to 100 covers each way the input can end within a
+    // stripe; longer ones are sampled.
+    unsigned char data[MAX_LEN];
+    unsigned int rand_seed = 7;
+    for(int i = 0; i < MAX_LEN; i++) data[i] = rand_r(&rand_seed);
+    for(size_t len = 0; len <= MAX_LEN; len += len < 100 ? 1 : 37) {
+        for(uint64_t seed = 0; seed < 2; seed++) {
+            uint64_t whole = hash_bytes(data, len, seed);
+            for(int i = 0; i < SPLITS; i++)
+                cr_assert_eq(hash_pieces(data, len, seed, &rand_seed), whole,
+                             "Hash of %zu bytes in pieces differs", len);
+        }
+    }
+}
@@ -0,0 +1,292 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "client_registry.h"
+#include "csapp.h"
+#include "data.h"
+#include "data_ext.h"
+#include "epoch.h"
+#include "protocol.h"
+#include "protocol_ext.h"
+#include "server_ext.h"
+#include "store_ext.h"
+#include "transaction.h"
+#include "vlog.h"
+
+extern CLIENT_REGISTRY *client_registry;
+
+static void init() {
+    if(client_registry == NULL) client_registry = creg_init();
+    trans_init();
+    store_init();
+}
+
+static void fini() {
+    store_fini();
+    vlog_close();
+    server_batch_retries = SERVER_BATCH_RETRIES;
+}
+
+static KEY *make_key(char *s) {
+    return key_create(blob_create(s, strlen(s)));
+}
+
+/*
+ * Start a thread serving one end of a socket pair, as the server would for
+ * a new connection, and return the other end.
+ */
+static int connect_server(void) {
+    int sv[2];
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0, "No socket pair");
+    int *fdp = Malloc(sizeof(int));
+    *fdp = sv[1];
+    pthread_t tid;
+    Pthread_create(&tid, NULL, xacto_client_service, fdp);
+    return sv[0];
+}
+
+/*
+ * Close our end of a connection, and wait until the server has closed its
+ * end, so that the serving thread is done with the store.
+ */
+static void hang_up(int fd) {
+    char buf[64];
+    shutdown(fd, SHUT_WR);
+    while(read(fd, buf, sizeof(buf)) > 0)
+        ;
+    close(fd);
+}
+
+static void send_pkt(int fd, uint8_t type, char *data) {
+    XACTO_PACKET pkt = { .type = type, .size = data != NULL ? strlen(data) : 0, .null = data == NULL };
+    cr_assert_eq(proto_send_packet(fd, &pkt, data), 0, "Packet not sent");
+}
+
+static void send_op(int fd, uint8_t type, char *key, char *value) {
+    send_pkt(fd, type, NULL);
+    send_pkt(fd, XACTO_KEY_PKT, key);
+    if(type == XACTO_PUT_PKT) send_pkt(fd, XACTO_VALUE_PKT, value);
+}
+
+/*
+ * Receive a packet of the given type and return its status.
+ */
+static int recv_type(int fd, uint8_t type) {
+    XACTO_PACKET pkt;
+    void *data = NULL;
+    cr_assert_eq(proto_recv_packet(fd, &pkt, &data), 0, "Connection closed");
+    cr_assert_eq(pkt.type, type, "Expected packet type %d, got %d", type, pkt.type);
+    Free(data);
+    return pkt.status;
+}
+
+/*
+ * Receive a VALUE packet and check its payload, NULL meaning a null packet.
+ */
+static void recv_value(int fd, char *expected) {
+    XACTO_PACKET pkt;
+    void *data = NULL;
+    cr_assert_eq(proto_recv_packet(fd, &pkt, &data), 0, "Connection closed");
+    cr_assert_eq(pkt.type, XACTO_VALUE_PKT, "Expected a VALUE packet, got type %d", pkt.type);
+    if(expected == NULL){
+        cr_assert(pkt.null, "Expected a null VALUE packet");
+    } else {
+        cr_assert(!pkt.null && ntohl(pkt.size) == strlen(expected) &&
+                  memcmp(data, expected, strlen(expected)) == 0, "Expected value %s", expected);
+    }
+    Free(data);
+}
+
+/*
+ * Make a transaction that has PUT a key and stays pending, so that any later
+ * transaction that PUTs the key depends on it and aborts when it does.
+ */
+static TRANSACTION *block_key(char *key) {
+    TRANSACTION *tp = trans_create();
+    cr_assert_eq(store_put(tp, make_key(key), blob_create("blocker", 7)), TRANS_PENDING);
+    return tp;
+}
+
+Test(server_suite, 00_batch_retried_after_abort, .init = init, .fini = fini, .timeout = 10) {
+    SERVER_BATCH_STATS before, after;
+    server_get_batch_stats(&before);
+    TRANSACTION *blocker = block_key("k0");
+    int fd = connect_server();
+    send_pkt(fd, XACTO_BATCH_PKT, NULL);
+    send_op(fd, XACTO_PUT_PKT, "k0", "batch");
+    send_op(fd, XACTO_GET_PKT, "k0", NULL);
+    send_pkt(fd, XACTO_COMMIT_PKT, NULL);
+    // The first try waits on the blocker and aborts with it.  The retry,
+    // in a new transaction, has nothing to wait for.
+    usleep(100000);
+    trans_abort(blocker);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_COMMITTED);
+    recv_value(fd, "batch");
+    server_get_batch_stats(&after);
+    cr_assert_eq(after.batches - before.batches, 1);
+    cr_assert_eq(after.commits - before.commits, 1);
+    cr_assert_eq(after.retries - before.retries, 1);
+    hang_up(fd);
+}
+
+Test(server_suite, 01_batch_values_only_on_commit, .init = init, .fini = fini, .timeout = 10) {
+    TRANSACTION *tp = trans_create();
+    cr_assert_eq(store_put(tp, make_key("k0"), blob_create("old", 3)), TRANS_PENDING);
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    server_batch_retries = 0;
+    TRANSACTION *blocker = block_key("k0");
+    int fd = connect_server();
+    send_pkt(fd, XACTO_BATCH_PKT, NULL);
+    send_op(fd, XACTO_GET_PKT, "k0", NULL);
+    send_op(fd, XACTO_PUT_PKT, "k0", "batch");
+    send_op(fd, XACTO_GET_PKT, "k0", NULL);
+    send_pkt(fd, XACTO_COMMIT_PKT, NULL);
+    usleep(100000);
+    trans_abort(blocker);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_ABORTED);
+    // No VALUE packets follow, so the next packet is the reply to a GET.
+    send_op(fd, XACTO_GET_PKT, "k0", NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_PENDING);
+    recv_value(fd, "old");
+    send_pkt(fd, XACTO_COMMIT_PKT, NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_COMMITTED);
+    hang_up(fd);
+}
+
+Test(server_suite, 02_batch_retries_bounded, .init = init, .fini = fini, .timeout = 10) {
+    // Each try waits on the next blocker, so every try aborts.
+    char *keys[] = { "k0", "k1", "k2" };
+    TRANSACTION *blockers[3];
+    for(int i = 0; i < 3; i++) blockers[i] = block_key(keys[i]);
+    server_batch_retries = 2;
+    SERVER_BATCH_STATS before, after;
+    server_get_batch_stats(&before);
+    int fd = connect_server();
+    send_pkt(fd, XACTO_BATCH_PKT, NULL);
+    for(int i = 0; i < 3; i++) send_op(fd, XACTO_PUT_PKT, keys[i], "batch");
+    send_op(fd, XACTO_GET_PKT, "k0", NULL);
+    send_pkt(fd, XACTO_COMMIT_PKT, NULL);
+    for(int i = 0; i < 3; i++) {
+        usleep(100000);
+        trans_abort(blockers[i]);
+    }
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_ABORTED);
+    server_get_batch_stats(&after);
+    cr_assert_eq(after.failures - before.failures, 1);
+    cr_assert_eq(after.retries - before.retries, 2);
+    hang_up(fd);
+}
+
+Test(server_suite, 03_malformed_batch_freed, .init = init, .fini = fini, .timeout = 10) {
+    epoch_reclaim_all();
+    size_t resident = blob_resident_bytes();
+    // Something other than a PUT or a GET in the batch.
+    int fd = connect_server();
+    send_pkt(fd, XACTO_BATCH_PKT, NULL);
+    send_op(fd, XACTO_PUT_PKT, "k0", "value");
+    send_op(fd, XACTO_GET_PKT, "k1", NULL);
+    send_pkt(fd, XACTO_SCAN_PKT, NULL);
+    XACTO_PACKET pkt;
+    cr_assert_neq(proto_recv_packet(fd, &pkt, NULL), 0, "Connection not closed");
+    hang_up(fd);
+    // A null key.
+    fd = connect_server();
+    send_pkt(fd, XACTO_BATCH_PKT, NULL);
+    send_op(fd, XACTO_PUT_PKT, "k0", "value");
+    send_op(fd, XACTO_GET_PKT, NULL, NULL);
+    cr_assert_neq(proto_recv_packet(fd, &pkt, NULL), 0, "Connection not closed");
+    hang_up(fd);
+    epoch_reclaim_all();
+    cr_assert_eq(blob_resident_bytes(), resident, "Blobs of the batch were not freed");
+}
+
+Test(server_suite, 04_connection_survives_commit, .init = init, .fini = fini, .timeout = 10) {
+    int fd = connect_server();
+    send_op(fd, XACTO_PUT_PKT, "k0", "first");
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_PENDING);
+    send_pkt(fd, XACTO_COMMIT_PKT, NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_COMMITTED);
+    // A transaction made now has read the key, so only a transaction made
+    // after it may PUT the key: the next request must start a new one.
+    // The pause lets a server that started one at the COMMIT do so first.
+    usleep(50000);
+    TRANSACTION *tp = trans_create();
+    BLOB *bp = NULL;
+    cr_assert_eq(store_get(tp, make_key("k0"), &bp), TRANS_PENDING);
+    blob_unref(bp, "test done");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    send_op(fd, XACTO_PUT_PKT, "k0", "second");
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_PENDING);
+    send_pkt(fd, XACTO_COMMIT_PKT, NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_COMMITTED);
+    send_op(fd, XACTO_GET_PKT, "k0", NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_PENDING);
+    recv_value(fd, "second");
+    send_pkt(fd, XACTO_COMMIT_PKT, NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_COMMITTED);
+    hang_up(fd);
+}
+
+Test(server_suite, 05_connection_survives_abort, .init = init, .fini = fini, .timeout = 10) {
+    int fd = connect_server();
+    send_op(fd, XACTO_PUT_PKT, "k1", "lost");
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_PENDING);
+    // A newer transaction writes the key, so the connection's is too old
+    // to read it.
+    TRANSACTION *tp = trans_create();
+    cr_assert_eq(store_put(tp, make_key("k0"), blob_create("newer", 5)), TRANS_PENDING);
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    send_op(fd, XACTO_GET_PKT, "k0", NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_ABORTED);
+    recv_value(fd, NULL);
+    // The next request starts a new transaction, which sees the newer
+    // value and not the PUT of the aborted one.
+    send_op(fd, XACTO_GET_PKT, "k0", NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_PENDING);
+    recv_value(fd, "newer");
+    send_op(fd, XACTO_GET_PKT, "k1", NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_PENDING);
+    recv_value(fd, NULL);
+    send_pkt(fd, XACTO_COMMIT_PKT, NULL);
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_COMMITTED);
+    hang_up(fd);
+}
+
+Test(server_suite, 06_batch_mid_transaction_closes, .init = init, .fini = fini, .timeout = 10) {
+    int fd = connect_server();
+    send_op(fd, XACTO_PUT_PKT, "k0", "value");
+    cr_assert_eq(recv_type(fd, XACTO_REPLY_PKT), TRANS_PENDING);
+    send_pkt(fd, XACTO_BATCH_PKT, NULL);
+    XACTO_PACKET pkt;
+    cr_assert_neq(proto_recv_packet(fd, &pkt, NULL), 0, "Connection not closed");
+    hang_up(fd);
+    // The transaction in progress was aborted with the connection.
+    TRANSACTION *tp = trans_create();
+    BLOB *bp = NULL;
+    cr_assert_eq(store_get(tp, make_key("k0"), &bp), TRANS_PENDING);
+    cr_assert_null(bp, "PUT of the aborted transaction is visible");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+}
+
+Test(server_suite, 07_shutdown_with_overlapping_connections, .init = init, .fini = fini, .timeout = 10) {
+    // A connects, then B, then B leaves while A stays.
+    int a = connect_server(), b = connect_server();
+    send_op(a, XACTO_GET_PKT, "k0", NULL);
+    cr_assert_eq(recv_type(a, XACTO_REPLY_PKT), TRANS_PENDING);
+    recv_value(a, NULL);
+    send_op(b, XACTO_GET_PKT, "k1", NULL);
+    cr_assert_eq(recv_type(b, XACTO_REPLY_PKT), TRANS_PENDING);
+    recv_value(b, NULL);
+    hang_up(b);
+    // Shutting down all connections ends A's too, and then the registry
+    // is empty.
+    creg_shutdown_all(client_registry);
+    creg_wait_for_empty(client_registry);
+    char c;
+    cr_assert_eq(read(a, &c, 1), 0, "Connection not shut down");
+    close(a);
+}
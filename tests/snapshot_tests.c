@@ -0,0 +1,206 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_FILE "/tmp/xacto_snapshot_test.snp"
+#define NUM_ACCOUNTS 16
+#define NUM_SNAPSHOTS 5
+
+static void init() {
+    unlink(SNAPSHOT_FILE);
+    trans_init();
+    store_init();
+}
+
+static void fini() {
+    store_fini();
+    snapshot_unmap();
+    unlink(SNAPSHOT_FILE);
+}
+
+static KEY *make_key(char *s) {
+    return key_create(blob_create(s, strlen(s)));
+}
+
+/*
+ * Replace the store with a fresh one loaded from the snapshot file.
+ */
+static long restart() {
+    store_fini();
+    snapshot_unmap();
+    store_init();
+    return snapshot_load(SNAPSHOT_FILE);
+}
+
+/*
+ * Overwrite one byte of the snapshot file, counting from the end if
+ * offset is negative.
+ */
+static void corrupt(long offset) {
+    FILE *f = fopen(SNAPSHOT_FILE, "r+");
+    cr_assert_not_null(f);
+    fseek(f, offset, offset < 0 ? SEEK_END : SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, -1, SEEK_CUR);
+    fputc(c ^ 0xff, f);
+    fclose(f);
+}
+
+static void put_committed(char *key, char *value) {
+    TRANSACTION *tp = trans_create();
+    store_put(tp, make_key(key), value != NULL ? blob_create(value, strlen(value)) : NULL);
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+}
+
+Test(snapshot_suite, 00_round_trip, .init = init, .fini = fini, .timeout = 5) {
+    put_committed("a", "old");
+    put_committed("a", "apple");
+    put_committed("b", "banana");
+    put_committed("gone", "x");
+    put_committed("gone", NULL);
+    // Not committed, so not in the snapshot.
+    TRANSACTION *pending = trans_create();
+    store_put(pending, make_key("c"), blob_create("cherry", 6));
+    cr_assert_eq(snapshot_write(SNAPSHOT_FILE), 0);
+    trans_abort(pending);
+
+    cr_assert_eq(restart(), 2);
+    TRANSACTION *tp = trans_create();
+    BLOB *bp = NULL;
+    cr_assert_eq(store_get(tp, make_key("a"), &bp), TRANS_PENDING);
+    cr_assert_not_null(bp, "Expected a value for a");
+    cr_assert_eq(bp->size, 5);
+    cr_assert_eq(memcmp(bp->content, "apple", 5), 0);
+    blob_unref(bp, "test done");
+    cr_assert_eq(store_get(tp, make_key("c"), &bp), TRANS_PENDING);
+    cr_assert_null(bp, "Expected no value for c");
+    cr_assert_eq(store_get(tp, make_key("gone"), &bp), TRANS_PENDING);
+    cr_assert_null(bp, "Expected no value for gone");
+    // Loaded values can be replaced like any others.
+    cr_assert_eq(store_put(tp, make_key("b"), blob_create("blueberry", 9)), TRANS_PENDING);
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+
+    cr_assert_eq(snapshot_write(SNAPSHOT_FILE), 0);
+    cr_assert_eq(restart(), 2);
+    tp = trans_create();
+    cr_assert_eq(store_get(tp, make_key("b"), &bp), TRANS_PENDING);
+    cr_assert_eq(memcmp(bp->content, "blueberry", 9), 0);
+    blob_unref(bp, "test done");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+}
+
+Test(snapshot_suite, 01_missing_file, .init = init, .fini = fini, .timeout = 5) {
+    cr_assert_eq(snapshot_load(SNAPSHOT_FILE), 0);
+}
+
+Test(snapshot_suite, 02_corrupt_header, .init = init, .fini = fini, .timeout = 5) {
+    put_committed("a", "apple");
+    cr_assert_eq(snapshot_write(SNAPSHOT_FILE), 0);
+    corrupt(20);
+    cr_assert_eq(restart(), -1);
+}
+
+Test(snapshot_suite, 03_corrupt_value, .init = init, .fini = fini, .timeout = 5) {
+    put_committed("a", "apple");
+    put_committed("b", "banana");
+    cr_assert_eq(snapshot_write(SNAPSHOT_FILE), 0);
+    // The last byte of the file belongs to the last value, "banana".
+    corrupt(-1);
+    // Values are only checked when they are read.
+    cr_assert_eq(restart(), 2);
+    TRANSACTION *tp = trans_create();
+    BLOB *bp = NULL;
+    cr_assert_eq(store_get(tp, make_key("a"), &bp), TRANS_PENDING);
+    cr_assert_eq(memcmp(bp->content, "apple", 5), 0);
+    blob_unref(bp, "test done");
+    cr_assert_eq(store_get(tp, make_key("b"), &bp), TRANS_ABORTED);
+    cr_assert_null(bp, "Expected no value for corrupt b");
+    trans_abort(tp);
+}
+
+static volatile int stop_transfers;
+
+static int get_int(TRANSACTION *tp, char *key, TRANS_STATUS *statusp) {
+    BLOB *bp = NULL;
+    *statusp = store_get(tp, make_key(key), &bp);
+    char buf[32] = "0";
+    if(bp != NULL) {
+        memcpy(buf, bp->content, bp->size);
+        buf[bp->size] = '\0';
+    }
+    blob_unref(bp, "test done");
+    return atoi(buf);
+}
+
+/*
+ * Move one unit at a time between accounts, so that the total stays the
+ * same in every consistent state of the store.
+ */
+static void *transfer(void *arg) {
+    unsigned int seed = (unsigned long)arg;
+    char from[16], to[16], buf[32];
+    while(!stop_transfers) {
+        snprintf(from, sizeof(from), "acct%d", rand_r(&seed) % NUM_ACCOUNTS);
+        snprintf(to, sizeof(to), "acct%d", rand_r(&seed) % NUM_ACCOUNTS);
+        if(strcmp(from, to) == 0) continue;
+        TRANSACTION *tp = trans_create();
+        TRANS_STATUS status;
+        int f = get_int(tp, from, &status);
+        int t = status != TRANS_ABORTED ? get_int(tp, to, &status) : 0;
+        if(status != TRANS_ABORTED) {
+            int n = snprintf(buf, sizeof(buf), "%d", f - 1);
+            status = store_put(tp, make_key(from), blob_create(buf, n));
+        }
+        if(status != TRANS_ABORTED) {
+            int n = snprintf(buf, sizeof(buf), "%d", t + 1);
+            store_put(tp, make_key(to), blob_create(buf, n));
+        }
+        trans_commit(tp);
+    }
+    return NULL;
+}
+
+Test(snapshot_suite, 04_consistent_while_writing, .init = init, .fini = fini, .timeout = 60) {
+    char key[16], name[64];
+    for(int i = 0; i < NUM_ACCOUNTS; i++) {
+        snprintf(key, sizeof(key), "acct%d", i);
+        put_committed(key, "100");
+    }
+    store_gc_start();
+    pthread_t tids[4];
+    stop_transfers = 0;
+    for(long i = 0; i < 4; i++)
+        pthread_create(&tids[i], NULL, transfer, (void *)(i + 1));
+    for(int s = 0; s < NUM_SNAPSHOTS; s++) {
+        usleep(20000);
+        snprintf(name, sizeof(name), "%s.%d", SNAPSHOT_FILE, s);
+        cr_assert_eq(snapshot_write(name), 0);
+    }
+    stop_transfers = 1;
+    for(int i = 0; i < 4; i++)
+        pthread_join(tids[i], NULL);
+
+    for(int s = 0; s < NUM_SNAPSHOTS; s++) {
+        snprintf(name, sizeof(name), "%s.%d", SNAPSHOT_FILE, s);
+        store_fini();
+        snapshot_unmap();
+        store_init();
+        cr_assert_eq(snapshot_load(name), NUM_ACCOUNTS);
+        unlink(name);
+        TRANSACTION *tp = trans_create();
+        TRANS_STATUS status;
+        int total = 0;
+        for(int i = 0; i < NUM_ACCOUNTS; i++) {
+            snprintf(key, sizeof(key), "acct%d", i);
+            total += get_int(tp, key, &status);
+        }
+        cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+        cr_assert_eq(total, NUM_ACCOUNTS * 100, "Snapshot %d is inconsistent: total %d", s, total);
+    }
+}
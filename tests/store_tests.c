@@ -0,0 +1,480 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "data.h"
+#include "data_ext.h"
+#include "epoch.h"
+#include "transaction.h"
+#include "store_ext.h"
+#include "transaction_ext.h"
+#include "vlog.h"
+
+#define NUM_KEYS 1100000
+
+static void init() {
+    trans_init();
+    store_init();
+}
+
+static void init_occ() {
+    store_occ = 1;
+    init();
+}
+
+static void fini() {
+    store_fini();
+    vlog_close();
+    store_memory_cap = 0;
+    store_occ = 0;
+}
+
+static KEY *make_key(char *s) {
+    return key_create(blob_create(s, strlen(s)));
+}
+
+Test(store_suite, 00_put_get, .init = init, .fini = fini, .timeout = 5) {
+    TRANSACTION *tp = trans_create();
+    BLOB *bp = NULL;
+    cr_assert_eq(store_put(tp, make_key("u:1"), blob_create("one", 3)), TRANS_PENDING);
+    cr_assert_eq(store_get(tp, make_key("u:1"), &bp), TRANS_PENDING);
+    cr_assert_not_null(bp, "Expected a value for u:1");
+    cr_assert_eq(bp->size, 3);
+    cr_assert_eq(memcmp(bp->content, "one", 3), 0);
+    blob_unref(bp, "test done");
+    cr_assert_eq(store_get(tp, make_key("u:2"), &bp), TRANS_PENDING);
+    cr_assert_null(bp, "Expected no value for u:2");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+}
+
+Test(store_suite, 01_million_keys_bounded_chains, .init = init, .fini = fini, .timeout = 120) {
+    TRANSACTION *tp = trans_create();
+    char buf[32];
+    for(int i = 0; i < NUM_KEYS; i++){
+        snprintf(buf, sizeof(buf), "u:%d", i);
+        cr_assert_eq(store_put(tp, make_key(buf), NULL), TRANS_PENDING);
+    }
+    STORE_STATS st;
+    store_get_stats(&st);
+    fprintf(stderr, "entries = %zu, buckets = %d, load = %.2f, grows = %zu, max chain = %zu\n",
+            st.num_entries, st.num_buckets, st.load_factor, st.grows, st.max_chain);
+    cr_assert_eq(st.num_entries, NUM_KEYS);
+    cr_assert_geq(st.num_buckets, NUM_KEYS / STORE_MAX_LOAD);
+    cr_assert_leq(st.load_factor, STORE_MAX_LOAD);
+    cr_assert_leq(st.max_chain, 16, "Longest chain was %zu", st.max_chain);
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+}
+
+static int collect(BLOB *key, BLOB *value, void *arg) {
+    char *out = arg;
+    strncat(out, key->content, key->size);
+    strcat(out, "=");
+    strncat(out, value->content, value->size);
+    strcat(out, ";");
+    return 0;
+}
+
+Test(store_suite, 02_scan_range, .init = init, .fini = fini, .timeout = 5) {
+    TRANSACTION *tp = trans_create();
+    char *keys[] = {"u:3", "a", "u:1", "u:2", "u:20", "v", "u:4"};
+    for(int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+        store_put(tp, make_key(keys[i]), blob_create("x", 1));
+    store_put(tp, make_key("u:25"), NULL);
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+
+    tp = trans_create();
+    char out[256] = "";
+    BLOB *lo = blob_create("u:2", 3), *hi = blob_create("u:4", 3);
+    cr_assert_eq(store_scan(tp, lo, hi, collect, out), TRANS_PENDING);
+    cr_assert_eq(strcmp(out, "u:2=x;u:20=x;u:3=x;"), 0, "Scan returned %s", out);
+    out[0] = '\0';
+    cr_assert_eq(store_scan(tp, NULL, lo, collect, out), TRANS_PENDING);
+    cr_assert_eq(strcmp(out, "a=x;u:1=x;"), 0, "Scan returned %s", out);
+    blob_unref(lo, "test done");
+    blob_unref(hi, "test done");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+}
+
+Test(store_suite, 03_scan_blocks_phantom, .init = init, .fini = fini, .timeout = 5) {
+    TRANSACTION *older = trans_create();
+    TRANSACTION *newer = trans_create();
+    char out[256] = "";
+    BLOB *lo = blob_create("u:", 2), *hi = blob_create("u;", 2);
+    cr_assert_eq(store_scan(newer, lo, hi, collect, out), TRANS_PENDING);
+    // The older transaction would have been seen by the scan, had it
+    // created the key first, so it may not create it now.
+    cr_assert_eq(store_put(older, make_key("u:7"), blob_create("x", 1)), TRANS_ABORTED);
+    cr_assert_eq(trans_get_status(older), TRANS_ABORTED);
+    trans_abort(older);
+    // Outside the scanned range is fine.
+    TRANSACTION *other = trans_create();
+    cr_assert_eq(store_put(newer, make_key("w"), blob_create("x", 1)), TRANS_PENDING);
+    cr_assert_eq(store_put(other, make_key("u:8"), blob_create("x", 1)), TRANS_PENDING);
+    blob_unref(lo, "test done");
+    blob_unref(hi, "test done");
+    cr_assert_eq(trans_commit(newer), TRANS_COMMITTED);
+    cr_assert_eq(trans_commit(other), TRANS_COMMITTED);
+}
+
+Test(store_suite, 04_settled_read, .init = init, .fini = fini, .timeout = 5) {
+    TRANSACTION *tp = trans_create();
+    BLOB *bp = NULL;
+    store_put(tp, make_key("k"), blob_create("v1", 2));
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+
+    TRANSACTION *writer = trans_create();
+    TRANSACTION *reader = trans_create();
+    for(int i = 0; i < 2; i++){
+        cr_assert_eq(store_get(reader, make_key("k"), &bp), TRANS_PENDING);
+        cr_assert_not_null(bp, "Expected a value for k");
+        cr_assert_eq(memcmp(bp->content, "v1", 2), 0);
+        blob_unref(bp, "test done");
+    }
+    // The reader left no version, but the older writer must still not
+    // overwrite what the reader has already read.
+    cr_assert_eq(store_put(writer, make_key("k"), blob_create("v0", 2)), TRANS_ABORTED);
+    trans_abort(writer);
+    cr_assert_eq(trans_commit(reader), TRANS_COMMITTED);
+
+    // A newer write unsettles the value, so readers see it and depend on it.
+    TRANSACTION *w2 = trans_create();
+    TRANSACTION *r2 = trans_create();
+    cr_assert_eq(store_put(w2, make_key("k"), blob_create("v2", 2)), TRANS_PENDING);
+    cr_assert_eq(store_get(r2, make_key("k"), &bp), TRANS_PENDING);
+    cr_assert_eq(memcmp(bp->content, "v2", 2), 0);
+    blob_unref(bp, "test done");
+    cr_assert_eq(trans_commit(w2), TRANS_COMMITTED);
+    cr_assert_eq(trans_commit(r2), TRANS_COMMITTED);
+}
+
+Test(store_suite, 05_gc_sweeps_cold_keys, .init = init, .fini = fini, .timeout = 10) {
+    char buf[32];
+    for(int round = 0; round < 3; round++){
+        TRANSACTION *tp = trans_create();
+        for(int i = 0; i < 1000; i++){
+            snprintf(buf, sizeof(buf), "c:%d", i);
+            store_put(tp, make_key(buf), blob_create("x", 1));
+        }
+        cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    }
+    // Keys nobody but an aborted transaction ever wrote.
+    TRANSACTION *tp = trans_create();
+    for(int i = 0; i < 500; i++){
+        snprintf(buf, sizeof(buf), "a:%d", i);
+        store_put(tp, make_key(buf), blob_create("x", 1));
+    }
+    trans_abort(tp);
+
+    STORE_STATS before, st;
+    store_get_stats(&before);
+    cr_assert_eq(before.num_entries, 1500);
+    store_gc_budget = 100;
+    store_gc_start();
+    do {
+        usleep(10000);
+        store_get_stats(&st);
+    } while(st.gc_passes == 0);
+    store_gc_stop();
+    store_gc_budget = STORE_GC_BUDGET;
+    fprintf(stderr, "reclaimed = %zu, removed = %zu, pass = %.2f ms\n",
+            st.reclaimed - before.reclaimed, st.removed, st.gc_last_pass_ms);
+    // One superseded version of each "c" key, and the aborted "a" versions.
+    cr_assert_eq(st.reclaimed - before.reclaimed, 1500);
+    cr_assert_eq(st.removed, 500);
+    cr_assert_eq(st.num_entries, 1000);
+    cr_assert_gt(st.gc_last_pass_ms, 0);
+
+    BLOB *bp = NULL;
+    tp = trans_create();
+    cr_assert_eq(store_get(tp, make_key("a:1"), &bp), TRANS_PENDING);
+    cr_assert_null(bp, "Expected no value for a:1");
+    cr_assert_eq(store_get(tp, make_key("c:1"), &bp), TRANS_PENDING);
+    cr_assert_not_null(bp, "Expected a value for c:1");
+    blob_unref(bp, "test done");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+}
+
+static void collect_as_of(BLOB *key, BLOB *value, void *arg) {
+    char *buf = arg;
+    strncat(buf, key->content, key->size);
+    strcat(buf, "=");
+    strncat(buf, value->content, value->size);
+    strcat(buf, ";");
+}
+
+Test(store_suite, 06_read_as_of, .init = init, .fini = fini, .timeout = 5) {
+    TRANSACTION *tp = trans_create();
+    store_put(tp, make_key("a"), blob_create("1", 1));
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    TRANSACTION *pending = trans_create();
+    store_put(pending, make_key("b"), blob_create("1", 1));
+
+    store_checkpoint_begin();
+    unsigned long seq = trans_last_sequence();
+    // Committed after the cut, so the checkpoint must not see these, and
+    // the version of a it does see must not be collected meanwhile.
+    cr_assert_eq(trans_commit(pending), TRANS_COMMITTED);
+    tp = trans_create();
+    store_put(tp, make_key("a"), blob_create("2", 1));
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    tp = trans_create();
+    BLOB *bp = NULL;
+    store_get(tp, make_key("a"), &bp);
+    blob_unref(bp, "test done");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+
+    char buf[64] = "";
+    store_each_as_of(seq, collect_as_of, buf);
+    store_checkpoint_end();
+    cr_assert_eq(strcmp(buf, "a=1;"), 0, "Got %s", buf);
+
+    buf[0] = '\0';
+    store_checkpoint_begin();
+    store_each_as_of(trans_last_sequence(), collect_as_of, buf);
+    store_checkpoint_end();
+    cr_assert(strcmp(buf, "a=2;b=1;") == 0 || strcmp(buf, "b=1;a=2;") == 0, "Got %s", buf);
+}
+
+Test(store_suite, 07_spill_cold_values, .init = init, .fini = fini, .timeout = 20) {
+    char key[32], value[256];
+    cr_assert_eq(vlog_open(NULL), 0);
+    TRANSACTION *tp = trans_create();
+    for(int i = 0; i < 2000; i++){
+        snprintf(key, sizeof(key), "s:%d", i);
+        memset(value, 'a' + i % 26, 200);
+        store_put(tp, make_key(key), blob_create(value, 200));
+    }
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+
+    VLOG_STATS st;
+    vlog_get_stats(&st);
+    size_t before = st.resident_bytes;
+    store_memory_cap = before / 4;
+    store_gc_budget = 100;
+    store_gc_start();
+    for(int i = 0; i < 500 && st.resident_bytes > store_memory_cap; i++){
+        usleep(10000);
+        vlog_get_stats(&st);
+    }
+    store_gc_stop();
+    store_gc_budget = STORE_GC_BUDGET;
+    fprintf(stderr, "resident %zu -> %zu bytes, %zu spills, %zu bytes spilled\n",
+            before, st.resident_bytes, st.spills, st.spilled_bytes);
+    cr_assert_leq(st.resident_bytes, store_memory_cap);
+    cr_assert_gt(st.spills, 0);
+    cr_assert_eq(st.reloads, 0);
+
+    // Every value reads back as written, and stays in memory once read.
+    for(int round = 0; round < 2; round++){
+        tp = trans_create();
+        for(int i = 0; i < 2000; i++){
+            BLOB *bp = NULL;
+            snprintf(key, sizeof(key), "s:%d", i);
+            memset(value, 'a' + i % 26, 200);
+            cr_assert_eq(store_get(tp, make_key(key), &bp), TRANS_PENDING);
+            cr_assert_not_null(bp, "Expected a value for %s", key);
+            cr_assert_eq(bp->size, 200);
+            cr_assert_eq(memcmp(bp->content, value, 200), 0, "Wrong value for %s", key);
+            blob_unref(bp, "test done");
+        }
+        cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+        VLOG_STATS now;
+        vlog_get_stats(&now);
+        cr_assert_eq(now.reloads, st.spills);
+        cr_assert_eq(now.errors, 0);
+    }
+}
+
+static sem_t entered, leave;
+
+static void *reader(void *arg) {
+    epoch_enter();
+    sem_post(&entered);
+    sem_wait(&leave);
+    epoch_exit();
+    return NULL;
+}
+
+Test(store_suite, 08_retired_blob_outlives_reader, .init = init, .fini = fini, .timeout = 10) {
+    char value[4096];
+    memset(value, 'x', sizeof(value));
+    size_t base = blob_resident_bytes();
+    BLOB *bp = blob_create(value, sizeof(value));
+
+    // A reader is in a read section when the last reference is dropped.
+    sem_init(&entered, 0, 0);
+    sem_init(&leave, 0, 0);
+    pthread_t tid;
+    pthread_create(&tid, NULL, reader, NULL);
+    sem_wait(&entered);
+    blob_unref(bp, "retired");
+    for(int i = 0; i < 1000; i++) blob_unref(blob_create("y", 1), "churn");
+    cr_assert_geq(blob_resident_bytes(), base + sizeof(value), "Blob freed under a reader");
+    cr_assert_eq(memcmp(bp->content, value, sizeof(value)), 0);
+
+    // Once the reader has left, later retirements free it.
+    sem_post(&leave);
+    pthread_join(tid, NULL);
+    for(int i = 0; i < 1000; i++) blob_unref(blob_create("y", 1), "churn");
+    cr_assert_lt(blob_resident_bytes(), base + sizeof(value), "Blob not freed after the reader left");
+}
+
+static int value_is(TRANSACTION *tp, char *key, char *expected) {
+    BLOB *bp = NULL;
+    store_get(tp, make_key(key), &bp);
+    int same = expected == NULL ? bp == NULL :
+        bp != NULL && bp->size == strlen(expected) && memcmp(bp->content, expected, bp->size) == 0;
+    blob_unref(bp, "test done");
+    return same;
+}
+
+Test(store_suite, 09_optimistic_mode, .init = init_occ, .fini = fini, .timeout = 5) {
+    TRANSACTION *tp = trans_create();
+    store_put(tp, make_key("k"), blob_create("0", 1));
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+
+    // An older transaction may write after a newer one has committed.
+    TRANSACTION *older = trans_create();
+    TRANSACTION *newer = trans_create();
+    store_put(newer, make_key("k"), blob_create("1", 1));
+    cr_assert(value_is(newer, "k", "1"), "Own write not seen");
+    tp = trans_create();
+    cr_assert(value_is(tp, "k", "0"), "Uncommitted write seen");
+    trans_abort(tp);
+    cr_assert_eq(trans_commit(newer), TRANS_COMMITTED);
+    store_put(older, make_key("k"), blob_create("x", 1));
+    store_put(older, make_key("j"), blob_create("x", 1));
+    cr_assert_eq(trans_commit(older), TRANS_COMMITTED);
+
+    // Of two transactions that read and then write the same key, the one
+    // that commits second has read a value that is gone.
+    TRANSACTION *t1 = trans_create();
+    TRANSACTION *t2 = trans_create();
+    cr_assert(value_is(t1, "k", "x"));
+    cr_assert(value_is(t2, "k", "x"));
+    store_put(t1, make_key("k"), blob_create("2", 1));
+    store_put(t2, make_key("k"), blob_create("3", 1));
+    cr_assert_eq(trans_commit(t2), TRANS_COMMITTED);
+    cr_assert_eq(trans_commit(t1), TRANS_ABORTED);
+
+    // A read of a missing key conflicts with its creation.
+    t1 = trans_create();
+    cr_assert(value_is(t1, "m", NULL));
+    tp = trans_create();
+    store_put(tp, make_key("m"), blob_create("4", 1));
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    store_put(t1, make_key("n"), blob_create("5", 1));
+    cr_assert_eq(trans_commit(t1), TRANS_ABORTED);
+
+    tp = trans_create();
+    cr_assert(value_is(tp, "k", "3"));
+    cr_assert(value_is(tp, "j", "x"));
+    cr_assert(value_is(tp, "m", "4"));
+    cr_assert(value_is(tp, "n", NULL));
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    STORE_STATS st;
+    store_get_stats(&st);
+    cr_assert_eq(st.occ_conflicts, 2);
+}
+
+#define SPILL_KEYS 500
+#define SPILL_SIZE 200
+
+static int spill_stop;
+
+/*
+ * Read random keys, each in a transaction of its own, and check their
+ * values, while the collector spills them.
+ */
+static void *spill_reader(void *arg) {
+    unsigned int seed = (unsigned long)arg;
+    char key[32], value[SPILL_SIZE];
+    long bad = 0;
+    while(!__atomic_load_n(&spill_stop, __ATOMIC_RELAXED)){
+        int i = rand_r(&seed) % SPILL_KEYS;
+        snprintf(key, sizeof(key), "r:%d", i);
+        memset(value, 'a' + i % 26, SPILL_SIZE);
+        TRANSACTION *tp = trans_create();
+        BLOB *bp = NULL;
+        if(store_get(tp, make_key(key), &bp) == TRANS_PENDING &&
+           (bp == NULL || bp->size != SPILL_SIZE || memcmp(bp->content, value, SPILL_SIZE) != 0))
+            bad++;
+        blob_unref(bp, "test done");
+        trans_commit(tp);
+    }
+    return (void *)bad;
+}
+
+Test(store_suite, 10_spill_races_settled_reads, .init = init, .fini = fini, .timeout = 30) {
+    char key[32], value[SPILL_SIZE];
+    cr_assert_eq(vlog_open(NULL), 0);
+    TRANSACTION *tp = trans_create();
+    for(int i = 0; i < SPILL_KEYS; i++){
+        snprintf(key, sizeof(key), "r:%d", i);
+        memset(value, 'a' + i % 26, SPILL_SIZE);
+        store_put(tp, make_key(key), blob_create(value, SPILL_SIZE));
+    }
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+
+    // With the cap at a quarter of the values, the collector keeps spilling
+    // values that the readers keep reading back, so settled reads race with
+    // the blobs of their versions being replaced.
+    VLOG_STATS st;
+    vlog_get_stats(&st);
+    store_memory_cap = st.resident_bytes / 4;
+    store_gc_budget = 100;
+    store_gc_start();
+    pthread_t tids[4];
+    for(long i = 0; i < 4; i++) pthread_create(&tids[i], NULL, spill_reader, (void *)(i + 1));
+    sleep(3);
+    __atomic_store_n(&spill_stop, 1, __ATOMIC_RELAXED);
+    long bad = 0;
+    for(int i = 0; i < 4; i++){
+        void *ret;
+        pthread_join(tids[i], &ret);
+        bad += (long)ret;
+    }
+    store_gc_stop();
+    store_gc_budget = STORE_GC_BUDGET;
+    vlog_get_stats(&st);
+    fprintf(stderr, "%zu spills, %zu reloads\n", st.spills, st.reloads);
+    cr_assert_eq(bad, 0, "%ld reads returned a wrong value", bad);
+    cr_assert_gt(st.spills, 0);
+    cr_assert_gt(st.reloads, 0);
+    cr_assert_eq(st.errors, 0);
+}
+
+Test(store_suite, 11_binary_keys, .init = init, .fini = fini, .timeout = 5) {
+    // Keys that differ only after a null byte are different keys.
+    char k1[] = { 'b', '\0', '1' }, k2[] = { 'b', '\0', '2' };
+    TRANSACTION *tp = trans_create();
+    store_put(tp, key_create(blob_create(k1, sizeof(k1))), blob_create("one", 3));
+    store_put(tp, key_create(blob_create(k2, sizeof(k2))), blob_create("two", 3));
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    tp = trans_create();
+    BLOB *v1 = NULL, *v2 = NULL;
+    cr_assert_eq(store_get(tp, key_create(blob_create(k1, sizeof(k1))), &v1), TRANS_PENDING);
+    cr_assert_eq(store_get(tp, key_create(blob_create(k2, sizeof(k2))), &v2), TRANS_PENDING);
+    cr_assert(v1 != NULL && v1->size == 3 && memcmp(v1->content, "one", 3) == 0, "Wrong value for b\\01");
+    cr_assert(v2 != NULL && v2->size == 3 && memcmp(v2->content, "two", 3) == 0, "Wrong value for b\\02");
+    blob_unref(v1, "test done");
+    blob_unref(v2, "test done");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+
+    // So do blobs with the same content up to a null byte, and blobs of
+    // different sizes of which one is a prefix of the other.
+    BLOB *b1 = blob_create(k1, sizeof(k1)), *b2 = blob_create(k2, sizeof(k2));
+    BLOB *shorter = blob_create("prefix", 6), *longer = blob_create("prefix-and-more", 15);
+    cr_assert_neq(blob_compare(b1, b2), 0);
+    cr_assert_neq(blob_compare(shorter, longer), 0);
+    cr_assert_neq(blob_compare(longer, shorter), 0);
+    BLOB *same = blob_create(k1, sizeof(k1));
+    cr_assert_eq(blob_compare(b1, same), 0);
+    blob_unref(b1, "test done");
+    blob_unref(b2, "test done");
+    blob_unref(shorter, "test done");
+    blob_unref(longer, "test done");
+    blob_unref(same, "test done");
+}
@@ -0,0 +1,146 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "transaction.h"
+#include "transaction_ext.h"
+
+#define NUM_THREADS 16
+#define TRANS_PER_THREAD 125000
+#define CHAIN_LENGTH 100000
+
+static void init() {
+    trans_init();
+}
+
+typedef struct {
+    unsigned int *ids;      // ID of each transaction, in creation order.
+    int ordered;            // Nonzero if the IDs kept increasing.
+} CREATOR;
+
+/*
+ * Create transactions back to back, keeping a few alive at a time so that
+ * creation and freeing overlap in the registry.
+ */
+static void *creator(void *arg) {
+    CREATOR *cp = arg;
+    TRANSACTION *live[4] = { NULL };
+    cp->ordered = 1;
+    for(int i = 0; i < TRANS_PER_THREAD; i++) {
+        TRANSACTION *tp = trans_create();
+        cp->ids[i] = tp->id;
+        if(i > 0 && cp->ids[i] <= cp->ids[i - 1]) cp->ordered = 0;
+        if(live[i % 4] != NULL) {
+            if(i % 2) trans_commit(live[i % 4]);
+            else trans_abort(live[i % 4]);
+        }
+        live[i % 4] = tp;
+    }
+    for(int i = 0; i < 4; i++) trans_commit(live[i]);
+    return NULL;
+}
+
+Test(transaction_suite, 00_unique_ordered_ids, .init = init, .timeout = 60) {
+    TRANSACTION *first = trans_create();
+    unsigned int base = first->id;
+    trans_commit(first);
+
+    pthread_t tids[NUM_THREADS];
+    CREATOR creators[NUM_THREADS];
+    for(int i = 0; i < NUM_THREADS; i++) {
+        creators[i].ids = malloc(TRANS_PER_THREAD * sizeof(unsigned int));
+        pthread_create(&tids[i], NULL, creator, &creators[i]);
+    }
+    for(int i = 0; i < NUM_THREADS; i++)
+        pthread_join(tids[i], NULL);
+
+    // Every ID after the first is used exactly once.
+    size_t total = (size_t)NUM_THREADS * TRANS_PER_THREAD;
+    char *seen = calloc(total, 1);
+    for(int i = 0; i < NUM_THREADS; i++) {
+        cr_assert(creators[i].ordered, "IDs of thread %d went backwards", i);
+        for(int j = 0; j < TRANS_PER_THREAD; j++) {
+            unsigned int n = creators[i].ids[j] - base - 1;
+            cr_assert_lt(n, total, "ID %u out of range", creators[i].ids[j]);
+            cr_assert_eq(seen[n], 0, "ID %u given out twice", creators[i].ids[j]);
+            seen[n] = 1;
+        }
+        free(creators[i].ids);
+    }
+    free(seen);
+
+    // A transaction created after all the others has a greater ID, and
+    // everything created by the threads has been freed.
+    TRANSACTION *last = trans_create();
+    cr_assert_eq(last->id, base + total + 1);
+    cr_assert_eq(trans_count_live(), 1);
+    trans_commit(last);
+    cr_assert_eq(trans_count_live(), 0);
+}
+
+Test(transaction_suite, 01_large_dependency_set, .init = init, .timeout = 10) {
+    TRANSACTION *deps[100];
+    for(int i = 0; i < 100; i++)
+        deps[i] = trans_create();
+    TRANSACTION *tp = trans_create();
+    // Each dependency is added three times but counted once.
+    for(int k = 0; k < 3; k++) {
+        for(int i = 0; i < 100; i++)
+            trans_add_dependency(tp, deps[i]);
+    }
+    for(int i = 0; i < 100; i++)
+        cr_assert_eq(deps[i]->refcnt, 2, "Dependency %d has %d references", i, deps[i]->refcnt);
+    for(int i = 0; i < 99; i++)
+        cr_assert_eq(trans_commit(deps[i]), TRANS_COMMITTED);
+    trans_abort(deps[99]);
+    cr_assert_eq(trans_commit(tp), TRANS_ABORTED);
+    cr_assert_eq(trans_count_live(), 0);
+}
+
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+typedef struct {
+    TRANSACTION *tp;
+    TRANS_STATUS status;
+    long done_ns;
+} COMMITTER;
+
+static void *committer(void *arg) {
+    COMMITTER *cp = arg;
+    cp->status = trans_commit(cp->tp);
+    cp->done_ns = now_ns();
+    return NULL;
+}
+
+Test(transaction_suite, 02_cascading_abort_deep_chain, .init = init, .timeout = 30) {
+    // Each transaction depends on the one before it.
+    TRANSACTION **chain = malloc((CHAIN_LENGTH + 1) * sizeof(TRANSACTION *));
+    for(int i = 0; i <= CHAIN_LENGTH; i++) {
+        chain[i] = trans_create();
+        if(i > 0) trans_add_dependency(chain[i], chain[i - 1]);
+    }
+    // The last one waits in commit until the abort reaches it.
+    COMMITTER c = { .tp = chain[CHAIN_LENGTH] };
+    pthread_t tid;
+    pthread_create(&tid, NULL, committer, &c);
+    usleep(100000);
+    long start = now_ns();
+    trans_abort(chain[0]);
+    pthread_join(tid, NULL);
+    fprintf(stderr, "abort reached the end of a chain of %d in %.2f ms\n",
+            CHAIN_LENGTH, (c.done_ns - start) / 1e6);
+    cr_assert_eq(c.status, TRANS_ABORTED);
+
+    for(int i = 1; i < CHAIN_LENGTH; i++) {
+        cr_assert_eq(trans_get_status(chain[i]), TRANS_ABORTED, "Transaction %d did not abort", i);
+        cr_assert_eq(trans_commit(chain[i]), TRANS_ABORTED);
+    }
+    free(chain);
+    cr_assert_eq(trans_count_live(), 0);
+}
@@ -0,0 +1,174 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "data.h"
+#include "transaction.h"
+#include "store_ext.h"
+#include "transaction_ext.h"
+#include "wal.h"
+
+#define WAL_FILE "/tmp/xacto_wal_test.log"
+#define NUM_THREADS 8
+#define COMMITS_PER_THREAD 50
+
+static void init() {
+    unlink(WAL_FILE);
+    unlink(WAL_FILE WAL_OLD_SUFFIX);
+    trans_init();
+    store_init();
+}
+
+static void fini() {
+    wal_close();
+    store_fini();
+    unlink(WAL_FILE);
+    unlink(WAL_FILE WAL_OLD_SUFFIX);
+}
+
+static KEY *make_key(char *s) {
+    return key_create(blob_create(s, strlen(s)));
+}
+
+/*
+ * Simulate a crash and restart: the store is thrown away and rebuilt from
+ * the log alone.
+ */
+static long restart() {
+    wal_close();
+    store_fini();
+    store_init();
+    return wal_open(WAL_FILE);
+}
+
+static void put_committed(char *key, char *value) {
+    TRANSACTION *tp = trans_create();
+    store_put(tp, make_key(key), value != NULL ? blob_create(value, strlen(value)) : NULL);
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+}
+
+/*
+ * Get the committed value of a key as a string, or NULL.
+ */
+static char *get_committed(char *key, char *buf) {
+    TRANSACTION *tp = trans_create();
+    BLOB *bp = NULL;
+    store_get(tp, make_key(key), &bp);
+    char *ret = NULL;
+    if(bp != NULL) {
+        memcpy(buf, bp->content, bp->size);
+        buf[bp->size] = '\0';
+        ret = buf;
+    }
+    blob_unref(bp, "test done");
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    return ret;
+}
+
+static size_t file_size() {
+    struct stat st;
+    cr_assert_eq(stat(WAL_FILE, &st), 0);
+    return st.st_size;
+}
+
+Test(wal_suite, 00_replay, .init = init, .fini = fini, .timeout = 5) {
+    char buf[64];
+    cr_assert_eq(wal_open(WAL_FILE), 0);
+    put_committed("a", "1");
+    put_committed("b", "2");
+    TRANSACTION *tp = trans_create();
+    store_put(tp, make_key("a"), blob_create("3", 1));
+    store_put(tp, make_key("b"), NULL);
+    store_put(tp, make_key("a"), blob_create("4", 1));
+    cr_assert_eq(trans_commit(tp), TRANS_COMMITTED);
+    // Neither an aborted nor a pending transaction is logged.
+    tp = trans_create();
+    store_put(tp, make_key("c"), blob_create("aborted", 7));
+    trans_abort(tp);
+    tp = trans_create();
+    store_put(tp, make_key("d"), blob_create("pending", 7));
+    // Nor is a transaction that only reads.
+    cr_assert_str_eq(get_committed("a", buf), "4");
+
+    WAL_STATS st;
+    wal_get_stats(&st);
+    cr_assert_eq(st.commits, 3);
+
+    cr_assert_eq(restart(), 3);
+    cr_assert_str_eq(get_committed("a", buf), "4");
+    cr_assert_null(get_committed("b", buf));
+    cr_assert_null(get_committed("c", buf));
+    cr_assert_null(get_committed("d", buf));
+    trans_abort(tp);
+}
+
+Test(wal_suite, 01_torn_tail, .init = init, .fini = fini, .timeout = 5) {
+    char buf[64];
+    cr_assert_eq(wal_open(WAL_FILE), 0);
+    put_committed("a", "1");
+    put_committed("b", "2");
+    wal_close();
+    size_t good = file_size();
+    // Cut the last record short, as if the server stopped while writing it.
+    cr_assert_eq(truncate(WAL_FILE, good - 3), 0);
+    cr_assert_eq(restart(), 1);
+    cr_assert_str_eq(get_committed("a", buf), "1");
+    cr_assert_null(get_committed("b", buf));
+    // The torn record is cut off, so new records follow the good ones.
+    put_committed("c", "3");
+    cr_assert_eq(restart(), 2);
+    cr_assert_str_eq(get_committed("c", buf), "3");
+}
+
+Test(wal_suite, 02_rotate, .init = init, .fini = fini, .timeout = 5) {
+    char buf[64];
+    unsigned long seq;
+    cr_assert_eq(wal_open(WAL_FILE), 0);
+    put_committed("a", "1");
+    cr_assert_eq(wal_rotate(&seq), 0);
+    cr_assert_eq(access(WAL_FILE WAL_OLD_SUFFIX, F_OK), 0);
+    put_committed("b", "2");
+    // Without the checkpoint finishing, both segments are replayed and
+    // then merged back into one.
+    cr_assert_eq(restart(), 2);
+    cr_assert_neq(access(WAL_FILE WAL_OLD_SUFFIX, F_OK), 0);
+    cr_assert_str_eq(get_committed("a", buf), "1");
+    cr_assert_str_eq(get_committed("b", buf), "2");
+    // Reads are not logged, so the segment that follows is empty.
+    cr_assert_eq(wal_rotate(&seq), 0);
+    cr_assert_eq(seq, trans_last_sequence());
+    put_committed("c", "3");
+    cr_assert_eq(wal_remove_old(), 0);
+    cr_assert_eq(restart(), 1);
+    cr_assert_null(get_committed("a", buf));
+    cr_assert_str_eq(get_committed("c", buf), "3");
+}
+
+static void *committer(void *arg) {
+    char key[32];
+    for(int i = 0; i < COMMITS_PER_THREAD; i++) {
+        snprintf(key, sizeof(key), "t%ld:%d", (long)arg, i);
+        TRANSACTION *tp = trans_create();
+        store_put(tp, make_key(key), blob_create(key, strlen(key)));
+        trans_commit(tp);
+    }
+    return NULL;
+}
+
+Test(wal_suite, 03_group_commit, .init = init, .fini = fini, .timeout = 30) {
+    char buf[64];
+    cr_assert_eq(wal_open(WAL_FILE), 0);
+    pthread_t tids[NUM_THREADS];
+    for(long i = 0; i < NUM_THREADS; i++)
+        pthread_create(&tids[i], NULL, committer, (void *)i);
+    for(int i = 0; i < NUM_THREADS; i++)
+        pthread_join(tids[i], NULL);
+    WAL_STATS st;
+    wal_get_stats(&st);
+    fprintf(stderr, "commits = %zu, syncs = %zu, max batch = %zu\n", st.commits, st.syncs, st.max_batch);
+    cr_assert_eq(st.commits, NUM_THREADS * COMMITS_PER_THREAD);
+    cr_assert_leq(st.syncs, st.commits);
+    cr_assert_eq(restart(), NUM_THREADS * COMMITS_PER_THREAD);
+    cr_assert_str_eq(get_committed("t3:49", buf), "t3:49");
+}